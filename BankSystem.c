@@ -2,40 +2,1029 @@
 // Author: Skim
 // Description: A comprehensive banking system with account management, transactions, and audit logging
 
+// CPU affinity calls for the server's shard workers
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
 // Standard library includes for I/O, string manipulation, memory allocation, time functions, and character handling
 #include <stdio.h> 
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #include <immintrin.h>
+#endif
 
-// Platform-specific directory creation
+// Platform-specific directory creation and raw file I/O
 #ifdef _WIN32
     #include <direct.h>
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <windows.h>
     #define mkdir(path, mode) _mkdir(path)  
 #else
     #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <dirent.h>
 #endif
+#if defined(__linux__)
+    #include <errno.h>
+    #include <sys/epoll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/resource.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <semaphore.h>
+    #define BANK_HAVE_EPOLL 1
+#endif
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+        #if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+            #define BANK_HAVE_URING 1
+        #endif
+    #endif
+#endif
+
+// Binary account store layout - every account lives in one fixed-size slot of a single data file
+// Slot N starts at byte (N + 1) * STORE_SLOT_SIZE; the first slot-sized block holds the file header
+#define STORE_FILE        "database/accounts.dat"
+#define STORE_MAGIC       0x4B4E4142u  // "BANK" in little-endian byte order
+#define STORE_VERSION     3            // 3: salted PIN hashes; 2: plaintext PINs; 1: float ringgit (upgraded on open)
+#define STORE_SLOT_SIZE   128          // Bytes per slot, large enough for StoreSlot with room to grow
+#define STORE_SLOT_FREE   0            // Slot never used or released by deleteAccount()
+#define STORE_SLOT_USED   1            // Slot holds a live account record
+#define STORE_MAP_MIN_SLOTS 1024       // The mapping (and the file) grow in doublings from this size
+
+// In-memory account index - open-addressing hash table from account number to slot number
+#define COLUMN_EMPTY      0            // Column row state: free or damaged slot
+#define COLUMN_ACTIVE     1            // Column row state: live, active account
+#define COLUMN_CLOSED     2            // Column row state: live, closed account
+#define LIST_PAGE_SIZE    20           // Accounts shown per page of the selection list
+#define LIST_ANY          -1           // Listing filter value that matches everything
+#define LIST_SORT_SLOT    0            // List in creation (slot) order
+#define LIST_SORT_NUMBER  1            // List by ascending account number
+#define LIST_SORT_BALANCE 2            // List by descending balance
+#define ARENA_SLAB_ACCOUNTS 64        // Accounts carved from each arena slab
+#define BENCH_ALLOC_OPS    10000000    // Default operations for --bench-alloc
+#define BENCH_FIRST_ACCOUNT 10000000  // Synthetic accounts are numbered from here
+#define BENCH_OPS          10000       // Default operations replayed by --bench
+#define ACCOUNT_NUMBER_MIN  1000000    // Smallest 7-digit account number
+#define ACCOUNT_NUMBER_SPAN 999000000  // How many 7-9 digit account numbers exist
+#define ACCOUNT_NUMBER_HALF 15         // Bits per Feistel half; 2^30 covers the whole span
+#define BENCH_NUMBERS       1000000    // Default allocations for --bench-numbers
+#define BENCH_SEARCHES      100000     // Default lookups of each kind for --bench-search
+#define BENCH_LOG_ACCOUNTS  1000000    // Distinct accounts in the --bench-log population
+#define BENCH_LOG_QUERIES   200        // Default statements timed by --bench-log
+#define INDEX_MIN_CAPACITY 1024        // Initial bucket count, always a power of two
+#define SEARCH_FILE        "database/search.idx"
+#define SEARCH_MAGIC       0x58444953u // "SIDX" in little-endian byte order
+#define SEARCH_VERSION     1
+#define SEARCH_PAGE_SIZE   4096        // Bytes per B+tree page; page 0 is the file header
+#define SEARCH_MAP_MIN_PAGES 256       // The search file grows in doublings from this size
+#define SEARCH_KEY_LEN     28          // Indexed bytes of a value; longer values are checked against the record
+#define SEARCH_TREES       3           // One tree per searchable field
+#define SEARCH_BY_ID       0           // Whole ID number
+#define SEARCH_BY_ID_LAST4 1           // Last four characters of the ID number
+#define SEARCH_BY_NAME     2           // Account holder name
+#define SEARCH_MAX_DEPTH   16          // Deeper than any tree over 2^31 keys can grow
+#define SEARCH_FILL_PERCENT 90         // How full a rebuild packs each page, leaving room for inserts
+#define SEARCH_COUNT_LIMIT 100000      // Matches counted before a search reports "or more"
+#define INDEX_MAX_LOAD     70          // Grow once more than this percentage of buckets are used
+
+// Write-ahead journal - balance changes are made durable here before the data file is touched
+#define JOURNAL_FILE             "database/journal.wal"
+#define JOURNAL_MAGIC            0x324E524Au  // "JRN2" in little-endian byte order
+#define JOURNAL_MAGIC_V1         0x4C4E524Au  // "JRNL": records of versions that kept float ringgit
+#define JOURNAL_DEPOSIT          1
+#define JOURNAL_WITHDRAW         2
+#define JOURNAL_TRANSFER         3
+#define JOURNAL_MONTH_END        4            // Interest/fee posting; amount is the net change
+#define JOURNAL_GROUP_RECORDS    64           // Sync once this many records are waiting...
+#define JOURNAL_GROUP_USEC       2000         // ...or once the oldest waiting record is this old
+#define JOURNAL_CHECKPOINT_BYTES (4 * 1024 * 1024) // Fold the journal into the data file past this size
+#define JOURNAL_BUFFER_RECORDS   8192         // Largest commit group the journal buffer can hold
+#define JOURNAL_IO_GROUPS        4            // Commit groups that may be on their way to disk at once
+
+// Asynchronous write layer under the journal and the binary log
+#define IO_BACKEND_THREADS       0            // Writer thread pool, available everywhere
+#define IO_BACKEND_URING         1            // Linux io_uring, driven through raw system calls
+#define IO_QUEUE_DEPTH           64           // io_uring submission entries; a synced write takes two
+#define IO_MAX_IN_FLIGHT         (IO_QUEUE_DEPTH / 2) // Requests outstanding at once; power of two
+#define IO_POOL_THREADS          2            // Writer threads of the fallback backend
+
+// Fault injection: BANK_CRASH_AT=<step name> kills the process the moment it reaches that step
+#define CRASH_NONE               0
+#define CRASH_BEFORE_JOURNAL     1            // Balances changed in memory, nothing journaled
+#define CRASH_JOURNAL_TORN       2            // Half of the commit group written, nothing synced
+#define CRASH_JOURNAL_SYNCED     3            // Journal record durable, no slot updated
+#define CRASH_SENDER_APPLIED     4            // First account's slot updated, second one not
+#define CRASH_APPLIED            5            // Both slots updated, journal still holds the record
+#define CRASH_CHECKPOINT_SYNCED  6            // Data file synced, journal not yet truncated
+#define CRASH_RECOVERY_REPLAYED  7            // Startup recovery replayed the journal, no checkpoint yet
+#define CRASH_POINTS             8
+#define CRASH_EXIT_CODE          86           // Exit status of a process killed by a crash point
+#define CRASH_TEST_DIR           "crash-test" // Scratch directory used by --crash-test
+
+// Transaction rules and validation results shared by the menu and batch mode
+#define MAX_DEPOSIT_AMOUNT 5000000LL   // Largest single deposit: RM50,000 in sen
+#define TXN_OK             0           // Operation passed every check
+#define TXN_NOT_FOUND      1           // Account number is not in the index
+#define TXN_CLOSED         2           // Account status is closed
+#define TXN_BAD_AMOUNT     3           // Amount is zero, negative or not a number
+#define TXN_OVER_LIMIT     4           // Deposit above MAX_DEPOSIT_AMOUNT
+#define TXN_NO_FUNDS       5           // Balance does not cover amount (plus fee)
+#define TXN_SAME_ACCOUNT   6           // Remittance sender and receiver are identical
+#define TXN_MALFORMED      7           // Batch line could not be parsed
+#define TXN_IO_ERROR       8           // Change applied in memory but the journal write failed
+#define TXN_BAD_PIN        9           // Server request carried the wrong PIN
+#define TXN_BAD_ID         10          // Server delete request carried the wrong last 4 of the ID number
+#define TXN_NO_NUMBERS     11          // Every 7-9 digit account number has been handed out
+#define TXN_LOCKED         12          // Too many wrong PINs; the account is locked for a while
+
+// Batch mode buffers
+#define BATCH_READ_SIZE    (1 << 20)   // Bytes of operations read per fread()
+#define BATCH_WRITE_SIZE   (1 << 20)   // Bytes of results buffered per fwrite()
+#define BATCH_LINE_MAX     256         // Longest accepted operation line
+#define BATCH_GROUP_USEC   100000      // Commit group age limit while posting a batch
+
+// Multi-threaded transaction engine
+#define ENGINE_LOCK_STRIPES 1024       // Account locks; power of two, rows map to stripes by slot
+#define STRESS_ACCOUNTS     1000       // Synthetic accounts used by --stress-test
+#define STRESS_THREADS      4          // Default worker threads for --stress-test
+#define STRESS_OPS          1000000    // Default operations per worker for --stress-test
+#define STRESS_AUDIT_USEC   1000       // Pause between the --stress-test auditor's read views
+
+// PIN authentication - salted hashes in the data file, sessions and failed attempts in memory
+#define PIN_HASH_ROUNDS      64           // Mixing rounds per PIN hash
+#define AUTH_MAX_FAILURES    3            // Wrong PINs in a row that lock an account
+#define AUTH_FAILURE_USEC    (15 * 60 * 1000000LL) // A wrong PIN older than this no longer counts
+#define AUTH_SESSION_USEC    (5 * 60 * 1000000LL)  // How long a verified PIN is answered from memory
+#define AUTH_LOCKOUT_SECONDS (30 * 60)    // Length of a lockout; stored in the account record
+#define AUTH_OK              0
+#define AUTH_WRONG_PIN       1
+#define AUTH_LOCKED          2            // Locked now, or by this very attempt
+#define AUTH_NOT_FOUND       3
+#define BENCH_AUTH_CHECKS    1000000      // Default PIN checks of each kind for --bench-auth
+
+// Network server mode - fixed-layout binary frames over a local TCP port or a Unix socket
+#define SERVER_DEFAULT_PORT "7411"     // Address --serve and --load-test use when none is given
+#define SERVER_BACKLOG      4096       // Pending connections the listening socket queues
+#define SERVER_MAX_EVENTS   1024       // epoll events handled per wakeup
+#define SERVER_IN_BUFFER    1024       // Unparsed request bytes kept per connection
+#define SERVER_OUT_BUFFER   2048       // Queued response bytes per connection; reading pauses when full
+#define SERVER_FRAME_MAX    128        // Largest request frame: a create with its name and ID number
+#define SERVER_SHARD_MAX    16         // Most shard workers BANK_SHARDS=<n> may start; none by default
+#define SERVER_TICK_OPS     65536      // Requests handed to the shards in one tick; power of two
+#define SERVER_SHARD_SPINS  4096       // Polls of an empty queue before a shard worker goes to sleep
+#define SERVER_OP_CREATE    1
+#define SERVER_OP_DEPOSIT   2
+#define SERVER_OP_WITHDRAW  3
+#define SERVER_OP_REMIT     4
+#define SERVER_OP_DELETE    5
+#define CLIENT_CONNECTIONS  1000       // Default connections opened by --load-test
+#define CLIENT_REQUESTS     200000     // Default deposits, withdrawals and remittances sent by --load-test
+#define CLIENT_DEPTH        8          // Default requests each connection keeps in flight
+#define CLIENT_MAX_DEPTH    64         // Most requests a connection may pipeline
+
+// Parallel startup scan, legacy migration and integrity check
+#define LOAD_MAX_THREADS    16         // Most workers a startup job uses; BANK_LOAD_THREADS=<n> overrides the count
+#define LOAD_MIN_ITEMS      65536      // Slots or account files per worker; smaller jobs start fewer workers
+#define CHECK_REPORT_LIMIT  20         // Problems --check lists one by one before it only counts them
+#define CHECK_OK            0          // Free slot, or a live account whose fields all make sense
+#define CHECK_BAD_STATE     1          // Slot state is neither free nor used
+#define CHECK_BAD_CHECKSUM  2          // Record does not match its checksum (torn or corrupt write)
+#define CHECK_BAD_NUMBER    3          // Account number outside the 7-9 digit range
+#define CHECK_BAD_TEXT      4          // Name or ID number empty or not terminated
+#define CHECK_BAD_PIN       5          // No PIN hash (salt is 0)
+#define CHECK_BAD_STATUS    6          // Status is neither active nor closed
+#define CHECK_BAD_TYPE      7          // Type is neither Savings nor Current
+#define CHECK_NEGATIVE      8          // Balance below zero
+#define CHECK_KINDS         9
+#define LEGACY_OK           0          // Account file parsed and holds the number index.txt names
+#define LEGACY_MISSING      1          // index.txt names a file that does not exist
+#define LEGACY_MALFORMED    2          // A field is missing or unreadable
+#define LEGACY_MISMATCH     3          // The file holds a different account number than its name
+#define LEGACY_REPEATED     4          // index.txt names the account more than once
+#define LEGACY_PRESENT      5          // Already in the data file from an earlier, interrupted migration
+#define LEGACY_UNSAVED      6          // Readable, but the data file could not take it
+#define LEGACY_KINDS        7
+#define CHECK_LOG_CREATED   1          // Log cross-check: the account's last lifecycle record is its creation
+#define CHECK_LOG_DELETED   2          // ...its last lifecycle record is its deletion
+#define CHECK_LOG_ACTIVITY  4          // ...deposits, withdrawals or remittances were logged for it
+#define CHECK_LOG_LATE      8          // ...some of them were logged after it was deleted
+
+// Binary transaction log - producers fill per-thread rings, one flusher thread writes them out
+#define LOG_FILE              "database/transaction.bin"  // Single-file log of older versions, moved into LOG_DIR
+#define LOG_DIR               "database/log"  // Segments <n>.bin and their sparse indexes <n>.idx
+#define LOG_SEGMENT_RECORDS   1048576  // Records per segment (64 MB); BANK_LOG_SEGMENT=<records> overrides it
+#define LOG_BLOCK_RECORDS     1024     // Records summarised by one index entry (64 KB of log)
+#define LOG_BLOOM_BITS        32768    // Bloom filter bits per block; power of two
+#define LOG_BLOOM_HASHES      4        // Bloom bits set per account
+#define LOG_INDEX_MAGIC       0x5844494Cu  // "LIDX" in little-endian byte order
+#define LOG_INDEX_VERSION     1
+#define LOG_FORMAT_VERSION    2        // LogRecord layout; 2: amounts in sen. Files without a format record may hold float ringgit
+#define LOG_FORMAT_TEXT       "bank log"  // Text of a format record
+#define LOG_MAX_RINGS         64       // Threads that may hold a ring at the same time
+#define LOG_RING_RECORDS      8192     // Records per ring; power of two
+#define LOG_FLUSH_RECORDS     8192     // Largest batch the flusher writes in one write()
+#define LOG_FLUSH_INTERVAL_NS 1000000  // Flusher sleep between polls when the rings are empty
+
+// Hot-path metrics; build with -DBANK_NO_METRICS to compile every probe out
+#define METRICS_FILE          "database/metrics.prom"  // Prometheus text exposition, rewritten periodically
+#define METRICS_DUMP_USEC     1000000  // How often the log flusher rewrites METRICS_FILE
+#define METRIC_BUCKETS        24       // Latency buckets: bucket i counts durations below 2^(i+8) ns
+#define METRIC_LIST           0        // Building the account listing cursor
+#define METRIC_LOAD           1        // getAccount() slot read
+#define METRIC_POST           2        // postTransaction(): journal, commit and slot updates
+#define METRIC_JOURNAL_SYNC   3        // Writing and syncing one journal commit group
+#define METRIC_SLOT_WRITE     4        // One slot write to the data file
+#define METRIC_LOG            5        // Queueing one log record
+#define METRIC_LOG_FLUSH      6        // Writing one batch of log records
+#define METRIC_STAGES         7
+#define LOG_TEXT              0        // Free-text event, rendered from LogRecord.text
+#define LOG_CREATE            1
+#define LOG_DELETE            2
+#define LOG_DEPOSIT           3
+#define LOG_WITHDRAW          4
+#define LOG_REMITTANCE        5
+#define LOG_MIGRATE           6        // account[0] = accounts migrated
+#define LOG_RECOVERY          7        // account[0] = journal records replayed
+#define LOG_BATCH             8        // account[0] = applied, account[1] = rejected, text = file
+#define LOG_MONTH_END         9        // account[0] = accounts, amount = interest, fee = fees
+#define LOG_FORMAT            10       // account[0] = LOG_FORMAT_VERSION; first record of every segment
+
+// Snapshots - a consistent copy of every account, after which older log segments are compacted away
+#define SNAPSHOT_FILE         "database/snapshot.dat"
+#define SNAPSHOT_TEMP_FILE    "database/snapshot.tmp"  // Written first, renamed over SNAPSHOT_FILE when complete
+#define SNAPSHOT_MAGIC        0x50414E53u  // "SNAP" in little-endian byte order
+#define SNAPSHOT_VERSION      1
+#define SNAPSHOT_CHUNK_SLOTS  512      // Slots copied at a time; a writer saves the whole chunk before changing it
+#define SNAPSHOT_INTERVAL     3600     // Seconds between automatic snapshots; BANK_SNAPSHOT_SECONDS=<n> overrides, 0 disables
+
+// Money is held as integer sen so balances of any size stay exact
+#define SEN_PER_RM                100
+#define MONEY_RM(m)               ((double)(m) / SEN_PER_RM)   // For display only
+#define ACCOUNT_SAVINGS           0    // Type codes used by the month-end kernel
+#define ACCOUNT_CURRENT           1
+#define MONTH_END_SAVINGS_BPS     21       // Monthly interest on Savings, in basis points (~2.5% a year)
+#define MONTH_END_CURRENT_BPS     0        // Current accounts earn no interest
+#define MONTH_END_MINIMUM_BALANCE 100000LL // Current accounts below RM1,000...
+#define MONTH_END_MAINTENANCE_FEE 1000LL   // ...pay a RM10 monthly maintenance fee
+#define MONTH_END_SIMD_LIMIT      (1LL << 36) // Largest balance the vector path handles exactly
+
+// Amount of money in sen (1/100 of a Malaysian Ringgit)
+typedef long long Money;
 
 // Account structure - stores all essential account information
 // This structure represents a single bank account with all required fields
 typedef struct {
     int accountNumber;    // Unique identifier for the account (7-9 digits)
     char accountName[50]; // Account holder's name (max 49 characters + null terminator)
-    char pin[5];          // 4-digit PIN + null terminator for security
-    float balance;        // Current account balance in Malaysian Ringgit
+    Money balance;        // Current account balance in sen
     int status;           // Account status: 0=active, 1=closed
     char accountType[10]; // Account type: "Savings" or "Current"
     char idNumber[20];    // Identification number for verification (min 4 chars)
+    unsigned int pinSalt; // Random per-account salt of pinHash, never 0 once a PIN is set
+    unsigned int pinHash; // pinHashOf(pinSalt, PIN); the PIN itself is never stored
+    unsigned int pinLockedUntil; // Unix time until which PIN entry is refused, 0 when not locked
 } Account;
 
+// Account layout of version 2 data files, which kept the PIN in plain text
+typedef struct {
+    int accountNumber;
+    char accountName[50];
+    char pin[5];
+    Money balance;
+    int status;
+    char accountType[10];
+    char idNumber[20];
+} AccountV2;
+
+// Account layout of version 1 data files, kept only so storeUpgrade() can read them
+typedef struct {
+    int accountNumber;
+    char accountName[50];
+    char pin[5];
+    float balance;        // Ringgit as a float
+    int status;
+    char accountType[10];
+    char idNumber[20];
+} AccountV1;
+
+// Running totals over every live account, kept current by columnsSet() on each slot change
+typedef struct {
+    int accounts[2][2];      // Live accounts by status (0 active, 1 closed) and type code
+    Money balances[2][2];    // Sum of balances by status and type code
+    Money feesCollected;     // Remittance fees charged since the data file was created
+} StoreTotals;
+
+// On-disk header stored at offset 0 of the data file
+typedef struct {
+    unsigned int magic;      // STORE_MAGIC, identifies a valid data file
+    unsigned int version;    // STORE_VERSION the file was written with
+    unsigned int slotSize;   // STORE_SLOT_SIZE the file was written with
+    int slotCount;           // Number of slots allocated so far (used and free)
+    unsigned long long numberSeed;  // Key of the account number permutation, 0 in files from older versions
+    unsigned long long numberNext;  // Position of the next account number in that permutation
+    unsigned long long checkpointSeq; // Last journal sequence number whose fee totals.feesCollected includes
+    StoreTotals totals;      // Totals as of the last header write; zero in files from older versions
+} StoreHeader;
+
+_Static_assert(sizeof(StoreHeader) <= STORE_SLOT_SIZE, "StoreHeader must fit in the header block");
+
+// On-disk slot: state flag, checksum of the record, then the raw Account record
+// Padded to exactly STORE_SLOT_SIZE so the mapped file can be used as an array of slots
+typedef struct {
+    unsigned int state;      // STORE_SLOT_FREE or STORE_SLOT_USED
+    unsigned int checksum;   // FNV-1a over the Account bytes to catch torn or corrupt records
+    Account acc;             // The account record itself
+    char reserved[STORE_SLOT_SIZE - 2 * sizeof(unsigned int) - sizeof(Account)];  // Always zero
+} StoreSlot;
+
+_Static_assert(sizeof(StoreSlot) == STORE_SLOT_SIZE, "StoreSlot must fill a slot exactly");
+
+// Version 1 slot layout
+typedef struct {
+    unsigned int state;
+    unsigned int checksum;
+    AccountV1 acc;
+} StoreSlotV1;
+
+// Version 2 slot layout
+typedef struct {
+    unsigned int state;
+    unsigned int checksum;
+    AccountV2 acc;
+} StoreSlotV2;
+
+// Parameters of the month-end kernel, all in sen or basis points
+typedef struct {
+    Money interestBps[2];    // Monthly interest rate per account type code
+    Money minimumBalance;    // Current accounts below this pay the maintenance fee
+    Money maintenanceFee;    // Monthly fee for Current accounts under the minimum
+} MonthEndRates;
+
+// Open data file state shared by all storage functions
+int storeFd = -1;            // File descriptor of STORE_FILE, -1 until storeOpen() succeeds
+char *storeMap = NULL;       // Whole data file mapped into memory; the header block comes first
+StoreSlot *storeSlots = NULL; // Slot array inside the mapping, right after the header block
+size_t storeMapBytes = 0;    // Bytes mapped, which is also the file's allocated size
+int storeSyncEachWrite = 0;  // BANK_MSYNC=write: msync every slot write instead of only at checkpoints
+int storeSlotCount = 0;      // Mirror of StoreHeader.slotCount
+atomic_llong ioBytesWritten; // Bytes written to the data file, journal and log, reported by --bench
+unsigned long long accountNumberSeed = 0;  // Mirror of StoreHeader.numberSeed
+unsigned long long accountNumberNext = 0;  // Mirror of StoreHeader.numberNext
+unsigned long long storeCheckpointSeq = 0; // Mirror of StoreHeader.checkpointSeq
+StoreTotals storeTotals;     // Live totals; counts and balances are rebuilt by indexBuild(), fees come from the header
+int crashAt = CRASH_NONE;    // Step at which to kill the process, from BANK_CRASH_AT
+const char *crashPointNames[CRASH_POINTS] = {
+    "none", "before-journal", "journal-torn", "journal-synced",
+    "sender-applied", "applied", "checkpoint-synced", "recovery-replayed"
+};
+
+// One hash bucket; accountNumber 0 marks an empty bucket since real numbers have 7-9 digits
+typedef struct {
+    int accountNumber;       // Key: account number, 0 when the bucket is empty
+    int slot;                // Value: slot number inside STORE_FILE
+} IndexEntry;
+
+// Index state, built by indexBuild() at startup and maintained on create/delete
+IndexEntry *indexTable = NULL;   // Bucket array of indexCapacity entries
+unsigned int indexCapacity = 0;  // Number of buckets (power of two)
+int indexCount = 0;              // Number of live accounts in the table
+int *freeSlots = NULL;           // Stack of released slots ready for reuse
+int freeSlotCount = 0;           // Entries currently on the free-slot stack
+int freeSlotCapacity = 0;        // Allocated size of the free-slot stack
+
+// Fixed block of accounts handed out by an arena
+typedef struct AccountSlab {
+    struct AccountSlab *next;              // Next slab of the same arena
+    int used;                              // Accounts handed out from this slab
+    Account items[ARENA_SLAB_ACCOUNTS];
+} AccountSlab;
+
+// Bump allocator for Account objects; everything it handed out is released at once by arenaReset()
+// Slabs are kept across resets, so an arena in steady state never calls malloc
+typedef struct {
+    AccountSlab *first;      // First slab, NULL until the first allocation
+    AccountSlab *current;    // Slab new accounts are carved from
+} AccountArena;
+
+// Accounts loaded by getAccount() during the current menu operation
+// They stay valid until mainMenu() starts the next operation and resets the arena
+AccountArena opArena = { NULL, NULL };
+
+// Name and ID of one account, kept apart from the scanned columns
+typedef struct {
+    char accountName[50];
+    char idNumber[20];
+} AccountText;
+
+// One B+tree key: a lower-cased field value and the slot it belongs to, which makes keys unique
+typedef struct {
+    char text[SEARCH_KEY_LEN];   // Zero padded; values longer than this share a key prefix
+    int slot;                    // Data file slot of the account
+} SearchKey;
+
+#define SEARCH_LEAF_KEYS  ((SEARCH_PAGE_SIZE - 16) / sizeof(SearchKey))
+#define SEARCH_INNER_KEYS ((SEARCH_PAGE_SIZE - 16 - sizeof(unsigned int)) / (sizeof(SearchKey) + sizeof(unsigned int)))
+
+// One B+tree page; inner pages send keys below sep[0] to child[0] and keys from sep[i] to child[i+1]
+typedef struct {
+    unsigned int leaf;           // 1 for a leaf page
+    unsigned int count;          // Keys in a leaf, separators in an inner page
+    unsigned int next;           // Leaf: the next leaf in key order, 0 after the last one
+    unsigned int reserved;
+    union {
+        SearchKey keys[SEARCH_LEAF_KEYS];               // Leaf keys in ascending order
+        struct {
+            SearchKey sep[SEARCH_INNER_KEYS];           // Inner separators in ascending order
+            unsigned int child[SEARCH_INNER_KEYS + 1];  // Child pages
+        };
+    };
+} SearchPage;
+
+_Static_assert(sizeof(SearchPage) <= SEARCH_PAGE_SIZE, "SearchPage must fit in a page");
+
+// Page 0 of the search file
+typedef struct {
+    unsigned int magic;                // SEARCH_MAGIC
+    unsigned int version;              // SEARCH_VERSION
+    unsigned int pageSize;             // SEARCH_PAGE_SIZE
+    unsigned int pageCount;            // Pages in use, header included
+    unsigned int root[SEARCH_TREES];   // Root page of each tree
+    unsigned int clean;                // 1 only while no process has the file open for changes
+    unsigned long long entries;        // Keys stored across all trees
+} SearchHeader;
+
+// Search index state; the file is mapped like the data file
+int searchFd = -1;                 // File descriptor of SEARCH_FILE
+char *searchMap = NULL;            // The whole search file; page n starts at n * SEARCH_PAGE_SIZE
+size_t searchMapBytes = 0;         // Bytes mapped
+int searchReady = 0;               // 1 once the index matches the data file and is kept up to date
+
+// Columnar copy of the account population, indexed by slot number like the data file
+// Scans that only need numbers, balances, statuses or types walk these dense arrays
+int *colNumber = NULL;           // Account number of each slot
+Money *colBalance = NULL;        // Balance of each slot
+unsigned char *colState = NULL;  // COLUMN_EMPTY, COLUMN_ACTIVE or COLUMN_CLOSED
+unsigned char *colType = NULL;   // ACCOUNT_SAVINGS or ACCOUNT_CURRENT
+AccountText *colText = NULL;     // Side store for names and IDs, read only when printing
+int colCapacity = 0;             // Rows allocated in every column
+unsigned long long colLayoutVersion = 0;   // Bumped when a row appears, disappears or changes state/type
+unsigned long long colBalanceVersion = 0;  // Bumped when any balance changes
+
+// Result of a full scan over the columns
+typedef struct {
+    int active;              // Active accounts
+    int closed;              // Closed accounts
+    int byType[2];           // Active accounts per type code
+    Money deposits[2];       // Sum of active balances per type code
+} ColumnSummary;
+
+// Cursor over the account listing; a single global instance remembers the operator's
+// filter, sort order and page between menu operations
+typedef struct {
+    int state;               // COLUMN_ACTIVE, COLUMN_CLOSED or LIST_ANY
+    int type;                // ACCOUNT_SAVINGS, ACCOUNT_CURRENT or LIST_ANY
+    int sort;                // LIST_SORT_SLOT, LIST_SORT_NUMBER or LIST_SORT_BALANCE
+    int page;                // Page shown last, reopened by the next listing
+    int *order;              // Slots that match the filter, in sort order
+    int count;               // Entries in order
+    int capacity;            // Allocated size of order
+    int valid;               // 0 until order has been built once
+    unsigned long long layoutVersion;   // colLayoutVersion order was built against
+    unsigned long long balanceVersion;  // colBalanceVersion order was built against
+} ListCursor;
+
+ListCursor listCursor = { LIST_ANY, LIST_ANY, LIST_SORT_SLOT, 0, NULL, 0, 0, 0, 0, 0 };
+
+// One journal record: the after-image balances of every account a mutation touched
+typedef struct {
+    unsigned int magic;      // JOURNAL_MAGIC, marks the start of a record
+    unsigned int type;       // JOURNAL_DEPOSIT, JOURNAL_WITHDRAW or JOURNAL_TRANSFER
+    unsigned long long seq;  // Sequence number within the current journal
+    int account[2];          // Affected accounts; account[1] is only used by transfers
+    Money balance[2];        // Balances of those accounts after the mutation
+    Money amount;            // Amount moved, kept for auditing
+    Money fee;               // Remittance fee charged to account[0]
+    unsigned int checksum;   // FNV-1a over every field above
+} JournalRecord;
+
+// Journal record of versions that kept float ringgit, kept only so journalRecover() can replay them
+typedef struct {
+    unsigned int magic;      // JOURNAL_MAGIC_V1
+    unsigned int type;
+    unsigned long long seq;
+    int account[2];
+    float balance[2];        // Ringgit as floats
+    float amount;
+    float fee;
+    unsigned int checksum;   // FNV-1a over every field above
+} JournalRecordV1;
+
+// One asynchronous write, optionally followed by a data sync of the same file
+// The buffer must stay untouched until ioWait() reports the request finished
+typedef struct {
+    int fd;                  // File to write
+    const void *buf;         // Bytes to write
+    size_t len;              // Number of bytes
+    long long offset;        // File offset, or -1 to write at the end of an O_APPEND file
+    int sync;                // 1 to fdatasync the file once the write is done
+    int done;                // Set under ioLock when the request has completed
+    long result;             // Bytes written, or negative on failure
+} IoRequest;
+
+// I/O layer state; ioLock guards the queues and every request's done flag
+int ioBackend = IO_BACKEND_THREADS;  // Backend chosen by ioInit()
+int ioRunning = 0;                   // 1 between ioInit() and ioShutdown(); before that writes are synchronous
+int ioStopping = 0;                  // Set by ioShutdown() to stop the worker or reaper threads
+int ioInFlight = 0;                  // Requests submitted and not yet completed
+pthread_mutex_t ioLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ioCond = PTHREAD_COND_INITIALIZER;   // Broadcast on every submission and completion
+IoRequest *ioQueue[IO_MAX_IN_FLIGHT];               // Thread pool backend: requests not yet picked up
+unsigned int ioQueueHead = 0, ioQueueTail = 0;
+pthread_t ioThreads[IO_POOL_THREADS];               // Pool workers, or the io_uring reaper in ioThreads[0]
+#ifdef BANK_HAVE_URING
+int ioRingFd = -1;                                  // io_uring instance
+unsigned int *ioSqTail, *ioSqMask, *ioSqArray;      // Submission ring fields shared with the kernel
+unsigned int *ioCqHead, *ioCqTail, *ioCqMask;       // Completion ring fields shared with the kernel
+struct io_uring_sqe *ioSqes;                        // Submission entries
+struct io_uring_cqe *ioCqes;                        // Completion entries
+#endif
+
+// A commit group buffer; groups rotate so new records are added while earlier groups are written
+typedef struct {
+    JournalRecord records[JOURNAL_BUFFER_RECORDS];  // Records of this group
+    IoRequest io;                                   // Write and sync of the group once submitted
+    int inFlight;                                   // 1 from submission until the completion is reaped
+    long long submitted;                            // monotonicNanos() at submission
+} JournalGroup;
+
+// Records a thread has built but not yet added to a commit group; journalMerge() moves them there
+typedef struct {
+    JournalRecord *records;                         // In sequence order
+    int count, capacity;
+    int merged;                                     // Records journalMerge() has taken so far
+    int failed;                                     // A record could not be staged; the journal is poisoned at merge
+} JournalStage;
+
+// Journal state; records accumulate in the current group until it is submitted
+int journalFd = -1;                                   // File descriptor of JOURNAL_FILE
+JournalGroup journalGroups[JOURNAL_IO_GROUPS];        // Open group plus groups still being written
+int journalCurrent = 0;                               // Group records are appended to
+int journalFailed = 0;                                // Set once a journal write or sync has failed
+int journalGroupRecords = JOURNAL_GROUP_RECORDS;      // Current commit group size limit
+long long journalGroupUsec = JOURNAL_GROUP_USEC;      // Current commit group age limit
+int journalPending = 0;                               // Records waiting in the current group
+long long journalGroupStart = 0;                      // nowMicros() when the group was opened
+atomic_ullong journalSeq = 0;                         // Last sequence number handed out
+long long journalBytes = 0;                           // Bytes submitted since the last checkpoint
+Money journalFees = 0;                                // Fees in records not yet folded into the header
+pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER; // Serializes appends from engine threads
+_Thread_local JournalStage *journalStage = NULL;      // Where the calling thread's records wait; NULL adds them directly
+
+// In-memory copy of the data file used by batch mode, indexed by slot number
+StoreSlot *tableRows = NULL;         // One row per slot, free slots included
+unsigned char *tableDirty = NULL;    // Rows changed since the last write-back
+int tableRowCount = 0;               // Number of rows loaded
+int tableRowCapacity = 0;            // Rows allocated; grows when the server creates accounts
+StoreSlot *tableBefore = NULL;       // Per row, its contents when the view epoch of its last change began
+atomic_uint *tableEpoch = NULL;      // Per row, the view epoch it was last changed in
+
+// One lock stripe, padded to its own cache line so neighbouring stripes do not false-share
+typedef struct {
+    pthread_mutex_t lock;    // Guards every row whose slot maps to this stripe
+    Money fees;              // Remittance fees collected from senders on this stripe
+    Money net;               // Deposits less withdrawals on rows of this stripe
+    char pad[64 - (sizeof(pthread_mutex_t) + 2 * sizeof(Money)) % 64];
+} EngineStripe;
+
+EngineStripe engineStripes[ENGINE_LOCK_STRIPES];
+
+// A consistent point in the table for a long scan; views opened while another is open share its point
+typedef struct {
+    unsigned int epoch;      // Rows changed in this epoch are read from tableBefore
+    int rows;                // Rows in the table at the view point; rows added later are not part of it
+    Money fees;              // Fees the engine had collected at the view point
+    Money net;               // Deposits less withdrawals the engine had applied at the view point
+} ReadView;
+
+pthread_mutex_t viewLock = PTHREAD_MUTEX_INITIALIZER; // Guards opening and closing views and growing the table
+pthread_cond_t viewClosed = PTHREAD_COND_INITIALIZER; // Signalled when the last open view closes
+atomic_uint viewEpoch = 1;   // Epoch writers are in; a view that is not shared starts the next one
+int viewReaders = 0;         // Views open on viewShared
+ReadView viewShared;         // The point the open views share
+
+// Per-thread state of a --stress-test worker
+typedef struct {
+    unsigned long long seed; // Private random generator state
+    long ops;                // Operations this worker performs
+    Money deposited;         // Money successfully deposited
+    Money withdrawn;         // Money successfully withdrawn
+    long long transfers;     // Transfers that went through
+} StressWorker;
+
+// State of the --stress-test auditor, which totals the table through read views during the run
+typedef struct {
+    atomic_int stop;         // Set once every worker has finished
+    Money opening;           // Sum of the opening balances
+    long long views;         // Read views audited
+    long long unbalanced;    // Views whose balances and fees did not match the net deposits
+    long long scanMicros;    // Time spent scanning through views
+} StressAudit;
+
+int *stressAccounts = NULL;  // Account numbers the stress workers pick from
+int stressAccountCount = 0;  // Number of entries in stressAccounts
+
+// Request frame of the server protocol (32 bytes, native byte order); a create request is followed
+// by the holder's name and ID number, each terminated by a NUL byte
+typedef struct {
+    unsigned short length;         // Bytes in the frame, this header included
+    unsigned char op;              // SERVER_OP_*
+    unsigned char type;            // Create: ACCOUNT_SAVINGS or ACCOUNT_CURRENT
+    unsigned int tag;              // Chosen by the client and echoed in the response
+    int account;                   // Account operated on; the sender of a remittance
+    int toAccount;                 // Receiver of a remittance
+    Money amount;                  // Amount in sen
+    char pin[4];                   // PIN of account, or the PIN a new account gets
+    char idLast4[4];               // Delete: last 4 characters of the ID number
+} ServerRequest;
+
+// Response frame (40 bytes); responses on a connection come back in request order
+typedef struct {
+    unsigned int tag;              // Tag of the request
+    unsigned char op;              // SERVER_OP_* of the request
+    unsigned char result;          // TXN_OK or the TXN_* reason it was rejected
+    unsigned short reserved;
+    int account;                   // Account operated on; for a create, the number it was given
+    int toAccount;                 // Receiver of a remittance
+    Money balance;                 // New balance of account (for a delete, the balance it held)
+    Money toBalance;               // New balance of the receiver
+    Money fee;                     // Remittance fee charged to the sender
+} ServerResponse;
+
+// One client connection of the server
+typedef struct {
+    int fd;
+    unsigned int events;           // epoll events currently registered
+    int inUsed;                    // Bytes of in holding requests not yet parsed
+    int outUsed;                   // Bytes of out holding responses
+    int outReady;                  // Leading bytes of out whose changes are durable and may be sent
+    int outSent;                   // Leading bytes of out already sent
+    int outQueued;                 // Bytes of out held back for responses the shards are still working on
+    int pending;                   // On serverTouched, waiting for the commit at the end of the tick
+    int closing;                   // Peer closed or broke the protocol; drop once nothing is left to send
+    int fenceShard;                // 1 + shard holding this connection's last queued request, 0 if none
+    unsigned int fenceTicket;      // That shard's queue head just after the request was pushed
+    char in[SERVER_IN_BUFFER];
+    char out[SERVER_OUT_BUFFER];
+} ServerConn;
+
+// One connection of the --load-test client
+typedef struct {
+    int fd;
+    int account;                   // Account this connection created
+    int inUsed, outUsed;
+    long sent, received;           // Requests of the current phase
+    long quota;                    // Requests to send in the current phase
+    unsigned long long rng;        // Picks operations, amounts and receivers
+    long long sentAt[CLIENT_MAX_DEPTH]; // Send time of each request in flight, oldest first by received
+    char in[SERVER_IN_BUFFER];
+    char out[SERVER_OUT_BUFFER];
+} ClientConn;
+
+volatile sig_atomic_t serverStop = 0;  // Set by SIGINT or SIGTERM to end --serve
+ServerConn **serverTouched = NULL;     // Connections that got responses during this tick
+int serverTouchedCount = 0, serverTouchedCapacity = 0;
+int *serverRows = NULL;                // Table rows changed during this tick
+int serverRowCount = 0, serverRowCapacity = 0;
+
+#ifdef BANK_HAVE_EPOLL
+// One request of the tick on its way through a shard; the response stays here until the commit
+typedef struct {
+    ServerRequest req;
+    ServerResponse resp;
+    ServerConn *conn;              // Connection the response goes back to
+} ServerOp;
+
+// A shard worker: it applies the requests charged to the accounts it owns, in the order they arrived
+typedef struct {
+    atomic_uint head;              // Queue entries the epoll thread has written
+    char padHead[60];
+    atomic_uint tail;              // Queue entries the worker has applied
+    atomic_int sleeping;           // 1 while the worker waits on wake
+    char padTail[56];
+    int *queue;                    // SERVER_TICK_OPS indexes into serverOps; one producer, one consumer
+    sem_t wake;                    // Posted when work is queued for a sleeping worker
+    pthread_t thread;
+    int cpu;                       // CPU the worker is pinned to, -1 if it could not be pinned
+    long long applied;             // Requests the worker has applied
+    int *rows;                     // Table rows the worker changed since the last commit
+    int rowCount, rowCapacity;
+    JournalStage stage;            // Journal records the worker wrote since the last commit
+} ServerShard;
+
+ServerOp *serverOps = NULL;            // Requests of the current tick, in the order they were parsed
+int serverOpCount = 0;
+ServerShard serverShards[SERVER_SHARD_MAX];
+int serverShardCount = 0;              // 0 applies every request on the epoll thread
+atomic_int serverShardsStopping;       // Set to make the workers exit once their queues are empty
+_Thread_local ServerShard *serverMyShard = NULL; // Shard of the calling worker, NULL on the epoll thread
+#endif
+
+// Authentication state of one account: its credentials while they are fresh, and recent failures
+typedef struct {
+    int accountNumber;             // 0 marks an empty bucket
+    unsigned int pinSalt;          // Copied from the account record...
+    unsigned int pinHash;
+    unsigned int lockedUntil;      // ...along with its lockout time
+    int failures;                  // Wrong PINs since the last success
+    long long failedAt;            // nowMicros() of the first of those failures
+    long long freshUntil;          // nowMicros() until which the fields above are used without reading the record
+    unsigned long long sessionTag; // pinSessionTag() of the PIN last verified, 0 if none since the record was read
+} AuthEntry;
+
+// Authentication entries of a set of accounts
+typedef struct {
+    AuthEntry *entries;            // Open addressing on account number; entries are only ever reset
+    unsigned int capacity;         // Buckets, a power of two
+    int count;                     // Accounts with an entry
+    long long hits, misses;        // Verifications answered from memory / from the record
+} AuthTable;
+
+AuthTable authShared;              // Every account's entry, used under authLock, unless split
+AuthTable authShardTables[SERVER_SHARD_MAX]; // While split, server shard s alone uses table s
+int authShards = 0;                // Tables the entries are split over by authSplit(); 0 uses authShared
+_Thread_local unsigned long long authSalts = 0; // Generator state for new salts, seeded on first use
+unsigned long long authSessionKey = 0; // Random key of pinSessionTag(), different in every process
+pthread_mutex_t authLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t authRecordLock = PTHREAD_MUTEX_INITIALIZER; // Serializes lockout writes, which update the columns
+
+// One worker's share of a parallel startup job: a range of data file slots or of index.txt entries
+typedef struct {
+    int from, to;                  // Items [from, to) this worker handles
+    int problems[CHECK_KINDS];     // Slot scan: slots found with each CHECK_* problem
+    int indexed;                   // Slot scan: live accounts added to the hash index
+    StoreTotals totals;            // Slot scan: running totals over the range
+    int *freeList;                 // Slot scan: free slots in ascending order
+    int freeCount, freeCapacity;
+    int *duplicates;               // Slot scan: live slots whose number another slot had already claimed
+    int duplicateCount, duplicateCapacity;
+    const int *numbers;            // Migration: account numbers listed in index.txt
+    Account *accounts;             // Migration: the account parsed for each entry
+    unsigned char *results;        // Migration: LEGACY_* outcome for each entry
+} LoadWorker;
+
+// What the startup scan and the legacy migration found; printed at startup and by --check
+typedef struct {
+    int threads;                   // Workers used by the slot scan
+    long long scanMicros;          // Time the slot scan took
+    int problems[CHECK_KINDS];     // Slots found with each CHECK_* problem
+    int duplicates;                // Slots dropped because a lower slot holds the same account number
+    int legacyListed;              // Entries in index.txt
+    int legacyLoaded;              // Accounts migrated into the data file
+    int legacyFailed[LEGACY_KINDS]; // Entries skipped, by LEGACY_* reason
+    int legacyOrphans;             // Account files index.txt does not name, left where they are
+    long long legacyMicros;        // Time the migration took
+} LoadReport;
+
+// Log cross-check state: what the log says happened to each account it mentions
+typedef struct {
+    IndexEntry *table;             // Open addressing on account number; slot holds CHECK_LOG_* flags
+    unsigned int capacity;         // Buckets, a power of two
+    int count;                     // Accounts seen
+    int failed;                    // Set when the table could not grow
+} CheckLog;
+
+LoadReport loadReport;
+const char *checkProblemNames[CHECK_KINDS] = {
+    "sound", "unknown slot state", "checksum mismatch", "account number out of range",
+    "name or ID number missing", "PIN hash missing", "unknown status", "unknown account type",
+    "negative balance"
+};
+const char *legacyResultNames[LEGACY_KINDS] = {
+    "migrated", "file missing", "malformed file", "file holds another account number", "listed twice",
+    "already migrated", "not saved"
+};
+
+// One fixed-size binary log record (64 bytes)
+typedef struct {
+    long long timestamp;     // Nanoseconds since the Unix epoch
+    Money amount;            // Amount moved
+    Money fee;               // Remittance fee
+    unsigned int type;       // LOG_* event type
+    int account[2];          // Accounts involved, or counters for summary events
+    char text[28];           // Free text for LOG_TEXT and LOG_BATCH events
+} LogRecord;
+
+// Oldest and newest timestamp in one block of a segment
+typedef struct {
+    long long minTime;
+    long long maxTime;
+} LogBlockTimes;
+
+// Start of a segment index file. It is followed by one LogBlockTimes per block, then LOG_BLOOM_BITS
+// bloom rows of rowBytes each: bit b of row p is set when an account in block b hashes to p, so
+// finding the blocks of one account reads LOG_BLOOM_HASHES short rows instead of every filter
+typedef struct {
+    unsigned int magic;            // LOG_INDEX_MAGIC
+    unsigned int version;          // LOG_INDEX_VERSION
+    unsigned int blockRecords;     // LOG_BLOCK_RECORDS
+    unsigned int bloomBits;        // LOG_BLOOM_BITS
+    unsigned int rowBytes;         // Bytes per bloom row, one bit per block
+    unsigned int blocks;           // Blocks described
+    unsigned long long records;    // Leading records of the segment the index covers
+    long long minTime;             // Oldest timestamp among them
+    long long maxTime;             // Newest timestamp among them
+} LogIndexHeader;
+
+// In-memory index of the segment being written; only the flusher thread touches it
+typedef struct {
+    unsigned long long records;    // Records added so far
+    unsigned int maxBlocks;        // Blocks the arrays have room for
+    unsigned int rowBytes;         // Bytes per bloom row
+    long long minTime, maxTime;    // Time range of every record added
+    LogBlockTimes *times;          // maxBlocks entries
+    unsigned char *bloom;          // LOG_BLOOM_BITS rows of rowBytes
+} LogIndex;
+
+// What one log query touched, reported by --bench-log
+typedef struct {
+    int segments;                  // Segment files opened
+    long long blocksRead;          // Blocks read through the index
+    long long recordsRead;         // Records read from disk in total
+    long long matches;             // Records passed to the caller
+} LogQueryStats;
+
+typedef void (*LogVisitor)(const LogRecord *rec, void *ctx);
+
+// Single-producer/single-consumer ring owned by one thread and drained by the flusher
+// head and tail sit on separate cache lines so producer and flusher do not false-share
+typedef struct {
+    atomic_uint head;                      // Next record the owner thread will write
+    char padHead[64 - sizeof(atomic_uint)];
+    atomic_uint tail;                      // Next record the flusher will read
+    char padTail[64 - sizeof(atomic_uint)];
+    atomic_int inUse;                      // 1 while a live thread owns the ring
+    LogRecord records[LOG_RING_RECORDS];
+} LogRing;
+
+LogRing logRings[LOG_MAX_RINGS];           // Ring pool shared by all threads
+_Thread_local LogRing *logMyRing = NULL;   // Ring claimed by the calling thread
+pthread_key_t logRingKey;                  // Releases a thread's ring when the thread exits
+pthread_t logFlusherThread;                // Background writer
+atomic_int logFlusherActive;               // Cleared to ask the flusher to drain and stop
+int logRunning = 0;                        // 1 between logOpen() and logClose()
+int logFd = -1;                            // File descriptor of the segment being written
+unsigned int logSegment = 0;               // Number of the segment being written
+unsigned long long logSegmentLimit = LOG_SEGMENT_RECORDS;  // Records per segment before rotating
+LogIndex logIndex;                         // Index of the segment being written
+long long logBatchDrainedAt = 0;           // nowNanos() before the flusher drained the batch being written
+atomic_llong logWrittenThrough;            // Every record published before this time has been written
+atomic_int logFailed;                      // Set once a segment write failed; nothing is written after it
+
+// Start of the snapshot file. It is followed by `accounts` Account records, then `tombstones`
+// SnapshotTombstone records; the checksum covers both.
+typedef struct {
+    unsigned int magic;            // SNAPSHOT_MAGIC
+    unsigned int version;          // SNAPSHOT_VERSION
+    unsigned int accountSize;      // sizeof(Account) when the file was written
+    unsigned int checksum;         // FNV-1a over everything after the header
+    long long takenAt;             // nowNanos() at the snapshot point; the log up to here is summarised
+    long long previousAt;          // takenAt of the snapshot this one replaced, 0 for the first
+    int accounts;                  // Live accounts
+    int tombstones;                // Accounts deleted at or before takenAt
+    StoreTotals totals;            // Running totals at takenAt
+} SnapshotHeader;
+
+// An account deleted before the snapshot point; its creation record may have been compacted away
+typedef struct {
+    int accountNumber;
+    int reserved;
+    long long deletedAt;           // Timestamp of its deletion record
+} SnapshotTombstone;
+
+// What the last snapshot writer did
+typedef struct {
+    int ok;                        // 1 when the file was written and renamed into place
+    int accounts, tombstones;      // Records written
+    int chunksSaved;               // Chunks a writer changed first and saved for the snapshot
+    int segmentsRemoved;           // Log segments compacted away afterwards
+    long long bytes;               // Size of the snapshot file
+    long long copyMicros;          // Time spent copying slots, while writers kept running
+    long long micros;              // Time for the whole job
+} SnapshotResult;
+
+// Snapshot state; snapshotLock guards the copy position, the saved chunks and remapping the data file
+pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+atomic_int snapshotActive;                 // 1 while the writer copies slots; checked before every slot change
+atomic_int snapshotDone;                   // Set by the writer thread when it has finished
+int snapshotRunning = 0;                   // 1 from snapshotStart() until snapshotFinish() joins the writer
+pthread_t snapshotThread;
+int snapshotSlots = 0;                     // Slots that existed at the snapshot point
+int snapshotCopied = 0;                    // Chunks the writer has copied so far
+StoreSlot **snapshotSaved = NULL;          // Per chunk, its contents at the snapshot point if a writer got there first
+long long snapshotAt = 0;                  // nowNanos() at the snapshot point
+StoreTotals snapshotTotals;                // storeTotals at the snapshot point
+long long snapshotDueAt = 0;               // nowMicros() when the next automatic snapshot starts, 0 before the first check
+SnapshotResult snapshotResult;
+
+#ifndef BANK_NO_METRICS
+// Latency histogram of one stage; updated with relaxed atomics so engine threads can share it
+typedef struct {
+    atomic_ullong count;                   // Samples recorded
+    atomic_ullong sumNanos;                // Total time of all samples
+    atomic_ullong buckets[METRIC_BUCKETS]; // Samples per power-of-two latency bucket
+} MetricHistogram;
+
+MetricHistogram metricStages[METRIC_STAGES];
+atomic_ullong metricTransactions[JOURNAL_TRANSFER + 1];   // Posted transactions per JOURNAL_* type
+const char *metricStageNames[METRIC_STAGES] = {
+    "account_list", "account_load", "transaction_post", "journal_sync",
+    "slot_write", "log_enqueue", "log_flush"
+};
+
+#define METRIC_START(t)         long long t = monotonicNanos()
+#define METRIC_STOP(stage, t)   metricRecord(stage, monotonicNanos() - (t))
+#define METRIC_TRANSACTION(k)   atomic_fetch_add_explicit(&metricTransactions[k], 1, memory_order_relaxed)
+#else
+#define METRIC_START(t)         ((void)0)
+#define METRIC_STOP(stage, t)   ((void)0)
+#define METRIC_TRANSACTION(k)   ((void)0)
+#endif
+
 // Function prototypes - declarations of all functions used in the system
 void displayAccount(Account *acc);                    // Display account details in formatted table
 int saveAccount(Account* acc);                        // Save account data to file
-Account* getAccount(int num);                         // Load account data from file
+Account* getAccount(int num);                         // Load account data into the operation arena
+Account* arenaAlloc(AccountArena *arena);             // Hand out one Account from an arena
+void arenaReset(AccountArena *arena);                 // Release every Account an arena handed out
+void arenaFree(AccountArena *arena);                  // Return an arena's slabs to the heap
+int runAllocBenchmark(long ops);                      // Compare arena and malloc per lookup
+int runBenchmark(long accounts, long ops, int textFormat, const int mix[3]); // Generate a population and replay a mix
+long long benchEnterPopulation(long accounts, int textFormat); // Enter a bench directory, generating the population
+int benchCompareLatency(const void *x, const void *y); // qsort() order of latency samples
+double benchPercentile(long long *sorted, long n, double q); // Latency at a quantile, in microseconds
+#ifndef BANK_NO_METRICS
+void metricRecord(int stage, long long nanos);        // Add one latency sample to a stage histogram
+int metricsWriteFile(const char *path);               // Write all metrics in Prometheus text format
+void metricsPrintSummary();                           // Print per-stage counts and latencies
+#endif
 void welcome();                                       // Display welcome banner
 void showSession();                                   // Show current session information
 void logTransaction(char* action);                    // Log transactions for audit trail
+void logEvent(int type, int a, int b, Money amount, Money fee, const char *text); // Queue a typed log record
+int logOpen();                                        // Open the binary log and start its flusher
+void logSegmentPath(char *out, size_t size, unsigned int segment, const char *ext); // Path of a segment file
+int logListSegments(unsigned int *first, unsigned int *last); // Range of segment numbers on disk
+int logSegmentOpen(unsigned int segment);             // Open a segment for appending and load its index
+int logFileFormat(const char *path);                  // LogRecord layout version of a log file
+void logCheckFormat(const char *path);                // Warn about a log file of another layout version
+int logSegmentSeal();                                 // Save the segment's index and start the next one
+void logIndexAdd(LogIndex *idx, const LogRecord *rec); // Add a record to the index being built
+int logIndexWrite(const LogIndex *idx, unsigned int segment); // Save a segment index
+int logIndexReadHeader(FILE *fp, LogIndexHeader *header, unsigned long long records); // Read and check an index header
+void logClose();                                      // Drain the rings and stop the flusher
+int dumpLog(const char *path);                        // Print a binary log in text form
+void logRender(const LogRecord *rec, char *out, size_t size); // Format a record as "[timestamp] action"
+int logQuery(int account, long long from, long long to, int useIndex, LogVisitor visit, void *ctx, LogQueryStats *stats); // Scan the log through its indexes
+int runStatement(int account, long long from, long long to); // Print one account's history
+int runLogReplay(long long from, long long to);       // Print every record in a time range
+int parseLogTime(const char *text, long long *nanos); // Parse a date/time argument
+int runLogBenchmark(long records, long queries);      // Time statements over a generated log
+int logWaitWritten(long long time);                   // Wait until every record published before time is written
+unsigned int snapshotHash(unsigned int hash, const void *data, size_t len); // Continue an FNV-1a hash
+void snapshotPreserve(int slot);                      // Save a slot's chunk for a running snapshot before changing it
+int snapshotStart();                                  // Take a snapshot point and start the background writer
+int snapshotFinish();                                 // Wait for the writer; returns 1 if the snapshot was written
+void snapshotTick();                                  // Join a finished writer and start the next one when due
+int snapshotReadHeader(FILE *fp, SnapshotHeader *header); // Read and check a snapshot header
+int snapshotCompact(long long takenAt);               // Remove log segments that lie wholly before takenAt
+int runSnapshot();                                    // Write a snapshot now and compact the log
+long rawRead(int fd, void *buf, size_t len);          // Unbuffered sequential read
+long rawWrite(int fd, const void *buf, size_t len);   // Unbuffered sequential write
+int syncFd(int fd);                                   // Flush a file's data to stable storage
+FILE* fileCreatePrivate(const char *path);            // Create a file only its owner can read, open for writing
+long long nowMicros();                                // Monotonic clock in microseconds
+long long monotonicNanos();                           // Monotonic clock in nanoseconds
 void mainMenu();                                      // Display main menu and handle user input
 void createAccount();                                 // Create a new bank account
 void deleteAccount();                                 // Delete an existing account
@@ -44,12 +1033,289 @@ void withdraw();                                      // Withdraw money from an
 void remittance();                                    // Transfer money between accounts
 void initDatabase();                                  // Initialize database directory and files
 int listAllAccountsAndSelect(int *selectedAccountNum); // List all accounts and allow selection 
+int listCursorRefresh(ListCursor *cur);               // Rebuild the cursor's slot order if it is stale
+int listCursorPage(ListCursor *cur, int page, int *slots); // Slots on one page of the listing
+void listPrintRows(const int *slots, int count, const char *emptyMessage); // Print account rows as a table
+int storeOpen();                                      // Open or create the binary account data file
+int storeReadSlot(int slot, StoreSlot *out);          // Copy one live slot out of the mapping
+int storeWriteSlot(int slot, StoreSlot *in);          // Copy one slot into the mapping
+StoreSlot* storeSlotAt(int slot);                     // Pointer to a slot inside the mapping
+int storeReserve(int slots);                          // Grow the file and mapping to hold slots
+int storeSync();                                      // msync the mapping to stable storage
+int storeSyncSlot(int slot);                          // msync only the page holding one slot
+void storeClose();                                    // Unmap and close the data file
+int storeAllocSlot();                                 // Reuse a free slot or append a new one
+int storeFreeSlot(int slot);                          // Release a slot after account deletion
+int indexBuild();                                     // Scan the data file in parallel into the index and columns
+int indexInsertConcurrent(int num, int slot);         // Lock-free insert used by the startup scan
+int storeSlotCheck(const StoreSlot *slot);            // CHECK_* problem of one slot, or CHECK_OK
+long cpuCount();                                      // Number of CPUs online, at least 1
+int loadThreadCount(long items);                      // Workers to start for a startup job
+void loadRun(LoadWorker *workers, int threads, long items, void* (*work)(void*)); // Run a job split into ranges
+int runCheck();                                       // Cross-check the data file, index, log and legacy files
+int checkSnapshot(CheckLog *log, long long *from);    // Seed the log cross-check from the snapshot
+int indexLookup(int num);                             // Slot of an account number, or -1 if absent
+int indexInsert(int num, int slot);                   // Add or update an account number mapping
+void indexRemove(int num);                            // Drop an account number from the index
+int columnsSet(int slot, const StoreSlot *row);       // Refresh one row of the columnar table
+void columnsFill(int slot, const Account *acc);       // Write one row without totals or versions
+int columnsReserve(int rows);                         // Grow the columns to hold rows entries
+void columnsSummarize(ColumnSummary *out);            // Scan the columns for counts and totals
+void columnsCount(int slot, int sign);                // Add or remove a row's share of the running totals
+void storeTotalsSummarize(ColumnSummary *out);        // The same figures from the running totals, in O(1)
+int runStats();                                       // Print the totals saved in the data file header
+int runReport();                                      // Print portfolio totals from the columns
+int searchOpen();                                     // Open the search index, rebuilding it if stale
+void searchClose();                                   // Sync and mark the search index clean
+int searchAddAccount(int slot, const Account *acc);   // Index a new account's ID, ID suffix and name
+int searchRemoveAccount(int slot, const Account *acc); // Drop a deleted account from the search index
+int searchFind(int tree, const char *low, const char *high, int *slots, int max, int *total); // Range/prefix lookup
+int searchAccounts(int *selectedAccountNum);          // Prompt for a search and list (or pick) matches
+int runSearchBenchmark(long accounts, long lookups);  // Time lookups over a generated population
+unsigned char accountTypeCode(const Account *acc);   // Kernel type code of an account
+int migrateLegacyDatabase();                          // Import database/<num>.txt files; -1 if some were not saved
+int legacyReadAccount(int num, Account *acc);         // Parse one account from the old text format; LEGACY_*
+int legacyCountFiles(const int *listed, int count);   // Count database/<num>.txt files not in a sorted list
+int compareAccountNumbers(const void *x, const void *y); // qsort() order of account numbers
+int ioInit();                                         // Start the io_uring or thread pool I/O backend
+int ioSubmit(IoRequest *req);                         // Queue a write (and sync) without waiting for it
+long ioWait(IoRequest *req);                          // Wait for a request; returns bytes written or < 0
+void ioShutdown();                                    // Drain outstanding requests and stop the backend
+const char* ioBackendName();                          // Name of the backend in use
+int journalRecover();                                 // Replay the journal into the data file at startup
+int journalAppend(int type, Account *a, Account *b, Money amount, Money fee); // Queue a journal record
+int journalMerge(JournalStage **stages, int count);   // Move staged records into the commit group in order
+int journalCommit();                                  // Flush and sync the open commit group
+int journalCheckpoint();                              // Sync the data file and truncate the journal
+int journalMaybeCheckpoint();                         // Checkpoint once the journal has grown past its limit
+int postTransaction(int type, Account *a, Account *b, Money amount, Money fee); // Durably apply a mutation
+int remittanceFeePercent(Account *from, Account *to); // Fee percentage between two account types
+Money remittanceFee(Account *from, Account *to, Money amount); // Fee charged on a remittance
+int checkDeposit(Account *acc, Money amount);         // Validate a deposit against business rules
+int checkWithdraw(Account *acc, Money amount);        // Validate a withdrawal against business rules
+int checkRemittance(Account *from, Account *to, Money amount, Money fee); // Validate a remittance
+int runBatch(const char *inputPath, const char *outputPath); // Post a file of operations non-interactively
+void engineInit();                                    // Initialize the engine's lock stripes
+int engineDeposit(int num, Money amount, Money *balance);  // Thread-safe deposit on the table
+int engineWithdraw(int num, Money amount, Money *balance); // Thread-safe withdrawal on the table
+int engineTransfer(int from, int to, Money amount, Money *fromBalance, Money *toBalance, Money *feeOut); // Thread-safe remittance
+void engineLogApplied(int type, int from, int to, Money amount, Money fee); // Audit-log an applied engine operation
+void viewOpen(ReadView *view);                        // Take, or share, a consistent point in the table
+int viewRow(const ReadView *view, int slot, StoreSlot *out); // Copy a row as it was at a view's point
+void viewClose(ReadView *view);                       // Release a view so writers stop keeping rows for it
+void viewPreserve(int slot);                          // Keep a row's contents for open views before it changes
+int viewReserve(int oldCapacity, int newCapacity);    // Grow the per-row view state along with the table
+void tableFree();                                     // Release the in-memory table
+int runStressTest(int threads, long opsPerThread);   // Check money conservation under concurrent load
+int tableWriteRow(int slot);                          // Copy one changed row into the mapping
+int tableAdopt(int slot);                             // Reload one row from the mapping, growing the table
+int createAccountRecord(Account *acc);                // Store, log and count a fully filled-in new account
+unsigned int pinHashOf(unsigned int salt, const char *pin); // Salted, stretched hash of a PIN
+void pinSet(Account *acc, const char *pin);           // Give an account a fresh salt and the hash of pin
+unsigned long long pinSessionTag(const char *pin);    // Cheap keyed stand-in for a PIN that verified, never 0
+int authVerify(int num, const char *pin);             // Check a PIN against the cache or the record; AUTH_*
+int authWriteLock(int num, unsigned int lockedUntil); // Write an account's lockout time into its record
+int authStoreLock(int num, unsigned int lockedUntil); // Persist an account's lockout time in its record
+int authTriesLeft(int num);                           // Wrong PINs an account may still take before it locks
+int authLockMinutes(int num);                         // Minutes left on an account's lockout, rounded up
+AuthEntry* authEntry(AuthTable *table, int num);      // An account's authentication entry, added if missing
+AuthTable* authAcquire(int num);                      // Table holding an account's entry, locked if shared
+void authRelease(AuthTable *table);                   // Unlock a table returned by authAcquire()
+void authSplit(int shards);                           // Spread the entries over shard tables, or gather them back
+int authPrompt(int num, const char *prompt);          // Ask for a PIN until it is right or the account locks
+void authForget(int num);                             // Drop a deleted account's authentication state
+int runAuthBenchmark(long accounts, long checks);     // Time PIN checks from the record and from memory
+int deleteAccountRecord(Account *acc);                // Release a live account's slot and index entries
+int runServer(const char *address);                   // Serve the transaction protocol until SIGINT/SIGTERM
+#ifdef BANK_HAVE_EPOLL
+int serverApply(const ServerRequest *req, const char *payload, int payloadLen, ServerResponse *resp); // Apply one request
+void serverShardDrain();                              // Wait until every shard worker has emptied its queue
+#endif
+int runLoadTest(const char *address, int connections, long requests, int depth); // Drive a server with pipelined clients
+long parseCount(const char *text);                    // Parse a count such as 20000, 20k or 1M
+int parseMoney(const char *text, Money *out);         // Parse a ringgit amount into exact sen
+Money moneyFromRinggit(float ringgit);                // Round a float ringgit amount of older versions to the sen
+int storeUpgrade(int version);                        // Convert a version 1 or 2 data file in place
+unsigned long long accountNumberNewSeed();            // Fresh random key for the number permutation
+int accountNumberAllocate();                          // Next unused 7-9 digit account number, or -1
+int runNumberBenchmark(long count);                   // Time and verify bulk number allocation
+int crashPointByName(const char *name);               // Crash point for a BANK_CRASH_AT step name
+void crashPoint(int point);                           // Kill the process if point is the armed step
+int runCrashTest();                                   // Kill a remittance at every step and check recovery
+int runMonthEnd();                                    // Apply month-end interest and fees to all accounts
 
 // Entry point: bootstrap storage, show intro, and start interactive menu
 // This is the main function that controls the program flow
-int main() {
+int main(int argc, char *argv[]) {
+    // The stress test runs on a synthetic in-memory population and never opens the database
+    if(argc > 1 && strcmp(argv[1], "--stress-test") == 0) {
+        int threads = (argc > 2) ? atoi(argv[2]) : STRESS_THREADS;
+        long ops = (argc > 3) ? atol(argv[3]) : STRESS_OPS;
+        if(threads < 1 || ops < 1) {
+            printf("Usage: %s --stress-test [threads] [ops-per-thread]\n", argv[0]);
+            return 1;
+        }
+        return runStressTest(threads, ops) ? 0 : 1;
+    }
+    
+    // Allocator microbenchmark; needs no database either
+    if(argc > 1 && strcmp(argv[1], "--bench-alloc") == 0) {
+        long ops = (argc > 2) ? atol(argv[2]) : BENCH_ALLOC_OPS;
+        if(ops < 1) {
+            printf("Usage: %s --bench-alloc [operations]\n", argv[0]);
+            return 1;
+        }
+        return runAllocBenchmark(ops) ? 0 : 1;
+    }
+    
+    // Storage benchmark on a generated population in its own bench-<accounts>-<format> directory
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        long accounts = (argc > 2) ? parseCount(argv[2]) : -1;
+        long ops = (argc > 3) ? parseCount(argv[3]) : BENCH_OPS;
+        int textFormat = (argc > 4) && strcmp(argv[4], "text") == 0;
+        int mix[3] = { 40, 30, 30 };
+        if(argc > 5 && sscanf(argv[5], "%d,%d,%d", &mix[0], &mix[1], &mix[2]) != 3)
+            mix[0] = -1;
+        if(accounts < 1 || ops < 1 || (argc > 4 && !textFormat && strcmp(argv[4], "binary") != 0) ||
+           mix[0] < 0 || mix[1] < 0 || mix[2] < 0 || mix[0] + mix[1] + mix[2] != 100) {
+            printf("Usage: %s --bench <accounts> [ops] [binary|text] [deposit%%,withdraw%%,remittance%%]\n", argv[0]);
+            printf("       sizes accept k and M suffixes, e.g. --bench 1M 20k text 40,30,30\n");
+            return 1;
+        }
+        return runBenchmark(accounts, ops, textFormat, mix) ? 0 : 1;
+    }
+    
+    // Account number allocator benchmark; works on a throwaway key and needs no database
+    if(argc > 1 && strcmp(argv[1], "--bench-numbers") == 0) {
+        long count = (argc > 2) ? parseCount(argv[2]) : BENCH_NUMBERS;
+        if(count < 1) {
+            printf("Usage: %s --bench-numbers [count]\n", argv[0]);
+            return 1;
+        }
+        return runNumberBenchmark(count) ? 0 : 1;
+    }
+    
+    // Secondary index lookups over a generated population, reusing the --bench directories
+    if(argc > 1 && strcmp(argv[1], "--bench-search") == 0) {
+        long accounts = (argc > 2) ? parseCount(argv[2]) : -1;
+        long lookups = (argc > 3) ? parseCount(argv[3]) : BENCH_SEARCHES;
+        if(accounts < 1 || lookups < 1) {
+            printf("Usage: %s --bench-search <accounts> [lookups]\n", argv[0]);
+            return 1;
+        }
+        return runSearchBenchmark(accounts, lookups) ? 0 : 1;
+    }
+    
+    // PIN verification from the record and from the authentication cache, reusing the --bench directories
+    if(argc > 1 && strcmp(argv[1], "--bench-auth") == 0) {
+        long accounts = (argc > 2) ? parseCount(argv[2]) : -1;
+        long checks = (argc > 3) ? parseCount(argv[3]) : BENCH_AUTH_CHECKS;
+        if(accounts < 1 || checks < 1) {
+            printf("Usage: %s --bench-auth <accounts> [checks]\n", argv[0]);
+            return 1;
+        }
+        return runAuthBenchmark(accounts, checks) ? 0 : 1;
+    }
+    
+    // Log write rate and indexed statement lookups over a generated log
+    if(argc > 1 && strcmp(argv[1], "--bench-log") == 0) {
+        long records = (argc > 2) ? parseCount(argv[2]) : -1;
+        long queries = (argc > 3) ? parseCount(argv[3]) : BENCH_LOG_QUERIES;
+        if(records < 1 || queries < 1) {
+            printf("Usage: %s --bench-log <records> [statements]\n", argv[0]);
+            return 1;
+        }
+        return runLogBenchmark(records, queries) ? 0 : 1;
+    }
+    
+    // Load generator for a running --serve; it only talks to the server and never opens the database
+    if(argc > 1 && strcmp(argv[1], "--load-test") == 0) {
+        long connections = (argc > 3) ? parseCount(argv[3]) : CLIENT_CONNECTIONS;
+        long requests = (argc > 4) ? parseCount(argv[4]) : CLIENT_REQUESTS;
+        int depth = (argc > 5) ? atoi(argv[5]) : CLIENT_DEPTH;
+        if(argc < 3 || argc > 6 || connections < 1 || connections > 1000000 || requests < 1 ||
+           depth < 1 || depth > CLIENT_MAX_DEPTH) {
+            printf("Usage: %s --load-test <port|socket-path> [connections] [requests] [depth]\n", argv[0]);
+            printf("       depth is the number of requests each connection pipelines (1-%d)\n", CLIENT_MAX_DEPTH);
+            return 1;
+        }
+        return runLoadTest(argv[2], (int)connections, requests, depth) ? 0 : 1;
+    }
+    
+    // Fault injection for manual crash testing; --crash-test arms every step in turn by itself
+    if(getenv("BANK_CRASH_AT") != NULL) {
+        crashAt = crashPointByName(getenv("BANK_CRASH_AT"));
+        if(crashAt == CRASH_NONE)
+            printf("Warning: unknown BANK_CRASH_AT step %s ignored\n", getenv("BANK_CRASH_AT"));
+    }
+    
+    // Remittance crash/recovery test in its own scratch directory
+    if(argc > 1 && strcmp(argv[1], "--crash-test") == 0)
+        return runCrashTest() ? 0 : 1;
+    
+    // Totals saved in the data file header, without loading the accounts
+    if(argc > 1 && strcmp(argv[1], "--stats") == 0)
+        return runStats() ? 0 : 1;
+    
+    // Render the binary transaction log as text without opening the database for writing
+    if(argc > 1 && strcmp(argv[1], "--dump-log") == 0)
+        return dumpLog(argc > 2 ? argv[2] : NULL) ? 0 : 1;
+    
+    // Per-account statements and time-range replay, answered from the log segment indexes
+    if(argc > 1 && (strcmp(argv[1], "--statement") == 0 || strcmp(argv[1], "--replay-log") == 0)) {
+        int statement = strcmp(argv[1], "--statement") == 0;
+        int first = statement ? 3 : 2, account = statement && argc > 2 ? atoi(argv[2]) : 0;
+        long long from = LLONG_MIN, to = LLONG_MAX;
+        if((statement && account <= 0) || (!statement && argc <= first) ||
+           (argc > first && !parseLogTime(argv[first], &from)) ||
+           (argc > first + 1 && !parseLogTime(argv[first + 1], &to)) || argc > first + 2) {
+            printf("Usage: %s --statement <account> [from] [to]\n", argv[0]);
+            printf("       %s --replay-log <from> [to]\n", argv[0]);
+            printf("       times are YYYY-MM-DD or YYYY-MM-DDTHH:MM[:SS] in local time\n");
+            return 1;
+        }
+        if(statement)
+            return runStatement(account, from, to) ? 0 : 1;
+        return runLogReplay(from, to) ? 0 : 1;
+    }
+    
     // Prepare storage files, greet user, show session info, then enter menu loop
     initDatabase();    // Ensure database directory and files exist
+    
+    // Batch mode posts a whole file of operations without any prompts
+    if(argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        if(argc != 4) {
+            printf("Usage: %s --batch <operations.csv> <results.csv>\n", argv[0]);
+            return 1;
+        }
+        return runBatch(argv[2], argv[3]) ? 0 : 1;
+    }
+    
+    // Portfolio totals computed from the columnar table
+    if(argc > 1 && strcmp(argv[1], "--report") == 0)
+        return runReport() ? 0 : 1;
+    
+    // Network server for teller front-ends and ATMs; runs until SIGINT or SIGTERM
+    if(argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        if(argc > 3) {
+            printf("Usage: %s --serve [port|socket-path]\n", argv[0]);
+            return 1;
+        }
+        return runServer(argc > 2 ? argv[2] : SERVER_DEFAULT_PORT) ? 0 : 1;
+    }
+    
+    // Integrity check of the database directory after the startup scan and recovery
+    if(argc > 1 && strcmp(argv[1], "--check") == 0)
+        return runCheck() ? 0 : 1;
+    
+    // Snapshot of every account now, followed by compaction of the log it covers
+    if(argc > 1 && strcmp(argv[1], "--snapshot") == 0)
+        return runSnapshot() ? 0 : 1;
+    
+    // Month-end posting of interest and maintenance fees
+    if(argc > 1 && strcmp(argv[1], "--month-end") == 0)
+        return runMonthEnd() ? 0 : 1;
+    
     welcome();         // Display welcome banner with ASCII art
     showSession();     // Show current session time and account count
     mainMenu();        // Enter main menu loop for user interaction
@@ -57,7 +1323,7 @@ int main() {
     return 0;          // Successful program termination
 }
 
-// Ensures the backing directory/index file exist before any operations run
+// Ensures the backing directory and data file exist before any operations run
 // This function initializes the database structure for the banking system
 void initDatabase() {
     // Create database directory with appropriate permissions
@@ -67,11 +1333,49 @@ void initDatabase() {
         mkdir("database", 0700);        // Unix/Linux: with read/write/execute permissions for owner only
     #endif
     
-    // Ensure index.txt exists so future reads do not fail
-    // The index file tracks all account numbers for quick enumeration
-    FILE *fp = fopen("database/index.txt", "a");
-    if(fp != NULL) {
-        fclose(fp);                     // Close immediately after creating/opening
+    // Journal and log writes go through the asynchronous I/O layer
+    if(!ioInit()) {
+        printf("Error: Unable to start the I/O backend!\n");
+        exit(1);
+    }
+    
+    // Start the audit log first so migration and recovery can record what they did
+    if(!logOpen()) {
+        printf("Error: Unable to open transaction log in %s!\n", LOG_DIR);
+        exit(1);
+    }
+    
+    if(!storeOpen()) {
+        printf("Error: Unable to open account data file %s!\n", STORE_FILE);
+        exit(1);
+    }
+    
+    // Check every slot and load the index and columns once so later lookups never touch the disk
+    if(!indexBuild()) {
+        printf("Error: Not enough memory to index accounts!\n");
+        exit(1);
+    }
+    int damaged = loadReport.problems[CHECK_BAD_STATE] + loadReport.problems[CHECK_BAD_CHECKSUM];
+    int implausible = 0;
+    for(int k = CHECK_BAD_NUMBER; k < CHECK_KINDS; k++)
+        implausible += loadReport.problems[k];
+    if(damaged > 0 || implausible > 0 || loadReport.duplicates > 0)
+        printf("Warning: %s has %d damaged slots, %d accounts with invalid fields and %d duplicate "
+               "account numbers; run --check for details\n", STORE_FILE, damaged, implausible, loadReport.duplicates);
+    // An index.txt means this database still uses one text file per account, or a migration was cut short
+    if(access("database/index.txt", 0) == 0)
+        migrateLegacyDatabase();
+    
+    // Finish any balance changes a crash left in the journal before serving requests
+    if(!journalRecover()) {
+        printf("Error: Unable to recover journal %s!\n", JOURNAL_FILE);
+        exit(1);
+    }
+    
+    // Secondary index over ID numbers and names; rebuilt here if it is missing or was not closed cleanly
+    if(!searchOpen()) {
+        printf("Error: Unable to open search index %s!\n", SEARCH_FILE);
+        exit(1);
     }
 }
 
@@ -91,204 +1395,6749 @@ void welcome() {
 // This function provides session context and system status information
 void showSession() {
     time_t now = time(NULL);    // Get current system time
-    int count = 0;              // Counter for total accounts
-    int num;                    // Temporary variable for reading account numbers
-    FILE *fp = fopen("database/index.txt", "r");  // Open index file for reading
+    int count = indexCount;     // The in-memory index already knows how many accounts exist
+    ColumnSummary summary;
     
     printf("\n+==============================================+\n");
     printf("  Banking Management System - Session Info\n");
     printf("+==============================================+\n");
     printf("  Session Time: %s", ctime(&now));  // Display current time
     
-    if(fp != NULL) {
-        // Count how many account numbers are recorded in the index file
-        // This gives us the total number of accounts in the system
-        while(fscanf(fp, "%d", &num) == 1)
-            count++;
-        fclose(fp);  // Always close file handles
-    }
-    
     printf("  Total Accounts: %d\n", count);
     if(count == 0)
         printf("  Note: No accounts found. Create one to start.\n");
+    else {
+        // Running totals, so the summary costs the same for any number of accounts
+        storeTotalsSummarize(&summary);
+        Money total = summary.deposits[ACCOUNT_SAVINGS] + summary.deposits[ACCOUNT_CURRENT];
+        printf("  Active / Closed: %d / %d\n", summary.active, summary.closed);
+        printf("  Deposits: Savings RM%.2f, Current RM%.2f\n",
+               MONEY_RM(summary.deposits[ACCOUNT_SAVINGS]), MONEY_RM(summary.deposits[ACCOUNT_CURRENT]));
+        printf("  Average Balance: RM%.2f\n", summary.active ? MONEY_RM(total) / summary.active : 0.0);
+        printf("  Fees Collected: RM%.2f\n", MONEY_RM(storeTotals.feesCollected));
+    }
+    #ifndef BANK_NO_METRICS
+        printf("+----------------------------------------------+\n");
+        metricsPrintSummary();
+    #endif
     printf("+==============================================+\n");
 }
 
 // Appends every significant action to a transaction log for auditing
 // This function maintains a complete audit trail of all system activities
+// Free-text actions are kept for rare events; hot paths call logEvent() with typed fields
 void logTransaction(char* action) {
-    FILE *fp = fopen("database/transaction.log", "a");  // Open log file in append mode
-    if(fp != NULL) {
-        time_t now = time(NULL);    // Get current timestamp
-        char timeStr[100];
-        strcpy(timeStr, ctime(&now));
-        timeStr[strlen(timeStr)-1] = '\0'; /*Remove newline character from ctime output*/
-        
-        // Append the action with a timestamp to the log file
-        // Format: [YYYY-MM-DD HH:MM:SS] action description
-        fprintf(fp, "[%s] %s\n", timeStr, action);
-        fclose(fp);  // Ensure log file is properly closed
-    }
+    logEvent(LOG_TEXT, 0, 0, 0, 0, action);
 }
 
-// Pretty-print the current state of an account in tabular form
-void displayAccount(Account *acc) {
-    // Pretty-print the current state of an account in tabular form
-    char *stat = (acc->status == 0) ? "Active" : "Closed";
-    printf("\n+------------------------------------------------------------------+\n");
-    printf("| Account No | Name      | PIN  | Balance    | Type     | Status   |\n");
-    printf("|%11d |%10s |%5s |%11.2f |%8s  |%8s  |\n",
-           acc->accountNumber, acc->accountName, acc->pin, 
-           acc->balance, acc->accountType, stat);
-    printf("+------------------------------------------------------------------+\n");
+// Wall-clock time in nanoseconds since the Unix epoch
+long long nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-// Lists up to 100 accounts and lets the operator choose one interactively
-int listAllAccountsAndSelect(int *selectedAccountNum) {
-    FILE *fp = fopen("database/index.txt", "r");
-    int num, count = 0;
-    int accountNumbers[100];
-    Account *acc;
-    int selection;
-    // Using an index file avoids scanning the whole directory on each request
-    
-    if(fp == NULL) {
-        // No index file means no accounts were ever created
-        printf("No accounts found!\n");
-        return 0;
-    }
-    
-    printf("\n+==================================================================+\n");
-    printf("| No | Account No | Name       | Balance    | Type     | Status   |\n");
-    printf("+----+------------+------------+------------+----------+----------+\n");
+// Releases the calling thread's ring when the thread exits; the flusher drains what is left
+void logRingRelease(void *arg) {
+    LogRing *ring = (LogRing*)arg;
+    atomic_store_explicit(&ring->inUse, 0, memory_order_release);
+}
+
+// Returns the calling thread's ring, claiming a free one the first time the thread logs
+LogRing* logThreadRing() {
+    if(logMyRing != NULL)
+        return logMyRing;
     
-    while(fscanf(fp, "%d", &num) == 1 && count < 100) {
-        // Load each account so we can show its latest balance and status
-        acc = getAccount(num);
-        if(acc->accountNumber != 0) {
-            accountNumbers[count] = acc->accountNumber;
-            count++;
-            char *stat = (acc->status == 0) ? "Active" : "Closed";
-            printf("| %2d |%11d |%-11s |%11.2f |%-9s |%-9s |\n",
-                   count, acc->accountNumber, acc->accountName, 
-                   acc->balance, acc->accountType, stat);
+    for(;;) {
+        // Reuse a ring whose owner thread has exited and whose records are all written
+        for(int i = 0; i < LOG_MAX_RINGS; i++) {
+            LogRing *ring = &logRings[i];
+            int expected = 0;
+            if(atomic_load_explicit(&ring->head, memory_order_acquire) !=
+               atomic_load_explicit(&ring->tail, memory_order_acquire))
+                continue;
+            if(atomic_compare_exchange_strong(&ring->inUse, &expected, 1)) {
+                logMyRing = ring;
+                pthread_setspecific(logRingKey, ring);
+                return ring;
+            }
         }
-        free(acc);
+        // Every ring is owned or still draining; give the flusher a moment
+        sched_yield();
     }
+}
+
+// Pushes one fixed-size record into the calling thread's ring; no locks and no system calls
+// The only wait is when the ring is full, which means the flusher has fallen far behind
+void logEvent(int type, int a, int b, Money amount, Money fee, const char *text) {
+    LogRing *ring;
+    LogRecord *rec;
+    unsigned int head;
     
-    printf("+==================================================================+\n");
-    fclose(fp);
+    if(!logRunning)
+        return;
+    METRIC_START(started);
     
-    if(count == 0) {
-        printf("No accounts available.\n");
-        return 0;
+    ring = logThreadRing();
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_RECORDS)
+        sched_yield();
+    
+    rec = &ring->records[head & (LOG_RING_RECORDS - 1)];
+    rec->timestamp = nowNanos();
+    rec->type = (unsigned int)type;
+    rec->account[0] = a;
+    rec->account[1] = b;
+    rec->amount = amount;
+    rec->fee = fee;
+    if(text != NULL) {
+        strncpy(rec->text, text, sizeof(rec->text) - 1);
+        rec->text[sizeof(rec->text) - 1] = '\0';
+    } else {
+        rec->text[0] = '\0';
     }
     
-    while(1) {
+    // Publish the record; the release store orders it before the new head becomes visible
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    METRIC_STOP(METRIC_LOG, started);
+}
+
+// Moves every published record from all rings into buf; returns the number of records copied
+int logDrain(LogRecord *buf, int capacity) {
+    int copied = 0;
+    
+    for(int i = 0; i < LOG_MAX_RINGS && copied < capacity; i++) {
+        LogRing *ring = &logRings[i];
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    
+        while(tail != head && copied < capacity) {
+            buf[copied++] = ring->records[tail & (LOG_RING_RECORDS - 1)];
+            tail++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return copied;
+}
+
+// Waits for the flusher's previous batch write; the log has at most one write in flight,
+// so batches reach the file in the order they were drained. A failed or short write poisons
+// the log for good, and logWrittenThrough stops where it was.
+void logWaitWrite(IoRequest *write, int *inFlight, long long submitted) {
+    (void)submitted;
+    if(!*inFlight)
+        return;
+    long written = ioWait(write);
+    METRIC_STOP(METRIC_LOG_FLUSH, submitted);
+    *inFlight = 0;
+    if(written != (long)write->len) {
+        if(!atomic_exchange(&logFailed, 1))
+            printf("Error: Audit log write failed; no further records will be logged!\n");
+        return;
+    }
+    atomic_store_explicit(&logWrittenThrough, logBatchDrainedAt, memory_order_release);
+}
+
+// Waits until every record published before time is in its segment file, so a scan sees it
+// Used by the snapshot writer; returns at once once the log is closed, and 0 if it has failed
+int logWaitWritten(long long time) {
+    while(logRunning && !atomic_load(&logFailed) &&
+          atomic_load_explicit(&logWrittenThrough, memory_order_acquire) <= time) {
+        struct timespec pause = { 0, LOG_FLUSH_INTERVAL_NS };
+        nanosleep(&pause, NULL);
+    }
+    return !atomic_load(&logFailed);
+}
+
+// Background thread: gathers records from every ring and writes them in large sequential writes
+// Two batch buffers alternate, so the next batch is drained while the previous one is written
+void* logFlusher(void *arg) {
+    LogRecord *batches = (LogRecord*)malloc(2 * LOG_FLUSH_RECORDS * sizeof(LogRecord));
+    IoRequest write;
+    int current = 0, inFlight = 0;
+    long long submitted = 0;
+    #ifndef BANK_NO_METRICS
+        long long lastMetrics = nowMicros();
+    #endif
+    (void)arg;
+    
+    if(batches == NULL)
+        return NULL;
+    
+    for(;;) {
+        int stopping = !atomic_load_explicit(&logFlusherActive, memory_order_acquire);
+        LogRecord *batch = batches + (size_t)current * LOG_FLUSH_RECORDS;
+        long long drainedAt = nowNanos();
+        int n = logDrain(batch, LOG_FLUSH_RECORDS);
+    
+        // A batch that fills the segment is split: the rest goes to the next segment
+        // Once the log has failed, batches are still drained so logEvent() never blocks, but dropped
+        for(int done = 0; done < n && !atomic_load(&logFailed); ) {
+            int chunk = n - done;
+            if((unsigned long long)chunk > logSegmentLimit - logIndex.records)
+                chunk = (int)(logSegmentLimit - logIndex.records);
+            for(int i = 0; i < chunk; i++)
+                logIndexAdd(&logIndex, &batch[done + i]);
+            logWaitWrite(&write, &inFlight, submitted);
+            write.fd = logFd;
+            write.buf = batch + done;
+            write.len = (size_t)chunk * sizeof(LogRecord);
+            write.offset = -1;
+            write.sync = 0;
+            if(done + chunk == n)
+                logBatchDrainedAt = drainedAt;
+            submitted = monotonicNanos();
+            inFlight = ioSubmit(&write);
+            done += chunk;
+            if(logIndex.records >= logSegmentLimit) {
+                logWaitWrite(&write, &inFlight, submitted);
+                logSegmentSeal();
+            }
+        }
+        if(n > 0) {
+            current ^= 1;
+        } else {
+            // Nothing new was published before drainedAt, so once the last write is done it is all written
+            logWaitWrite(&write, &inFlight, submitted);
+            if(!atomic_load(&logFailed))
+                atomic_store_explicit(&logWrittenThrough, drainedAt, memory_order_release);
+        }
+        #ifndef BANK_NO_METRICS
+            // The flusher is already awake every millisecond, so it also keeps the metrics file fresh
+            if(nowMicros() - lastMetrics >= METRICS_DUMP_USEC || stopping) {
+                metricsWriteFile(METRICS_FILE);
+                lastMetrics = nowMicros();
+            }
+        #endif
+        if(n == LOG_FLUSH_RECORDS)
+            continue;            // More is waiting, keep going without sleeping
+        if(stopping)
+            break;               // Rings were drained after the stop request was seen
+    
+        struct timespec pause = { 0, LOG_FLUSH_INTERVAL_NS };
+        nanosleep(&pause, NULL);
+    }
+    logWaitWrite(&write, &inFlight, submitted);
+    free(batches);
+    return NULL;
+}
+
+// Opens the newest log segment and starts the flusher thread
+// A single-file log from an older version becomes segment 0
+int logOpen() {
+    unsigned int first, last;
+    char path[64];
+    const char *limit = getenv("BANK_LOG_SEGMENT");
+    
+    if(limit != NULL && atol(limit) > 0)
+        logSegmentLimit = ((unsigned long long)atol(limit) + LOG_BLOCK_RECORDS - 1) / LOG_BLOCK_RECORDS * LOG_BLOCK_RECORDS;
+    #ifdef _WIN32
+        mkdir(LOG_DIR);
+    #else
+        mkdir(LOG_DIR, 0700);
+    #endif
+    if(logListSegments(&first, &last) == 0) {
+        last = 0;
+        logSegmentPath(path, sizeof(path), 0, "bin");
+        if(access(LOG_FILE, 0) == 0 && rename(LOG_FILE, path) != 0)
+            return 0;
+    }
+    // Records are only appended to a segment of the current layout
+    logSegmentPath(path, sizeof(path), last, "bin");
+    int format = logFileFormat(path);
+    if(format > LOG_FORMAT_VERSION) {
+        printf("Error: %s was written by a newer version (log format %d)!\n", path, format);
+        return 0;
+    }
+    if(format == 0)
+        logCheckFormat(path);
+    if(!logSegmentOpen(last))
+        return 0;
+    
+    // A segment that is already full, such as a large migrated log, is sealed straight away, and so
+    // is one written before segments carried a format record
+    if((logIndex.records >= logSegmentLimit || format == 0) && !logSegmentSeal())
+        return 0;
+    
+    pthread_key_create(&logRingKey, logRingRelease);
+    atomic_store(&logFlusherActive, 1);
+    if(pthread_create(&logFlusherThread, NULL, logFlusher, NULL) != 0) {
+        close(logFd);
+        logFd = -1;
+        return 0;
+    }
+    logRunning = 1;
+    atexit(logClose);
+    return 1;
+}
+
+// Stops the flusher after it has written every queued record; registered with atexit()
+void logClose() {
+    if(!logRunning)
+        return;
+    logRunning = 0;
+    atomic_store_explicit(&logFlusherActive, 0, memory_order_release);
+    pthread_join(logFlusherThread, NULL);
+    syncFd(logFd);
+    // After a failed write the index would claim records the segment does not hold
+    if(!atomic_load(&logFailed))
+        logIndexWrite(&logIndex, logSegment);
+    close(logFd);
+    logFd = -1;
+}
+
+// Path of a segment's log ("bin") or index ("idx") file
+void logSegmentPath(char *out, size_t size, unsigned int segment, const char *ext) {
+    snprintf(out, size, "%s/%08u.%s", LOG_DIR, segment, ext);
+}
+
+// Finds the lowest and highest segment numbers in LOG_DIR; returns how many segments there are
+int logListSegments(unsigned int *first, unsigned int *last) {
+    int count = 0;
+    
+    *first = UINT_MAX;
+    *last = 0;
+    #ifdef _WIN32
+        struct _finddata_t found;
+        intptr_t handle = _findfirst(LOG_DIR "/*.bin", &found);
+        if(handle == -1)
+            return 0;
+        do {
+            const char *name = found.name;
+    #else
+        DIR *dir = opendir(LOG_DIR);
+        struct dirent *entry;
+        if(dir == NULL)
+            return 0;
+        while((entry = readdir(dir)) != NULL) {
+            const char *name = entry->d_name;
+    #endif
+            unsigned int segment;
+            char ext[4];
+            if(strlen(name) == 12 && sscanf(name, "%8u.%3s", &segment, ext) == 2 && strcmp(ext, "bin") == 0) {
+                if(segment < *first) *first = segment;
+                if(segment > *last) *last = segment;
+                count++;
+            }
+    #ifdef _WIN32
+        } while(_findnext(handle, &found) == 0);
+        _findclose(handle);
+    #else
+        }
+        closedir(dir);
+    #endif
+    return count;
+}
+
+// Accounts a record belongs to; summary events carry counters in account[], not accounts
+int logRecordAccounts(const LogRecord *rec, int *accounts) {
+    switch(rec->type) {
+        case LOG_REMITTANCE:
+            accounts[0] = rec->account[0];
+            accounts[1] = rec->account[1];
+            return 2;
+        case LOG_CREATE:
+        case LOG_DELETE:
+        case LOG_DEPOSIT:
+        case LOG_WITHDRAW:
+            accounts[0] = rec->account[0];
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Bloom bit number j of an account; one 64-bit mix gives all LOG_BLOOM_HASHES bits
+unsigned int logBloomBit(int account, int j) {
+    unsigned long long x = (unsigned int)account * 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 31)) * 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 29;
+    return (unsigned int)(x >> (j * 16)) & (LOG_BLOOM_BITS - 1);
+}
+
+// Empties an index and sizes it for a segment of up to capacity records
+int logIndexReset(LogIndex *idx, unsigned long long capacity) {
+    free(idx->times);
+    free(idx->bloom);
+    memset(idx, 0, sizeof(LogIndex));
+    idx->maxBlocks = (unsigned int)((capacity + LOG_BLOCK_RECORDS - 1) / LOG_BLOCK_RECORDS);
+    if(idx->maxBlocks == 0)
+        idx->maxBlocks = 1;
+    idx->rowBytes = (idx->maxBlocks + 7) / 8;
+    idx->times = (LogBlockTimes*)calloc(idx->maxBlocks, sizeof(LogBlockTimes));
+    idx->bloom = (unsigned char*)calloc(LOG_BLOOM_BITS, idx->rowBytes);
+    return idx->times != NULL && idx->bloom != NULL;
+}
+
+// Adds the next record of the segment to its block's time range and bloom bits
+void logIndexAdd(LogIndex *idx, const LogRecord *rec) {
+    unsigned int block = (unsigned int)(idx->records / LOG_BLOCK_RECORDS);
+    LogBlockTimes *t = &idx->times[block];
+    int accounts[2], n = logRecordAccounts(rec, accounts);
+    
+    if(idx->records % LOG_BLOCK_RECORDS == 0)
+        t->minTime = t->maxTime = rec->timestamp;
+    if(rec->timestamp < t->minTime) t->minTime = rec->timestamp;
+    if(rec->timestamp > t->maxTime) t->maxTime = rec->timestamp;
+    if(idx->records == 0 || rec->timestamp < idx->minTime) idx->minTime = rec->timestamp;
+    if(idx->records == 0 || rec->timestamp > idx->maxTime) idx->maxTime = rec->timestamp;
+    for(int a = 0; a < n; a++)
+        for(int j = 0; j < LOG_BLOOM_HASHES; j++)
+            idx->bloom[(size_t)logBloomBit(accounts[a], j) * idx->rowBytes + block / 8] |= (unsigned char)(1 << (block % 8));
+    idx->records++;
+}
+
+// Writes a segment's index next to it, through a temporary file so readers never see half of one
+int logIndexWrite(const LogIndex *idx, unsigned int segment) {
+    LogIndexHeader header;
+    char path[64], temp[72];
+    FILE *fp;
+    
+    if(idx->times == NULL)
+        return 0;
+    logSegmentPath(path, sizeof(path), segment, "idx");
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if((fp = fileCreatePrivate(temp)) == NULL)
+        return 0;
+    memset(&header, 0, sizeof(header));
+    header.magic = LOG_INDEX_MAGIC;
+    header.version = LOG_INDEX_VERSION;
+    header.blockRecords = LOG_BLOCK_RECORDS;
+    header.bloomBits = LOG_BLOOM_BITS;
+    header.blocks = (unsigned int)((idx->records + LOG_BLOCK_RECORDS - 1) / LOG_BLOCK_RECORDS);
+    header.rowBytes = (header.blocks + 7) / 8;
+    header.records = idx->records;
+    header.minTime = idx->minTime;
+    header.maxTime = idx->maxTime;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(idx->times, sizeof(LogBlockTimes), header.blocks, fp) == header.blocks;
+    // Only the bytes of each row that cover used blocks are saved, so a short segment has a short index
+    for(unsigned int p = 0; ok && p < LOG_BLOOM_BITS; p++)
+        ok = fwrite(idx->bloom + (size_t)p * idx->rowBytes, 1, header.rowBytes, fp) == header.rowBytes;
+    ok = ok && fflush(fp) == 0 && syncFd(fileno(fp));
+    ok = (fclose(fp) == 0) && ok;
+    return ok && rename(temp, path) == 0;
+}
+
+// Reads a segment's index header; fails unless it matches this build and covers at most records
+int logIndexReadHeader(FILE *fp, LogIndexHeader *header, unsigned long long records) {
+    return fread(header, sizeof(LogIndexHeader), 1, fp) == 1 && header->magic == LOG_INDEX_MAGIC &&
+           header->version == LOG_INDEX_VERSION && header->blockRecords == LOG_BLOCK_RECORDS &&
+           header->bloomBits == LOG_BLOOM_BITS && header->records <= records &&
+           header->blocks == (header->records + LOG_BLOCK_RECORDS - 1) / LOG_BLOCK_RECORDS &&
+           header->rowBytes >= (header->blocks + 7) / 8;
+}
+
+// Loads a saved index into idx, which must already be sized for the segment
+int logIndexLoad(LogIndex *idx, unsigned int segment, unsigned long long records) {
+    LogIndexHeader header;
+    char path[64];
+    FILE *fp;
+    int ok;
+    
+    logSegmentPath(path, sizeof(path), segment, "idx");
+    if((fp = fopen(path, "rb")) == NULL)
+        return 0;
+    ok = logIndexReadHeader(fp, &header, records) && header.blocks <= idx->maxBlocks &&
+         fread(idx->times, sizeof(LogBlockTimes), header.blocks, fp) == header.blocks;
+    // Rows are copied one by one, since the saved rows may be shorter than the ones in memory
+    for(unsigned int p = 0; ok && p < LOG_BLOOM_BITS; p++) {
+        unsigned char *row = idx->bloom + (size_t)p * idx->rowBytes;
+        ok = fread(row, 1, (header.blocks + 7) / 8, fp) == (header.blocks + 7) / 8 &&
+             fseek(fp, header.rowBytes - (header.blocks + 7) / 8, SEEK_CUR) == 0;
+    }
+    fclose(fp);
+    if(ok) {
+        idx->records = header.records;
+        idx->minTime = header.minTime;
+        idx->maxTime = header.maxTime;
+    }
+    return ok;
+}
+
+// Fills in the format record that opens every segment, so readers know the layout that follows
+void logFormatRecord(LogRecord *rec) {
+    memset(rec, 0, sizeof(LogRecord));
+    rec->timestamp = nowNanos();
+    rec->type = LOG_FORMAT;
+    rec->account[0] = LOG_FORMAT_VERSION;
+    strcpy(rec->text, LOG_FORMAT_TEXT);
+}
+
+// Layout version of a log file, from its first record: 0 for a file written before segments carried
+// a format record, LOG_FORMAT_VERSION for an empty one, and -1 if it cannot be opened
+int logFileFormat(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    LogRecord rec;
+    int format = LOG_FORMAT_VERSION;
+    
+    if(fp == NULL)
+        return -1;
+    if(fread(&rec, sizeof(rec), 1, fp) == 1)
+        format = (rec.type == LOG_FORMAT && memcmp(rec.text, LOG_FORMAT_TEXT, sizeof(LOG_FORMAT_TEXT)) == 0)
+                 ? rec.account[0] : 0;
+    fclose(fp);
+    return format;
+}
+
+// Warns when a log file is not in the current layout, since its records would render wrongly
+void logCheckFormat(const char *path) {
+    int format = logFileFormat(path);
+    
+    if(format == 0)
+        printf("Warning: %s has no log format record; if an older version that kept float ringgit "
+               "wrote it, its amounts are shown wrongly\n", path);
+    else if(format > LOG_FORMAT_VERSION)
+        printf("Warning: %s was written by a newer version (log format %d) and may be shown wrongly\n",
+               path, format);
+}
+
+// Opens a segment for appending and brings its in-memory index up to date: the saved index is
+// loaded and only records written after it (those of a run that crashed) are read back
+int logSegmentOpen(unsigned int segment) {
+    char path[64];
+    struct stat st;
+    LogRecord chunk[LOG_BLOCK_RECORDS];
+    
+    logSegmentPath(path, sizeof(path), segment, "bin");
+    logFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if(logFd < 0 || fstat(logFd, &st) != 0)
+        return 0;
+    
+    // A record torn by a crash is dropped so every later record stays aligned
+    unsigned long long records = (unsigned long long)st.st_size / sizeof(LogRecord);
+    if((unsigned long long)st.st_size != records * sizeof(LogRecord)) {
+        #ifdef _WIN32
+            if(_chsize(logFd, (long)(records * sizeof(LogRecord))) != 0) return 0;
+        #else
+            if(ftruncate(logFd, (off_t)(records * sizeof(LogRecord))) != 0) return 0;
+        #endif
+    }
+    // A new segment starts with its format record
+    if(records == 0) {
+        LogRecord format;
+        logFormatRecord(&format);
+        if(rawWrite(logFd, &format, sizeof(format)) != (long)sizeof(format))
+            return 0;
+        records = 1;
+    }
+    logSegment = segment;
+    if(!logIndexReset(&logIndex, records > logSegmentLimit ? records : logSegmentLimit))
+        return 0;
+    if(!logIndexLoad(&logIndex, segment, records) && !logIndexReset(&logIndex, records > logSegmentLimit ? records : logSegmentLimit))
+        return 0;
+    if(logIndex.records == records)
+        return 1;
+    
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL || fseek(fp, (long)(logIndex.records * sizeof(LogRecord)), SEEK_SET) != 0) {
+        if(fp != NULL)
+            fclose(fp);
+        return 0;
+    }
+    size_t n;
+    while(logIndex.records < records && (n = fread(chunk, sizeof(LogRecord), LOG_BLOCK_RECORDS, fp)) > 0)
+        for(size_t i = 0; i < n && logIndex.records < records; i++)
+            logIndexAdd(&logIndex, &chunk[i]);
+    fclose(fp);
+    return 1;
+}
+
+// Finishes the current segment: saves its index and moves on to a fresh segment
+int logSegmentSeal() {
+    int ok = syncFd(logFd) && logIndexWrite(&logIndex, logSegment);
+    
+    close(logFd);
+    logFd = -1;
+    return logSegmentOpen(logSegment + 1) && ok;
+}
+
+// Reads count records from index start of an open segment and hands on those that match
+void logScanRecords(FILE *fp, unsigned long long start, unsigned long long count, int account,
+                    long long from, long long to, LogVisitor visit, void *ctx, LogQueryStats *stats) {
+    LogRecord chunk[LOG_BLOCK_RECORDS];
+    int accounts[2];
+    
+    if(fseek(fp, (long)(start * sizeof(LogRecord)), SEEK_SET) != 0)
+        return;
+    while(count > 0) {
+        size_t want = count < LOG_BLOCK_RECORDS ? (size_t)count : LOG_BLOCK_RECORDS;
+        size_t n = fread(chunk, sizeof(LogRecord), want, fp);
+        if(n == 0)
+            break;
+        stats->recordsRead += n;
+        count -= n;
+        for(size_t i = 0; i < n; i++) {
+            if(chunk[i].timestamp < from || chunk[i].timestamp > to)
+                continue;
+            if(account != 0) {
+                int k = logRecordAccounts(&chunk[i], accounts);
+                if(!(k > 0 && accounts[0] == account) && !(k > 1 && accounts[1] == account))
+                    continue;
+            }
+            stats->matches++;
+            visit(&chunk[i], ctx);
+        }
+    }
+}
+
+// Passes every record in [from, to] (all records when account is 0, else that account's) to visit,
+// in log order. With useIndex, segments and blocks whose time range or bloom bits rule them out are
+// never read; records a crash left past the end of a segment's index are scanned directly.
+int logQuery(int account, long long from, long long to, int useIndex, LogVisitor visit, void *ctx, LogQueryStats *stats) {
+    unsigned int first, last;
+    unsigned char *candidates = NULL;
+    LogBlockTimes *times = NULL;
+    char path[64];
+    int timed = (from != LLONG_MIN || to != LLONG_MAX);
+    
+    memset(stats, 0, sizeof(LogQueryStats));
+    if(logListSegments(&first, &last) == 0)
+        return 1;
+    for(unsigned int segment = first; segment <= last; segment++) {
+        struct stat st;
+        LogIndexHeader header;
+        FILE *fp, *ix = NULL;
+        
+        logSegmentPath(path, sizeof(path), segment, "bin");
+        if(stat(path, &st) != 0 || (fp = fopen(path, "rb")) == NULL)
+            continue;
+        stats->segments++;
+        unsigned long long records = (unsigned long long)st.st_size / sizeof(LogRecord), covered = 0;
+        
+        logSegmentPath(path, sizeof(path), segment, "idx");
+        if(useIndex && (ix = fopen(path, "rb")) != NULL && logIndexReadHeader(ix, &header, records)) {
+            covered = header.records;
+            int skip = covered == 0 || header.maxTime < from || header.minTime > to;
+            unsigned int rowBytes = (header.blocks + 7) / 8;
+            LogBlockTimes *t = skip ? NULL : (LogBlockTimes*)realloc(times, (header.blocks + 1) * sizeof(LogBlockTimes));
+            unsigned char *c = skip ? NULL : (unsigned char*)realloc(candidates, rowBytes + 1);
+            if(t != NULL) times = t;
+            if(c != NULL) candidates = c;
+            // Block time ranges are only read when the query is bounded in time
+            if(!skip && (t == NULL || c == NULL ||
+                         (timed && fread(times, sizeof(LogBlockTimes), header.blocks, ix) != header.blocks)))
+                covered = 0;
+            else if(!skip) {
+                // Candidate blocks: the AND of the account's bloom rows, or every block for a time range
+                long rows = (long)(sizeof(LogIndexHeader) + (size_t)header.blocks * sizeof(LogBlockTimes));
+                memset(candidates, 0xFF, rowBytes);
+                for(int j = 0; account != 0 && j < LOG_BLOOM_HASHES && covered; j++) {
+                    unsigned char row[4096];
+                    long offset = rows + (long)logBloomBit(account, j) * (long)header.rowBytes;
+                    for(unsigned int done = 0; done < rowBytes && covered; done += sizeof(row)) {
+                        size_t len = rowBytes - done < sizeof(row) ? rowBytes - done : sizeof(row);
+                        if(fseek(ix, offset + done, SEEK_SET) != 0 || fread(row, 1, len, ix) != len)
+                            covered = 0;
+                        for(size_t b = 0; b < len && covered; b++)
+                            candidates[done + b] &= row[b];
+                    }
+                }
+                for(unsigned int b = 0; b < header.blocks && covered; b++) {
+                    if(!(candidates[b / 8] & (1 << (b % 8))) || (timed && (times[b].maxTime < from || times[b].minTime > to)))
+                        continue;
+                    unsigned long long start = (unsigned long long)b * LOG_BLOCK_RECORDS;
+                    unsigned long long count = covered - start < LOG_BLOCK_RECORDS ? covered - start : LOG_BLOCK_RECORDS;
+                    stats->blocksRead++;
+                    logScanRecords(fp, start, count, account, from, to, visit, ctx, stats);
+                }
+            }
+        }
+        if(ix != NULL)
+            fclose(ix);
+        logScanRecords(fp, covered, records - covered, account, from, to, visit, ctx, stats);
+        fclose(fp);
+    }
+    free(times);
+    free(candidates);
+    return 1;
+}
+
+// Parses YYYY-MM-DD or YYYY-MM-DDTHH:MM[:SS] (local time) into nanoseconds since the epoch
+int parseLogTime(const char *text, long long *nanos) {
+    struct tm tm;
+    char extra;
+    
+    memset(&tm, 0, sizeof(tm));
+    int n = sscanf(text, "%d-%d-%dT%d:%d:%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &extra);
+    if(n != 3 && n != 5 && n != 6)
+        return 0;
+    if((n == 3 && strlen(text) != 10) || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 ||
+       tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60 || tm.tm_hour < 0 ||
+       tm.tm_min < 0 || tm.tm_sec < 0)
+        return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if(t == (time_t)-1)
+        return 0;
+    *nanos = (long long)t * 1000000000LL;
+    return 1;
+}
+
+// Matching records gathered by a statement query
+typedef struct {
+    LogRecord *records;
+    long count;
+    long capacity;
+} LogCollection;
+
+void logCollect(const LogRecord *rec, void *ctx) {
+    LogCollection *c = (LogCollection*)ctx;
+    if(c->count == c->capacity) {
+        long capacity = c->capacity ? c->capacity * 2 : 256;
+        LogRecord *grown = (LogRecord*)realloc(c->records, capacity * sizeof(LogRecord));
+        if(grown == NULL)
+            return;
+        c->records = grown;
+        c->capacity = capacity;
+    }
+    c->records[c->count++] = *rec;
+}
+
+// Orders statement lines by time; records from different threads may reach the log slightly out of order
+int logCompareTime(const void *x, const void *y) {
+    long long a = ((const LogRecord*)x)->timestamp, b = ((const LogRecord*)y)->timestamp;
+    return (a > b) - (a < b);
+}
+
+// Prints one account's transactions in [from, to] with debits, credits and totals
+int runStatement(int account, long long from, long long to) {
+    LogCollection found = { NULL, 0, 0 };
+    LogQueryStats stats;
+    Money debits = 0, credits = 0;
+    char timeStr[32], description[64], debitStr[16], creditStr[16];
+    
+    long long started = monotonicNanos();
+    logQuery(account, from, to, 1, logCollect, &found, &stats);
+    double millis = (monotonicNanos() - started) / 1e6;
+    qsort(found.records, found.count, sizeof(LogRecord), logCompareTime);
+    
+    printf("Statement for account %d\n", account);
+    printf("+---------------------+------------------------------------------+-------------+-------------+\n");
+    printf("| Time                | Description                              |       Debit |      Credit |\n");
+    printf("+---------------------+------------------------------------------+-------------+-------------+\n");
+    for(long i = 0; i < found.count; i++) {
+        LogRecord *rec = &found.records[i];
+        time_t seconds = (time_t)(rec->timestamp / 1000000000LL);
+        Money debit = 0, credit = 0;
+        
+        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+        switch(rec->type) {
+            case LOG_CREATE:
+                snprintf(description, sizeof(description), "Account opened");
+                break;
+            case LOG_DELETE:
+                snprintf(description, sizeof(description), "Account closed");
+                break;
+            case LOG_DEPOSIT:
+                snprintf(description, sizeof(description), "Deposit");
+                credit = rec->amount;
+                break;
+            case LOG_WITHDRAW:
+                snprintf(description, sizeof(description), "Withdrawal");
+                debit = rec->amount;
+                break;
+            default:
+                // The sender pays the fee on top of the amount
+                if(rec->account[0] == account) {
+                    snprintf(description, sizeof(description), "Remittance to %d (fee %.2f)",
+                             rec->account[1], MONEY_RM(rec->fee));
+                    debit = rec->amount + rec->fee;
+                } else {
+                    snprintf(description, sizeof(description), "Remittance from %d", rec->account[0]);
+                    credit = rec->amount;
+                }
+                break;
+        }
+        debits += debit;
+        credits += credit;
+        debitStr[0] = creditStr[0] = '\0';
+        if(debit)
+            snprintf(debitStr, sizeof(debitStr), "%.2f", MONEY_RM(debit));
+        if(credit)
+            snprintf(creditStr, sizeof(creditStr), "%.2f", MONEY_RM(credit));
+        printf("| %s | %-40s | %11s | %11s |\n", timeStr, description, debitStr, creditStr);
+    }
+    if(found.count == 0)
+        printf("| %-90s |\n", "No transactions in this period.");
+    printf("+---------------------+------------------------------------------+-------------+-------------+\n");
+    // Segments numbered below the first one left were removed by a snapshot
+    unsigned int first, last;
+    if(logListSegments(&first, &last) > 0 && first > 0)
+        printf("  Log segments before %08u were compacted into %s; older transactions are not listed\n",
+               first, SNAPSHOT_FILE);
+    printf("  %ld transaction%s, debits RM%.2f, credits RM%.2f\n", found.count, found.count == 1 ? "" : "s",
+           MONEY_RM(debits), MONEY_RM(credits));
+    printf("  Read %lld of the log's records from %d segment%s in %.2f ms\n", stats.recordsRead,
+           stats.segments, stats.segments == 1 ? "" : "s", millis);
+    free(found.records);
+    return 1;
+}
+
+void logPrintRecord(const LogRecord *rec, void *ctx) {
+    char line[300];
+    (void)ctx;
+    logRender(rec, line, sizeof(line));
+    printf("%s\n", line);
+}
+
+// Prints every record in [from, to] in log order, skipping segments and blocks outside the range
+int runLogReplay(long long from, long long to) {
+    LogQueryStats stats;
+    return logQuery(0, from, to, 1, logPrintRecord, NULL, &stats);
+}
+
+
+// Formats one record in the same "[timestamp] action" layout the text log has always used
+// --dump-log may hand it any file, so the text need not end in a NUL and the time may be garbage
+void logRender(const LogRecord *rec, char *out, size_t size) {
+    time_t seconds = (time_t)(rec->timestamp / 1000000000LL);
+    char timeStr[64], action[200];
+    struct tm *tm = localtime(&seconds);
+    
+    if(tm != NULL)
+        strftime(timeStr, sizeof(timeStr), "%a %b %e %H:%M:%S %Y", tm);
+    else
+        snprintf(timeStr, sizeof(timeStr), "invalid time %lld", rec->timestamp);
+    switch(rec->type) {
+        case LOG_CREATE:
+            sprintf(action, "create account - Account: %d", rec->account[0]);
+            break;
+        case LOG_DELETE:
+            sprintf(action, "delete account - Account: %d", rec->account[0]);
+            break;
+        case LOG_DEPOSIT:
+            sprintf(action, "deposit - Account: %d, Amount: RM%.2f", rec->account[0], MONEY_RM(rec->amount));
+            break;
+        case LOG_WITHDRAW:
+            sprintf(action, "withdrawal - Account: %d, Amount: RM%.2f", rec->account[0], MONEY_RM(rec->amount));
+            break;
+        case LOG_REMITTANCE:
+            sprintf(action, "remittance - From: %d to %d, Amount: RM%.2f, Fee: RM%.2f",
+                    rec->account[0], rec->account[1], MONEY_RM(rec->amount), MONEY_RM(rec->fee));
+            break;
+        case LOG_MIGRATE:
+            sprintf(action, "migrate database - Accounts: %d", rec->account[0]);
+            break;
+        case LOG_RECOVERY:
+            sprintf(action, "journal recovery - Records replayed: %d", rec->account[0]);
+            break;
+        case LOG_BATCH:
+            sprintf(action, "batch - File: %.*s, Applied: %d, Rejected: %d",
+                    (int)sizeof(rec->text), rec->text, rec->account[0], rec->account[1]);
+            break;
+        case LOG_MONTH_END:
+            sprintf(action, "month end - Accounts: %d, Interest: RM%.2f, Fees: RM%.2f",
+                    rec->account[0], MONEY_RM(rec->amount), MONEY_RM(rec->fee));
+            break;
+        case LOG_FORMAT:
+            sprintf(action, "log format - Version: %d", rec->account[0]);
+            break;
+        default:
+            sprintf(action, "%.*s", (int)sizeof(rec->text), rec->text);
+            break;
+    }
+    snprintf(out, size, "[%s] %s", timeStr, action);
+}
+
+// Reader tool: prints a binary log file as text, one "[timestamp] action" line per record
+// Without a path every segment is printed in order
+int dumpLog(const char *path) {
+    FILE *fp;
+    LogRecord rec;
+    char line[300];
+    
+    if(path == NULL) {
+        unsigned int first, last;
+        char segmentPath[64];
+        if(logListSegments(&first, &last) > 0) {
+            for(unsigned int segment = first; segment <= last; segment++) {
+                logSegmentPath(segmentPath, sizeof(segmentPath), segment, "bin");
+                logCheckFormat(segmentPath);
+            }
+        }
+        return runLogReplay(LLONG_MIN, LLONG_MAX);
+    }
+    fp = fopen(path, "rb");
+    if(fp == NULL) {
+        printf("Error: Unable to open %s!\n", path);
+        return 0;
+    }
+    logCheckFormat(path);
+    while(fread(&rec, sizeof(rec), 1, fp) == 1) {
+        logRender(&rec, line, sizeof(line));
+        printf("%s\n", line);
+    }
+    fclose(fp);
+    return 1;
+}
+
+#ifndef BANK_NO_METRICS
+// Adds one latency sample; the bucket is the bit length of the duration, so no loop or division
+void metricRecord(int stage, long long nanos) {
+    MetricHistogram *h = &metricStages[stage];
+    int bucket = (nanos > 0) ? 64 - __builtin_clzll((unsigned long long)nanos) - 8 : 0;
+    
+    if(bucket < 0) bucket = 0;
+    if(bucket >= METRIC_BUCKETS) bucket = METRIC_BUCKETS - 1;
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sumNanos, (unsigned long long)nanos, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+}
+
+// Upper bound in nanoseconds of the bucket holding quantile q of a stage
+double metricQuantile(MetricHistogram *h, double q) {
+    unsigned long long count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    unsigned long long target = (unsigned long long)(q * count + 0.5), seen = 0;
+    
+    for(int i = 0; i < METRIC_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if(seen >= target && seen > 0)
+            return (double)(1ULL << (i + 8));
+    }
+    return (double)(1ULL << (METRIC_BUCKETS + 7));
+}
+
+// Writes every metric in the Prometheus text exposition format
+// Written to a temporary file and renamed, so a scraper never sees a half-written file
+int metricsWriteFile(const char *path) {
+    char temp[256];
+    const char *types[JOURNAL_TRANSFER + 1] = { "", "deposit", "withdraw", "remittance" };
+    FILE *fp;
+    
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    fp = fileCreatePrivate(temp);
+    if(fp == NULL)
+        return 0;
+    
+    fprintf(fp, "# HELP bank_stage_seconds Latency of each stage of a transaction.\n");
+    fprintf(fp, "# TYPE bank_stage_seconds histogram\n");
+    for(int s = 0; s < METRIC_STAGES; s++) {
+        MetricHistogram *h = &metricStages[s];
+        unsigned long long cumulative = 0;
+        for(int i = 0; i < METRIC_BUCKETS - 1; i++) {
+            cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+            fprintf(fp, "bank_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                    metricStageNames[s], (double)(1ULL << (i + 8)) / 1e9, cumulative);
+        }
+        cumulative += atomic_load_explicit(&h->buckets[METRIC_BUCKETS - 1], memory_order_relaxed);
+        fprintf(fp, "bank_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", metricStageNames[s], cumulative);
+        fprintf(fp, "bank_stage_seconds_sum{stage=\"%s\"} %.9f\n", metricStageNames[s],
+                atomic_load_explicit(&h->sumNanos, memory_order_relaxed) / 1e9);
+        fprintf(fp, "bank_stage_seconds_count{stage=\"%s\"} %llu\n", metricStageNames[s], cumulative);
+    }
+    
+    fprintf(fp, "# HELP bank_transactions_total Transactions durably posted.\n");
+    fprintf(fp, "# TYPE bank_transactions_total counter\n");
+    for(int k = JOURNAL_DEPOSIT; k <= JOURNAL_TRANSFER; k++)
+        fprintf(fp, "bank_transactions_total{type=\"%s\"} %llu\n", types[k],
+                atomic_load_explicit(&metricTransactions[k], memory_order_relaxed));
+    
+    fprintf(fp, "# HELP bank_bytes_written_total Bytes written to the data file, journal and log.\n");
+    fprintf(fp, "# TYPE bank_bytes_written_total counter\n");
+    fprintf(fp, "bank_bytes_written_total %lld\n", (long long)atomic_load(&ioBytesWritten));
+    fprintf(fp, "# HELP bank_accounts Live accounts in the index.\n");
+    fprintf(fp, "# TYPE bank_accounts gauge\n");
+    fprintf(fp, "bank_accounts %d\n", indexCount);
+    
+    // Running totals, so a scrape never costs a pass over the accounts
+    const char *states[2] = { "active", "closed" }, *typeNames[2] = { "savings", "current" };
+    fprintf(fp, "# HELP bank_accounts_by_status Live accounts by status and type.\n");
+    fprintf(fp, "# TYPE bank_accounts_by_status gauge\n");
+    for(int st = 0; st < 2; st++)
+        for(int t = 0; t < 2; t++)
+            fprintf(fp, "bank_accounts_by_status{status=\"%s\",type=\"%s\"} %d\n",
+                    states[st], typeNames[t], storeTotals.accounts[st][t]);
+    fprintf(fp, "# HELP bank_balance_ringgit Sum of balances by status and type.\n");
+    fprintf(fp, "# TYPE bank_balance_ringgit gauge\n");
+    for(int st = 0; st < 2; st++)
+        for(int t = 0; t < 2; t++)
+            fprintf(fp, "bank_balance_ringgit{status=\"%s\",type=\"%s\"} %.2f\n",
+                    states[st], typeNames[t], MONEY_RM(storeTotals.balances[st][t]));
+    fprintf(fp, "# HELP bank_fees_collected_ringgit Remittance fees charged since the data file was created.\n");
+    fprintf(fp, "# TYPE bank_fees_collected_ringgit counter\n");
+    fprintf(fp, "bank_fees_collected_ringgit %.2f\n", MONEY_RM(storeTotals.feesCollected));
+    
+    if(fclose(fp) != 0)
+        return 0;
+    return rename(temp, path) == 0;
+}
+
+// Prints one line per stage that has samples; quantiles are bucket upper bounds
+void metricsPrintSummary() {
+    int printed = 0;
+    
+    for(int s = 0; s < METRIC_STAGES; s++) {
+        MetricHistogram *h = &metricStages[s];
+        unsigned long long count = atomic_load_explicit(&h->count, memory_order_relaxed);
+        if(count == 0)
+            continue;
+        if(!printed)
+            printf("  %-17s %8s %9s %9s %9s\n", "Stage", "Count", "Avg us", "p50 us", "p99 us");
+        printed = 1;
+        printf("  %-17s %8llu %9.1f %9.1f %9.1f\n", metricStageNames[s], count,
+               atomic_load_explicit(&h->sumNanos, memory_order_relaxed) / 1000.0 / count,
+               metricQuantile(h, 0.50) / 1000.0, metricQuantile(h, 0.99) / 1000.0);
+    }
+    if(!printed)
+        printf("  No transactions timed yet in this session.\n");
+}
+#endif
+
+// Pretty-print the current state of an account in tabular form
+void displayAccount(Account *acc) {
+    // Pretty-print the current state of an account in tabular form
+    char *stat = (acc->status == 0) ? "Active" : "Closed";
+    printf("\n+------------------------------------------------------------------+\n");
+    printf("| Account No | Name      | PIN  | Balance    | Type     | Status   |\n");
+    printf("|%11d |%10s |%5s |%11.2f |%8s  |%8s  |\n",
+           acc->accountNumber, acc->accountName, "****", 
+           MONEY_RM(acc->balance), acc->accountType, stat);
+    printf("+------------------------------------------------------------------+\n");
+}
+
+// Orders slots for LIST_SORT_NUMBER
+int listCompareNumber(const void *x, const void *y) {
+    int a = colNumber[*(const int*)x], b = colNumber[*(const int*)y];
+    return (a > b) - (a < b);
+}
+
+// Orders slots for LIST_SORT_BALANCE, largest first, ties by account number
+int listCompareBalance(const void *x, const void *y) {
+    Money a = colBalance[*(const int*)x], b = colBalance[*(const int*)y];
+    if(a != b)
+        return (a < b) ? 1 : -1;
+    return listCompareNumber(x, y);
+}
+
+// Collects the slots that pass the cursor's filter from the columns and sorts them
+// Nothing is rebuilt while the columns it depends on are unchanged, so reopening the listing is free
+int listCursorRefresh(ListCursor *cur) {
+    if(cur->valid && cur->layoutVersion == colLayoutVersion &&
+       (cur->sort != LIST_SORT_BALANCE || cur->balanceVersion == colBalanceVersion))
+        return 1;
+    METRIC_START(started);
+    
+    if(cur->capacity < storeSlotCount) {
+        int *grown = (int*)realloc(cur->order, (storeSlotCount ? storeSlotCount : 1) * sizeof(int));
+        if(grown == NULL)
+            return 0;
+        cur->order = grown;
+        cur->capacity = storeSlotCount;
+    }
+    
+    cur->count = 0;
+    for(int slot = 0; slot < storeSlotCount; slot++) {
+        if(colState[slot] == COLUMN_EMPTY)
+            continue;
+        if(cur->state != LIST_ANY && colState[slot] != cur->state)
+            continue;
+        if(cur->type != LIST_ANY && colType[slot] != cur->type)
+            continue;
+        cur->order[cur->count++] = slot;
+    }
+    if(cur->sort == LIST_SORT_NUMBER)
+        qsort(cur->order, cur->count, sizeof(int), listCompareNumber);
+    else if(cur->sort == LIST_SORT_BALANCE)
+        qsort(cur->order, cur->count, sizeof(int), listCompareBalance);
+    
+    cur->valid = 1;
+    cur->layoutVersion = colLayoutVersion;
+    cur->balanceVersion = colBalanceVersion;
+    METRIC_STOP(METRIC_LIST, started);
+    return 1;
+}
+
+// Number of pages in the cursor's current result, at least one
+int listCursorPages(ListCursor *cur) {
+    return cur->count ? (cur->count + LIST_PAGE_SIZE - 1) / LIST_PAGE_SIZE : 1;
+}
+
+// Copies the slots of one page into slots (LIST_PAGE_SIZE entries) and returns how many there are
+// Out-of-range pages are clamped, and the page becomes the one the next listing reopens
+int listCursorPage(ListCursor *cur, int page, int *slots) {
+    int pages = listCursorPages(cur), n;
+    
+    if(page >= pages) page = pages - 1;
+    if(page < 0) page = 0;
+    cur->page = page;
+    
+    n = cur->count - page * LIST_PAGE_SIZE;
+    if(n > LIST_PAGE_SIZE) n = LIST_PAGE_SIZE;
+    // An empty listing may have no order array at all, and memcpy() must not see NULL
+    if(n <= 0)
+        return 0;
+    memcpy(slots, cur->order + page * LIST_PAGE_SIZE, n * sizeof(int));
+    return n;
+}
+
+// Asks the operator for new listing filters and sort order; invalid answers leave a setting unchanged
+void listChooseView(ListCursor *cur) {
+    int choice;
+    
+    printf("Status (0=Any, 1=Active, 2=Closed): ");
+    if(scanf("%d", &choice) == 1 && choice >= 0 && choice <= 2)
+        cur->state = (choice == 0) ? LIST_ANY : (choice == 1 ? COLUMN_ACTIVE : COLUMN_CLOSED);
+    while(getchar() != '\n');
+    
+    printf("Type (0=Any, 1=Savings, 2=Current): ");
+    if(scanf("%d", &choice) == 1 && choice >= 0 && choice <= 2)
+        cur->type = (choice == 0) ? LIST_ANY : (choice == 1 ? ACCOUNT_SAVINGS : ACCOUNT_CURRENT);
+    while(getchar() != '\n');
+    
+    printf("Sort by (1=Creation order, 2=Account number, 3=Balance): ");
+    if(scanf("%d", &choice) == 1 && choice >= 1 && choice <= 3)
+        cur->sort = choice - 1;
+    while(getchar() != '\n');
+    
+    // A different view starts from its first page
+    cur->valid = 0;
+    cur->page = 0;
+}
+
+// Prints numbered account rows in the selection table layout
+// Every field comes from the columns, so a page never touches the data file
+void listPrintRows(const int *slots, int count, const char *emptyMessage) {
+    printf("\n+==================================================================+\n");
+    printf("| No | Account No | Name       | Balance    | Type     | Status   |\n");
+    printf("+----+------------+------------+------------+----------+----------+\n");
+    
+    for(int i = 0; i < count; i++) {
+        int slot = slots[i];
+        char *stat = (colState[slot] == COLUMN_ACTIVE) ? "Active" : "Closed";
+        char *type = (colType[slot] == ACCOUNT_CURRENT) ? "Current" : "Savings";
+        printf("| %2d |%11d |%-11s |%11.2f |%-9s |%-9s |\n",
+               i + 1, colNumber[slot], colText[slot].accountName, 
+               MONEY_RM(colBalance[slot]), type, stat);
+    }
+    if(count == 0)
+        printf("|  %-64s|\n", emptyMessage);
+    printf("+==================================================================+\n");
+}
+
+// Lists accounts one page at a time and lets the operator choose one interactively
+// The page, filter and sort order carry over to the next operation that needs an account
+int listAllAccountsAndSelect(int *selectedAccountNum) {
+    ListCursor *cur = &listCursor;
+    int slots[LIST_PAGE_SIZE];
+    char input[20];
+    int count, selection;
+    
+    if(indexCount == 0) {
+        // An empty index means no accounts were ever created
+        printf("No accounts found!\n");
+        return 0;
+    }
+    
+    while(1) {
+        if(!listCursorRefresh(cur)) {
+            printf("Error: Not enough memory to list accounts!\n");
+            return 0;
+        }
+        count = listCursorPage(cur, cur->page, slots);
+        
+        listPrintRows(slots, count, "No accounts match the current filter.");
+        printf("  Page %d of %d (%d accounts)\n", cur->page + 1, listCursorPages(cur), cur->count);
+        
         // Keep asking until the operator chooses a valid account or cancels
-        printf("\nEnter account number (1-%d) or 0 to enter account number directly: ", count);
+        printf("\nEnter account (1-%d), 0 to enter account number directly,\n", count);
+        printf("n/p for next/previous page, f to filter and sort, or s to search: ");
+        if(scanf("%19s", input) != 1) {
+            printf("Invalid input! Please enter a number.\n");
+            while(getchar() != '\n');
+            continue;
+        }
+        getchar();
+        
+        if(strcmp(input, "n") == 0 || strcmp(input, "N") == 0) {
+            cur->page++;
+            continue;
+        }
+        if(strcmp(input, "p") == 0 || strcmp(input, "P") == 0) {
+            cur->page--;
+            continue;
+        }
+        if(strcmp(input, "f") == 0 || strcmp(input, "F") == 0) {
+            listChooseView(cur);
+            continue;
+        }
+        if(strcmp(input, "s") == 0 || strcmp(input, "S") == 0) {
+            if(searchAccounts(selectedAccountNum))
+                return 1;
+            continue;
+        }
+        
+        selection = atoi(input);
+        if(!isdigit((unsigned char)input[0])) {
+            printf("Invalid input! Please enter a number.\n");
+        }
+        else if(selection == 0) {
+            // Allow operators to type the exact account number if they know it
+            printf("Enter account number: ");
+            if(scanf("%d", selectedAccountNum) != 1) {
+                printf("Invalid account number!\n");
+                while(getchar() != '\n');
+                continue;
+            }
+            getchar();
+            return 1;
+        }
+        else if(selection >= 1 && selection <= count) {
+            *selectedAccountNum = colNumber[slots[selection - 1]];
+            return 1;
+        }
+        else {
+            printf("Invalid selection! Please try again.\n");
+        }
+    }
+}
+
+// Persists an account into its slot of the data file (one positioned write)
+int saveAccount(Account* acc) {
+    StoreSlot slot;
+    int index = indexLookup(acc->accountNumber);
+    int isNew = (index < 0);
+    
+    if(isNew) {
+        // First save of a new account claims a free slot and registers it in the index
+        index = storeAllocSlot();
+        if(index < 0)
+            return 0;
+        if(!indexInsert(acc->accountNumber, index)) {
+            storeFreeSlot(index);
+            return 0;
+        }
+    }
+    
+    memset(&slot, 0, sizeof(slot));
+    slot.state = STORE_SLOT_USED;
+    slot.acc = *acc;
+    if(!storeWriteSlot(index, &slot)) {
+        // A new account that never reached the file must not keep its index entry or slot
+        if(isNew) {
+            indexRemove(acc->accountNumber);
+            storeFreeSlot(index);
+        }
+        return 0;
+    }
+    // Names and IDs never change after creation, so only a new account touches the search index
+    if(isNew)
+        searchAddAccount(index, acc);
+    return 1;
+}
+
+// Loads an account from the data file into the operation arena
+// The result must not be freed; it lives until the current menu operation ends
+Account* getAccount(int num) {
+    static Account missing;   // Returned when the arena cannot grow
+    Account *acc = arenaAlloc(&opArena);
+    StoreSlot slot;
+    int index = indexLookup(num);
+    
+    if(acc == NULL) {
+        missing.accountNumber = 0;
+        return &missing;
+    }
+    METRIC_START(started);
+    if(index >= 0 && storeReadSlot(index, &slot)) {
+        *acc = slot.acc;
+    } else {
+        // Signal missing account by zeroing the account number
+        acc->accountNumber = 0;
+    }
+    METRIC_STOP(METRIC_LOAD, started);
+    return acc;
+}
+
+// Carves one Account out of the arena, adding a slab only when every existing one is full
+Account* arenaAlloc(AccountArena *arena) {
+    if(arena->current == NULL) {
+        if(arena->first == NULL) {
+            arena->first = (AccountSlab*)malloc(sizeof(AccountSlab));
+            if(arena->first == NULL)
+                return NULL;
+            arena->first->next = NULL;
+            arena->first->used = 0;
+        }
+        arena->current = arena->first;
+    }
+    
+    while(arena->current->used == ARENA_SLAB_ACCOUNTS) {
+        if(arena->current->next == NULL) {
+            AccountSlab *slab = (AccountSlab*)malloc(sizeof(AccountSlab));
+            if(slab == NULL)
+                return NULL;
+            slab->next = NULL;
+            slab->used = 0;
+            arena->current->next = slab;
+        }
+        arena->current = arena->current->next;
+    }
+    return &arena->current->items[arena->current->used++];
+}
+
+// Releases every Account handed out since the last reset; the slabs stay for reuse
+void arenaReset(AccountArena *arena) {
+    for(AccountSlab *slab = arena->first; slab != NULL; slab = slab->next)
+        slab->used = 0;
+    arena->current = arena->first;
+}
+
+// Gives all of an arena's slabs back to the heap
+void arenaFree(AccountArena *arena) {
+    AccountSlab *slab = arena->first;
+    while(slab != NULL) {
+        AccountSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+Account * volatile benchEscape;   // Keeps the compiler from optimizing the benchmark allocations away
+
+// Microbenchmark: the old malloc/free-per-lookup pattern against the operation arena
+// Each operation loads two accounts, as a remittance does, and ends the way a menu operation ends
+int runAllocBenchmark(long ops) {
+    AccountArena arena = { NULL, NULL };
+    Account source;
+    long long started;
+    double mallocNs, arenaNs;
+    
+    memset(&source, 0, sizeof(source));
+    source.accountNumber = 1234567;
+    strcpy(source.accountName, "Benchmark");
+    
+    started = nowMicros();
+    for(long i = 0; i < ops; i++) {
+        Account *a = (Account*)malloc(sizeof(Account));
+        Account *b = (Account*)malloc(sizeof(Account));
+        if(a == NULL || b == NULL) {
+            printf("Error: Not enough memory for benchmark!\n");
+            return 0;
+        }
+        *a = source;
+        *b = source;
+        a->balance += i;
+        benchEscape = a;
+        benchEscape = b;
+        free(a);
+        free(b);
+    }
+    mallocNs = (nowMicros() - started) * 1000.0 / ops;
+    
+    started = nowMicros();
+    for(long i = 0; i < ops; i++) {
+        Account *a = arenaAlloc(&arena);
+        Account *b = arenaAlloc(&arena);
+        if(a == NULL || b == NULL) {
+            printf("Error: Not enough memory for benchmark!\n");
+            arenaFree(&arena);
+            return 0;
+        }
+        *a = source;
+        *b = source;
+        a->balance += i;
+        benchEscape = a;
+        benchEscape = b;
+        arenaReset(&arena);
+    }
+    arenaNs = (nowMicros() - started) * 1000.0 / ops;
+    arenaFree(&arena);
+    
+    printf("Account allocation: %ld operations of two lookups each\n", ops);
+    printf("  malloc/free per lookup: %8.1f ns/op\n", mallocNs);
+    printf("  operation arena       : %8.1f ns/op\n", arenaNs);
+    printf("  Speedup               : %8.2fx\n", arenaNs > 0 ? mallocNs / arenaNs : 0.0);
+    return 1;
+}
+
+// FNV-1a hash used as a cheap integrity checksum for slot payloads
+unsigned int storeChecksum(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned int hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Maps the first bytes of a file read-write, extending the file first if it is shorter
+// Any earlier mapping in *map is dropped, so pointers into it must not be kept across a call
+int fileMap(int fd, char **map, size_t *mapped, size_t bytes) {
+    #ifdef _WIN32
+        if(*map != NULL)
+            UnmapViewOfFile(*map);
+        *map = NULL;
+        if(_chsize_s(fd, (long long)bytes) != 0)
+            return 0;
+        HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_READWRITE,
+                                           (DWORD)((unsigned long long)bytes >> 32), (DWORD)bytes, NULL);
+        if(mapping == NULL)
+            return 0;
+        *map = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+        CloseHandle(mapping);
+        if(*map == NULL)
+            return 0;
+    #else
+        struct stat st;
+        if(fstat(fd, &st) != 0)
+            return 0;
+        if((size_t)st.st_size < bytes && ftruncate(fd, (off_t)bytes) != 0)
+            return 0;
+        if(*map != NULL)
+            munmap(*map, *mapped);
+        *map = (char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(*map == MAP_FAILED) {
+            *map = NULL;
+            return 0;
+        }
+    #endif
+    *mapped = bytes;
+    return 1;
+}
+
+// Flushes the dirty pages of a mapping to stable storage
+int fileSync(int fd, char *map, size_t bytes) {
+    if(map == NULL)
+        return 0;
+    #ifdef _WIN32
+        return FlushViewOfFile(map, bytes) && syncFd(fd);
+    #else
+        (void)fd;
+        return msync(map, bytes, MS_SYNC) == 0;
+    #endif
+}
+
+// Drops a mapping made by fileMap()
+void fileUnmap(char *map, size_t bytes) {
+    if(map == NULL)
+        return;
+    #ifdef _WIN32
+        (void)bytes;
+        UnmapViewOfFile(map);
+    #else
+        munmap(map, bytes);
+    #endif
+}
+
+// Maps the first bytes of the data file; storeSlots follows the mapping
+// A snapshot writer copies slots out of the mapping, so it must not move in the middle of a copy
+int storeMapFile(size_t bytes) {
+    pthread_mutex_lock(&snapshotLock);
+    int ok = fileMap(storeFd, &storeMap, &storeMapBytes, bytes);
+    if(ok)
+        storeSlots = (StoreSlot*)(storeMap + STORE_SLOT_SIZE);
+    pthread_mutex_unlock(&snapshotLock);
+    return ok;
+}
+
+// Makes sure the file and mapping hold at least slots slots, doubling so appends stay cheap
+int storeReserve(int slots) {
+    size_t needed = (size_t)(slots + 1) * STORE_SLOT_SIZE;
+    size_t bytes = storeMapBytes ? storeMapBytes : (size_t)(STORE_MAP_MIN_SLOTS + 1) * STORE_SLOT_SIZE;
+    
+    if(needed <= storeMapBytes)
+        return 1;
+    while(bytes < needed)
+        bytes *= 2;
+    return storeMapFile(bytes);
+}
+
+// Pointer to a slot inside the mapping; reads and in-place updates need no copy and no system call
+StoreSlot* storeSlotAt(int slot) {
+    return &storeSlots[slot];
+}
+
+// Flushes dirty pages of the data file mapping to stable storage
+int storeSync() {
+    return fileSync(storeFd, storeMap, storeMapBytes);
+}
+
+// Flushes only the page of the mapping that holds one slot
+int storeSyncSlot(int slot) {
+    size_t offset = (size_t)(slot + 1) * STORE_SLOT_SIZE;
+    #ifdef _WIN32
+        return fileSync(storeFd, storeMap + offset, STORE_SLOT_SIZE);
+    #else
+        long page = sysconf(_SC_PAGESIZE);
+        size_t start = offset / page * page;
+        return fileSync(storeFd, storeMap + start, offset + STORE_SLOT_SIZE - start);
+    #endif
+}
+
+// Unmaps and closes the data file
+void storeClose() {
+    fileUnmap(storeMap, storeMapBytes);
+    if(storeFd >= 0)
+        close(storeFd);
+    storeMap = NULL;
+    storeSlots = NULL;
+    storeMapBytes = 0;
+    storeFd = -1;
+}
+
+// Copies bytes out of the mapped file; used for records that are not StoreSlots
+long storePread(void *buf, size_t len, long offset) {
+    if(offset < 0 || (size_t)offset + len > storeMapBytes)
+        return -1;
+    memcpy(buf, storeMap + offset, len);
+    return (long)len;
+}
+
+// Copies bytes into the mapped file; the kernel writes them back, storeSync() forces it
+long storePwrite(const void *buf, size_t len, long offset) {
+    if(offset < 0 || (size_t)offset + len > storeMapBytes)
+        return -1;
+    memcpy(storeMap + offset, buf, len);
+    atomic_fetch_add_explicit(&ioBytesWritten, (long long)len, memory_order_relaxed);
+    return (long)len;
+}
+
+// Rewrites the header block so slotCount survives restarts
+int storeWriteHeader() {
+    char block[STORE_SLOT_SIZE];
+    StoreHeader header;
+    
+    memset(block, 0, sizeof(block));
+    header.magic = STORE_MAGIC;
+    header.version = STORE_VERSION;
+    header.slotSize = STORE_SLOT_SIZE;
+    header.slotCount = storeSlotCount;
+    header.numberSeed = accountNumberSeed;
+    header.numberNext = accountNumberNext;
+    // Fees still only in the journal are left out; recovery adds them when it replays their records
+    header.checkpointSeq = storeCheckpointSeq;
+    header.totals = storeTotals;
+    header.totals.feesCollected -= journalFees;
+    memcpy(block, &header, sizeof(header));
+    return storePwrite(block, sizeof(block), 0) == STORE_SLOT_SIZE;
+}
+
+// Opens and maps the data file, creating it with an empty header if it does not exist yet
+// Opening reads nothing but the header, so it costs the same for ten accounts or ten million
+int storeOpen() {
+    StoreHeader header;
+    struct stat st;
+    const char *syncMode = getenv("BANK_MSYNC");
+    
+    storeSyncEachWrite = (syncMode != NULL && strcmp(syncMode, "write") == 0);
+    #ifdef _WIN32
+        storeFd = _open(STORE_FILE, _O_RDWR | _O_CREAT | _O_BINARY, 0600);
+    #else
+        storeFd = open(STORE_FILE, O_RDWR | O_CREAT, 0600);
+    #endif
+    if(storeFd < 0)
+        return 0;
+    
+    if(fstat(storeFd, &st) != 0 || st.st_size < STORE_SLOT_SIZE) {
+        // Brand new file: map the initial size and write an empty header
+        storeSlotCount = 0;
+        accountNumberSeed = accountNumberNewSeed();
+        accountNumberNext = 0;
+        storeCheckpointSeq = 0;
+        storeTotals.feesCollected = 0;
+        if(!storeReserve(0) || !storeWriteHeader()) {
+            storeClose();
+            return 0;
+        }
+        return 1;
+    }
+    
+    // Map whole slots only; a file cut short by a crash is extended with empty slots
+    if(!storeMapFile(((size_t)st.st_size + STORE_SLOT_SIZE - 1) / STORE_SLOT_SIZE * STORE_SLOT_SIZE)) {
+        storeClose();
+        return 0;
+    }
+    memcpy(&header, storeMap, sizeof(header));
+    
+    // Refuse files written with a different layout rather than misreading them
+    if(header.magic != STORE_MAGIC || header.slotSize != STORE_SLOT_SIZE ||
+       header.version < 1 || header.version > STORE_VERSION || !storeReserve(header.slotCount)) {
+        storeClose();
+        return 0;
+    }
+    storeSlotCount = header.slotCount;
+    accountNumberSeed = header.numberSeed;
+    accountNumberNext = header.numberNext;
+    storeCheckpointSeq = header.checkpointSeq;
+    storeTotals.feesCollected = header.totals.feesCollected;
+    
+    // Files from before the number allocator get their permutation key now
+    if(accountNumberSeed == 0) {
+        accountNumberSeed = accountNumberNewSeed();
+        accountNumberNext = 0;
+        if(!storeWriteHeader()) {
+            storeClose();
+            return 0;
+        }
+    }
+    
+    // Version 1 files kept float balances and version 2 files plain PINs; convert them once
+    if(header.version < STORE_VERSION && !storeUpgrade(header.version)) {
+        storeClose();
+        return 0;
+    }
+    return 1;
+}
+
+// Copies one slot out of the mapping; returns 1 only for a live record whose checksum matches
+int storeReadSlot(int slot, StoreSlot *out) {
+    if(slot < 0 || slot >= storeSlotCount)
+        return 0;
+    memcpy(out, storeSlotAt(slot), sizeof(StoreSlot));
+    if(out->state != STORE_SLOT_USED)
+        return 0;
+    return out->checksum == storeChecksum(&out->acc, sizeof(Account));
+}
+
+// Finishes an in-place change to a slot: stamps the checksum, refreshes the columns and,
+// with BANK_MSYNC=write, forces the page holding the slot to disk
+int storeSlotChanged(int slot) {
+    StoreSlot *row = storeSlotAt(slot);
+    
+    row->checksum = (row->state == STORE_SLOT_USED) ? storeChecksum(&row->acc, sizeof(Account)) : 0;
+    atomic_fetch_add_explicit(&ioBytesWritten, STORE_SLOT_SIZE, memory_order_relaxed);
+    #ifndef _WIN32
+        if(storeSyncEachWrite && !storeSyncSlot(slot))
+            return 0;
+    #endif
+    return columnsSet(slot, row);
+}
+
+// Writes one slot in place, stamping the checksum before it hits the disk
+int storeWriteSlot(int slot, StoreSlot *in) {
+    if(slot < 0 || slot >= storeSlotCount)
+        return 0;
+    METRIC_START(started);
+    memset(in->reserved, 0, sizeof(in->reserved));
+    snapshotPreserve(slot);
+    memcpy(storeSlotAt(slot), in, sizeof(StoreSlot));
+    int ok = storeSlotChanged(slot);
+    in->checksum = storeSlotAt(slot)->checksum;
+    METRIC_STOP(METRIC_SLOT_WRITE, started);
+    return ok;
+}
+
+// Returns a released slot from the free stack, or grows the file by one slot when none is free
+int storeAllocSlot() {
+    StoreSlot empty;
+    
+    if(freeSlotCount > 0)
+        return freeSlots[--freeSlotCount];
+    
+    // Append a zeroed slot and persist the new count in the header
+    if(!storeReserve(storeSlotCount + 1))
+        return -1;
+    storeSlotCount++;
+    memset(&empty, 0, sizeof(empty));
+    if(!storeWriteSlot(storeSlotCount - 1, &empty) || !storeWriteHeader()) {
+        storeSlotCount--;
+        return -1;
+    }
+    return storeSlotCount - 1;
+}
+
+// Pushes a slot onto the free stack so storeAllocSlot() can hand it out again
+int freeSlotPush(int slot) {
+    if(freeSlotCount == freeSlotCapacity) {
+        int newCapacity = freeSlotCapacity ? freeSlotCapacity * 2 : 64;
+        int *grown = (int*)realloc(freeSlots, newCapacity * sizeof(int));
+        if(grown == NULL)
+            return 0;
+        freeSlots = grown;
+        freeSlotCapacity = newCapacity;
+    }
+    freeSlots[freeSlotCount++] = slot;
+    return 1;
+}
+
+// Marks a slot free on disk and remembers it for reuse by the next account creation
+int storeFreeSlot(int slot) {
+    StoreSlot empty;
+    memset(&empty, 0, sizeof(empty));
+    empty.state = STORE_SLOT_FREE;
+    if(!storeWriteSlot(slot, &empty))
+        return 0;
+    freeSlotPush(slot);
+    return 1;
+}
+
+// Fibonacci hashing spreads the clustered 7-9 digit numbers across all buckets
+unsigned int indexHash(int num) {
+    return (unsigned int)(((unsigned long long)(unsigned int)num * 11400714819323198485ull) >> 32);
+}
+
+// Re-creates the bucket array with a new capacity and re-inserts every live entry
+int indexResize(unsigned int newCapacity) {
+    IndexEntry *old = indexTable;
+    unsigned int oldCapacity = indexCapacity;
+    IndexEntry *table = (IndexEntry*)calloc(newCapacity, sizeof(IndexEntry));
+    
+    if(table == NULL)
+        return 0;
+    
+    indexTable = table;
+    indexCapacity = newCapacity;
+    for(unsigned int i = 0; i < oldCapacity; i++) {
+        if(old[i].accountNumber == 0)
+            continue;
+        unsigned int b = indexHash(old[i].accountNumber) & (newCapacity - 1);
+        while(table[b].accountNumber != 0)
+            b = (b + 1) & (newCapacity - 1);
+        table[b] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+// Looks up the slot of an account number with linear probing; -1 when absent
+int indexLookup(int num) {
+    if(indexCapacity == 0 || num == 0)
+        return -1;
+    
+    unsigned int mask = indexCapacity - 1;
+    unsigned int b = indexHash(num) & mask;
+    while(indexTable[b].accountNumber != 0) {
+        if(indexTable[b].accountNumber == num)
+            return indexTable[b].slot;
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
+
+// Inserts or updates a mapping, doubling the table before it gets too full
+int indexInsert(int num, int slot) {
+    if(indexCapacity == 0 || (indexCount + 1) * 100 > (int)indexCapacity * INDEX_MAX_LOAD) {
+        if(!indexResize(indexCapacity ? indexCapacity * 2 : INDEX_MIN_CAPACITY))
+            return 0;
+    }
+    
+    unsigned int mask = indexCapacity - 1;
+    unsigned int b = indexHash(num) & mask;
+    while(indexTable[b].accountNumber != 0) {
+        if(indexTable[b].accountNumber == num) {
+            indexTable[b].slot = slot;
+            return 1;
+        }
+        b = (b + 1) & mask;
+    }
+    indexTable[b].accountNumber = num;
+    indexTable[b].slot = slot;
+    indexCount++;
+    return 1;
+}
+
+// Removes a mapping using backward-shift deletion so no tombstones accumulate
+void indexRemove(int num) {
+    if(indexCapacity == 0)
+        return;
+    
+    unsigned int mask = indexCapacity - 1;
+    unsigned int b = indexHash(num) & mask;
+    while(indexTable[b].accountNumber != num) {
+        if(indexTable[b].accountNumber == 0)
+            return;
+        b = (b + 1) & mask;
+    }
+    
+    // Pull later entries of the same probe run back into the hole
+    unsigned int hole = b;
+    unsigned int next = (hole + 1) & mask;
+    while(indexTable[next].accountNumber != 0) {
+        unsigned int home = indexHash(indexTable[next].accountNumber) & mask;
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            indexTable[hole] = indexTable[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    indexTable[hole].accountNumber = 0;
+    indexTable[hole].slot = 0;
+    indexCount--;
+}
+
+// Lock-free insert used only by the parallel startup scan, while nothing else reads the table
+// The table must already be large enough; returns 0 when another slot has claimed the number
+int indexInsertConcurrent(int num, int slot) {
+    unsigned int mask = indexCapacity - 1;
+    unsigned int b = indexHash(num) & mask;
+    
+    for(;;) {
+        int expected = 0;
+        if(atomic_compare_exchange_strong((_Atomic int*)&indexTable[b].accountNumber, &expected, num)) {
+            indexTable[b].slot = slot;
+            return 1;
+        }
+        if(expected == num)
+            return 0;
+        b = (b + 1) & mask;
+    }
+}
+
+// Classifies one slot as CHECK_OK or the first CHECK_* problem found in it
+// Bad state and checksum mean the bytes cannot be trusted; the other problems are in a sound record
+int storeSlotCheck(const StoreSlot *slot) {
+    const Account *acc = &slot->acc;
+    
+    if(slot->state == STORE_SLOT_FREE)
+        return CHECK_OK;
+    if(slot->state != STORE_SLOT_USED)
+        return CHECK_BAD_STATE;
+    if(slot->checksum != storeChecksum(acc, sizeof(Account)))
+        return CHECK_BAD_CHECKSUM;
+    if(acc->accountNumber < ACCOUNT_NUMBER_MIN || acc->accountNumber - ACCOUNT_NUMBER_MIN >= ACCOUNT_NUMBER_SPAN)
+        return CHECK_BAD_NUMBER;
+    if(acc->accountName[0] == '\0' || memchr(acc->accountName, '\0', sizeof(acc->accountName)) == NULL ||
+       acc->idNumber[0] == '\0' || memchr(acc->idNumber, '\0', sizeof(acc->idNumber)) == NULL)
+        return CHECK_BAD_TEXT;
+    if(acc->pinSalt == 0)
+        return CHECK_BAD_PIN;
+    if(acc->status != 0 && acc->status != 1)
+        return CHECK_BAD_STATUS;
+    if(strcmp(acc->accountType, "Savings") != 0 && strcmp(acc->accountType, "Current") != 0)
+        return CHECK_BAD_TYPE;
+    if(acc->balance < 0)
+        return CHECK_NEGATIVE;
+    return CHECK_OK;
+}
+
+// Appends a value to a growable int array
+int loadListPush(int **list, int *count, int *capacity, int value) {
+    if(*count == *capacity) {
+        int newCapacity = *capacity ? *capacity * 2 : 64;
+        int *grown = (int*)realloc(*list, newCapacity * sizeof(int));
+        if(grown == NULL)
+            return 0;
+        *list = grown;
+        *capacity = newCapacity;
+    }
+    (*list)[(*count)++] = value;
+    return 1;
+}
+
+// Number of CPUs online, at least 1
+long cpuCount() {
+    long cpus = 1;
+    
+    #if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        cpus = (long)info.dwNumberOfProcessors;
+    #elif defined(_SC_NPROCESSORS_ONLN)
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    return cpus < 1 ? 1 : cpus;
+}
+
+// Workers worth starting for a job of this many items: one per LOAD_MIN_ITEMS, at most one per CPU
+int loadThreadCount(long items) {
+    const char *forced = getenv("BANK_LOAD_THREADS");
+    long threads = cpuCount();
+    
+    if(forced != NULL)
+        threads = atol(forced);
+    else if(threads > items / LOAD_MIN_ITEMS)
+        threads = items / LOAD_MIN_ITEMS;
+    if(threads > LOAD_MAX_THREADS)
+        threads = LOAD_MAX_THREADS;
+    return threads < 1 ? 1 : (int)threads;
+}
+
+// Splits items into one contiguous range per worker and runs work on each, the first range on the
+// calling thread; a worker that cannot be started has its range done here too
+void loadRun(LoadWorker *workers, int threads, long items, void* (*work)(void*)) {
+    pthread_t ids[LOAD_MAX_THREADS];
+    int started[LOAD_MAX_THREADS];
+    
+    for(int t = 0; t < threads; t++) {
+        workers[t].from = (int)(items * t / threads);
+        workers[t].to = (int)(items * (t + 1) / threads);
+    }
+    for(int t = 1; t < threads; t++)
+        started[t] = pthread_create(&ids[t], NULL, work, &workers[t]) == 0;
+    work(&workers[0]);
+    for(int t = 1; t < threads; t++) {
+        if(started[t])
+            pthread_join(ids[t], NULL);
+        else
+            work(&workers[t]);
+    }
+}
+
+// Startup scan of one range of slots: checks every record, fills its columns and running totals,
+// and indexes it. Ranges are disjoint, so only the hash index is shared between workers.
+void* loadSlotWorker(void *arg) {
+    LoadWorker *w = (LoadWorker*)arg;
+    
+    for(int i = w->from; i < w->to; i++) {
+        StoreSlot *slot = storeSlotAt(i);
+        int problem = storeSlotCheck(slot);
+        w->problems[problem]++;
+        
+        // Damaged slots are neither indexed nor reused, and stay empty in the columns
+        if(slot->state != STORE_SLOT_USED || problem == CHECK_BAD_STATE || problem == CHECK_BAD_CHECKSUM) {
+            columnsFill(i, NULL);
+            if(slot->state == STORE_SLOT_FREE)
+                loadListPush(&w->freeList, &w->freeCount, &w->freeCapacity, i);
+            continue;
+        }
+        columnsFill(i, &slot->acc);
+        if(!indexInsertConcurrent(slot->acc.accountNumber, i)) {
+            loadListPush(&w->duplicates, &w->duplicateCount, &w->duplicateCapacity, i);
+            continue;
+        }
+        w->indexed++;
+        w->totals.accounts[colState[i] == COLUMN_CLOSED][colType[i]]++;
+        w->totals.balances[colState[i] == COLUMN_CLOSED][colType[i]] += colBalance[i];
+    }
+    return NULL;
+}
+
+// Builds the hash index, the columns and the running totals in one parallel pass over the mapping
+// Each worker scans a contiguous range of slots; the free-slot stack is then filled in slot order,
+// and an account number found in two slots keeps the lower one
+int indexBuild() {
+    unsigned int capacity = INDEX_MIN_CAPACITY;
+    LoadWorker workers[LOAD_MAX_THREADS];
+    int threads = loadThreadCount(storeSlotCount), ok = 1;
+    
+    // Size the table up front so a large database is indexed without rehashing
+    while((unsigned long long)storeSlotCount * 100 > (unsigned long long)capacity * INDEX_MAX_LOAD)
+        capacity *= 2;
+    free(indexTable);
+    indexTable = NULL;
+    indexCapacity = 0;
+    indexCount = 0;
+    freeSlotCount = 0;
+    if(!indexResize(capacity) || !columnsReserve(storeSlotCount))
+        return 0;
+    
+    long long started = nowMicros();
+    memset(workers, 0, sizeof(workers));
+    loadRun(workers, threads, storeSlotCount, loadSlotWorker);
+    
+    memset(storeTotals.accounts, 0, sizeof(storeTotals.accounts));
+    memset(storeTotals.balances, 0, sizeof(storeTotals.balances));
+    memset(loadReport.problems, 0, sizeof(loadReport.problems));
+    loadReport.duplicates = 0;
+    for(int t = 0; t < threads; t++) {
+        LoadWorker *w = &workers[t];
+        indexCount += w->indexed;
+        for(int st = 0; st < 2; st++) {
+            for(int type = 0; type < 2; type++) {
+                storeTotals.accounts[st][type] += w->totals.accounts[st][type];
+                storeTotals.balances[st][type] += w->totals.balances[st][type];
+            }
+        }
+        for(int k = 0; k < CHECK_KINDS; k++)
+            loadReport.problems[k] += w->problems[k];
+        for(int i = 0; i < w->freeCount && ok; i++)
+            ok = freeSlotPush(w->freeList[i]);
+    }
+    
+    // Duplicates are resolved once every worker is done, so the outcome never depends on timing
+    for(int t = 0; t < threads; t++) {
+        LoadWorker *w = &workers[t];
+        for(int i = 0; i < w->duplicateCount && ok; i++) {
+            int slot = w->duplicates[i];
+            int holder = indexLookup(colNumber[slot]);
+            if(slot < holder) {
+                ok = indexInsert(colNumber[slot], slot);
+                columnsCount(slot, 1);
+                columnsCount(holder, -1);
+                columnsFill(holder, NULL);
+            } else {
+                columnsFill(slot, NULL);
+            }
+            loadReport.duplicates++;
+        }
+        free(w->freeList);
+        free(w->duplicates);
+    }
+    colLayoutVersion++;
+    colBalanceVersion++;
+    loadReport.threads = threads;
+    loadReport.scanMicros = nowMicros() - started;
+    return ok;
+}
+
+// Grows every column to hold at least rows entries; new rows start out empty
+int columnsReserve(int rows) {
+    int newCapacity = colCapacity ? colCapacity : 1024;
+    
+    if(rows <= colCapacity)
+        return 1;
+    while(newCapacity < rows)
+        newCapacity *= 2;
+    
+    int *numbers = (int*)realloc(colNumber, newCapacity * sizeof(int));
+    if(numbers == NULL) return 0;
+    colNumber = numbers;
+    Money *balances = (Money*)realloc(colBalance, newCapacity * sizeof(Money));
+    if(balances == NULL) return 0;
+    colBalance = balances;
+    unsigned char *states = (unsigned char*)realloc(colState, newCapacity);
+    if(states == NULL) return 0;
+    colState = states;
+    unsigned char *types = (unsigned char*)realloc(colType, newCapacity);
+    if(types == NULL) return 0;
+    colType = types;
+    AccountText *text = (AccountText*)realloc(colText, newCapacity * sizeof(AccountText));
+    if(text == NULL) return 0;
+    colText = text;
+    
+    memset(colState + colCapacity, COLUMN_EMPTY, newCapacity - colCapacity);
+    colCapacity = newCapacity;
+    return 1;
+}
+
+// Adds (sign 1) or takes back (sign -1) one column row's share of the running totals
+void columnsCount(int slot, int sign) {
+    if(colState[slot] == COLUMN_EMPTY)
+        return;
+    int closed = (colState[slot] == COLUMN_CLOSED);
+    storeTotals.accounts[closed][colType[slot]] += sign;
+    storeTotals.balances[closed][colType[slot]] += sign * colBalance[slot];
+}
+
+// Copies one slot into the columns; a NULL or non-live row empties that position
+// Called for every slot written to the data file so the columns never go stale
+int columnsSet(int slot, const StoreSlot *row) {
+    if(!columnsReserve(slot + 1))
+        return 0;
+    columnsCount(slot, -1);
+    if(row == NULL || row->state != STORE_SLOT_USED) {
+        if(colState[slot] != COLUMN_EMPTY)
+            colLayoutVersion++;
+        columnsFill(slot, NULL);
+        return 1;
+    }
+    
+    unsigned char state = (row->acc.status == 0) ? COLUMN_ACTIVE : COLUMN_CLOSED;
+    unsigned char type = accountTypeCode(&row->acc);
+    // Listing cursors only rebuild when something they filter or sort on has changed
+    if(colState[slot] != state || colType[slot] != type || colNumber[slot] != row->acc.accountNumber)
+        colLayoutVersion++;
+    if(colBalance[slot] != row->acc.balance)
+        colBalanceVersion++;
+    
+    columnsFill(slot, &row->acc);
+    columnsCount(slot, 1);
+    return 1;
+}
+
+// Writes one account (or an empty row for NULL) into the columns without touching the totals
+// or the versions; the startup scan calls it from several threads on disjoint rows
+void columnsFill(int slot, const Account *acc) {
+    if(acc == NULL) {
+        colState[slot] = COLUMN_EMPTY;
+        colNumber[slot] = 0;
+        colBalance[slot] = 0;
+        return;
+    }
+    colNumber[slot] = acc->accountNumber;
+    colBalance[slot] = acc->balance;
+    colState[slot] = (acc->status == 0) ? COLUMN_ACTIVE : COLUMN_CLOSED;
+    colType[slot] = accountTypeCode(acc);
+    memcpy(colText[slot].accountName, acc->accountName, sizeof(colText[slot].accountName));
+    memcpy(colText[slot].idNumber, acc->idNumber, sizeof(colText[slot].idNumber));
+}
+
+// Counts accounts and totals balances in one sequential pass over the state, type and balance columns
+// The loop body has no branches on the data, so the compiler can keep it in registers and vectorize it
+void columnsSummarize(ColumnSummary *out) {
+    int active[2] = { 0, 0 }, closed = 0;
+    Money deposits[2] = { 0, 0 };
+    
+    for(int i = 0; i < storeSlotCount; i++) {
+        int isActive = (colState[i] == COLUMN_ACTIVE);
+        int isCurrent = (colType[i] == ACCOUNT_CURRENT);
+        Money balance = isActive ? colBalance[i] : 0;
+        closed += (colState[i] == COLUMN_CLOSED);
+        active[isCurrent] += isActive;
+        deposits[isCurrent] += balance;
+    }
+    
+    out->active = active[0] + active[1];
+    out->closed = closed;
+    out->byType[ACCOUNT_SAVINGS] = active[0];
+    out->byType[ACCOUNT_CURRENT] = active[1];
+    out->deposits[ACCOUNT_SAVINGS] = deposits[0];
+    out->deposits[ACCOUNT_CURRENT] = deposits[1];
+}
+
+// Fills a summary from the running totals without touching the columns
+void storeTotalsSummarize(ColumnSummary *out) {
+    out->byType[ACCOUNT_SAVINGS] = storeTotals.accounts[0][ACCOUNT_SAVINGS];
+    out->byType[ACCOUNT_CURRENT] = storeTotals.accounts[0][ACCOUNT_CURRENT];
+    out->active = out->byType[ACCOUNT_SAVINGS] + out->byType[ACCOUNT_CURRENT];
+    out->closed = storeTotals.accounts[1][ACCOUNT_SAVINGS] + storeTotals.accounts[1][ACCOUNT_CURRENT];
+    out->deposits[ACCOUNT_SAVINGS] = storeTotals.balances[0][ACCOUNT_SAVINGS];
+    out->deposits[ACCOUNT_CURRENT] = storeTotals.balances[0][ACCOUNT_CURRENT];
+}
+
+// Prints the portfolio lines shared by the report and --stats
+void printPortfolio(const ColumnSummary *summary, Money feesCollected) {
+    Money total = summary->deposits[ACCOUNT_SAVINGS] + summary->deposits[ACCOUNT_CURRENT];
+    
+    printf("Active accounts  : %d (Savings %d, Current %d)\n",
+           summary->active, summary->byType[ACCOUNT_SAVINGS], summary->byType[ACCOUNT_CURRENT]);
+    printf("Closed accounts  : %d\n", summary->closed);
+    printf("Savings deposits : RM%.2f\n", MONEY_RM(summary->deposits[ACCOUNT_SAVINGS]));
+    printf("Current deposits : RM%.2f\n", MONEY_RM(summary->deposits[ACCOUNT_CURRENT]));
+    printf("Total deposits   : RM%.2f\n", MONEY_RM(total));
+    printf("Average balance  : RM%.2f\n", summary->active ? MONEY_RM(total) / summary->active : 0.0);
+    printf("Fees collected   : RM%.2f\n", MONEY_RM(feesCollected));
+}
+
+// Prints portfolio totals from the running totals, then checks them against a full column scan
+int runReport() {
+    ColumnSummary summary, scanned;
+    
+    storeTotalsSummarize(&summary);
+    printPortfolio(&summary, storeTotals.feesCollected);
+    
+    long long started = nowMicros();
+    columnsSummarize(&scanned);
+    long long scanMicros = nowMicros() - started;
+    int match = memcmp(&summary, &scanned, sizeof(ColumnSummary)) == 0;
+    printf("Column scan check: %d slots in %lld us, %s\n", storeSlotCount, scanMicros,
+           match ? "totals match" : "MISMATCH");
+    return match;
+}
+
+// Prints the totals saved in the data file header as of the last checkpoint
+// Reads only the header, so it costs the same for any number of accounts and never opens the journal
+int runStats() {
+    StoreHeader header;
+    ColumnSummary summary;
+    FILE *fp = fopen(STORE_FILE, "rb");
+    
+    if(fp == NULL || fread(&header, sizeof(header), 1, fp) != 1 || header.magic != STORE_MAGIC) {
+        printf("Error: Unable to read %s!\n", STORE_FILE);
+        if(fp != NULL)
+            fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+    storeTotals = header.totals;
+    storeTotalsSummarize(&summary);
+    printf("Totals as of the last checkpoint (journal sequence %llu):\n", header.checkpointSeq);
+    printPortfolio(&summary, header.totals.feesCollected);
+    return 1;
+}
+
+// Lower-cases a field value into a zero-padded B+tree key text
+void searchKeyText(const char *value, char *text) {
+    memset(text, 0, SEARCH_KEY_LEN);
+    for(int i = 0; i < SEARCH_KEY_LEN && value[i]; i++)
+        text[i] = (char)tolower((unsigned char)value[i]);
+}
+
+// The value a tree indexes for an account; the last-four tree keys on the ID's final characters
+const char* searchFieldValue(int tree, const char *accountName, const char *idNumber) {
+    size_t len = strlen(idNumber);
+    if(tree == SEARCH_BY_NAME)
+        return accountName;
+    if(tree == SEARCH_BY_ID_LAST4 && len > 4)
+        return idNumber + len - 4;
+    return idNumber;
+}
+
+// Orders keys by text, then by slot
+int searchCompare(const SearchKey *a, const SearchKey *b) {
+    int c = memcmp(a->text, b->text, SEARCH_KEY_LEN);
+    if(c != 0)
+        return c;
+    return (a->slot > b->slot) - (a->slot < b->slot);
+}
+
+int searchCompareKeys(const void *x, const void *y) {
+    return searchCompare((const SearchKey*)x, (const SearchKey*)y);
+}
+
+SearchHeader* searchHeader() {
+    return (SearchHeader*)searchMap;
+}
+
+// Pointer to a page; only valid until the next searchAllocPage(), which may move the mapping
+SearchPage* searchPage(unsigned int page) {
+    return (SearchPage*)(searchMap + (size_t)page * SEARCH_PAGE_SIZE);
+}
+
+// Appends an empty page, growing the file in doublings; returns 0 when the file cannot grow
+unsigned int searchAllocPage(int leaf) {
+    unsigned int page = searchHeader()->pageCount;
+    
+    if((size_t)(page + 1) * SEARCH_PAGE_SIZE > searchMapBytes &&
+       !fileMap(searchFd, &searchMap, &searchMapBytes, searchMapBytes * 2))
+        return 0;
+    searchHeader()->pageCount++;
+    memset(searchPage(page), 0, SEARCH_PAGE_SIZE);
+    searchPage(page)->leaf = (unsigned int)leaf;
+    return page;
+}
+
+// Child of an inner page that covers key: the number of separators not greater than key
+int searchChildIndex(SearchPage *p, const SearchKey *key) {
+    int lo = 0, hi = (int)p->count;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(searchCompare(&p->sep[mid], key) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Position of the first leaf key not less than key
+int searchLeafIndex(SearchPage *p, const SearchKey *key) {
+    int lo = 0, hi = (int)p->count;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(searchCompare(&p->keys[mid], key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Walks from the root to the leaf that covers key, recording the inner pages passed on the way
+// Returns the leaf page, or 0 if the tree is deeper than SEARCH_MAX_DEPTH
+unsigned int searchDescend(int tree, const SearchKey *key, unsigned int *path, int *depth) {
+    unsigned int page = searchHeader()->root[tree];
+    
+    *depth = 0;
+    while(!searchPage(page)->leaf) {
+        if(*depth == SEARCH_MAX_DEPTH)
+            return 0;
+        if(path != NULL)
+            path[*depth] = page;
+        (*depth)++;
+        page = searchPage(page)->child[searchChildIndex(searchPage(page), key)];
+    }
+    return page;
+}
+
+// Inserts one key, splitting full pages on the way back up; a root split adds a level
+int searchInsert(int tree, const SearchKey *key) {
+    unsigned int path[SEARCH_MAX_DEPTH], right, page;
+    SearchKey up;
+    int depth;
+    
+    page = searchDescend(tree, key, path, &depth);
+    if(page == 0)
+        return 0;
+    SearchPage *p = searchPage(page);
+    int at = searchLeafIndex(p, key);
+    if(at < (int)p->count && searchCompare(&p->keys[at], key) == 0)
+        return 1;
+    
+    if(p->count < SEARCH_LEAF_KEYS) {
+        memmove(&p->keys[at + 1], &p->keys[at], (p->count - at) * sizeof(SearchKey));
+        p->keys[at] = *key;
+        p->count++;
+        right = 0;
+    } else {
+        // Split the full leaf in half; the right half's first key goes up as the separator
+        SearchKey all[SEARCH_LEAF_KEYS + 1];
+        int total = SEARCH_LEAF_KEYS + 1, half = total / 2;
+        
+        if((right = searchAllocPage(1)) == 0)
+            return 0;
+        p = searchPage(page);
+        memcpy(all, p->keys, at * sizeof(SearchKey));
+        all[at] = *key;
+        memcpy(all + at + 1, p->keys + at, (p->count - at) * sizeof(SearchKey));
+        memcpy(p->keys, all, half * sizeof(SearchKey));
+        p->count = half;
+        SearchPage *r = searchPage(right);
+        memcpy(r->keys, all + half, (total - half) * sizeof(SearchKey));
+        r->count = total - half;
+        r->next = p->next;
+        p->next = right;
+        up = r->keys[0];
+    }
+    searchHeader()->entries++;
+    
+    // Hand each split's separator to the parent until a page has room
+    while(right != 0) {
+        if(depth == 0) {
+            unsigned int root = searchAllocPage(0);
+            if(root == 0)
+                return 0;
+            SearchPage *n = searchPage(root);
+            n->count = 1;
+            n->sep[0] = up;
+            n->child[0] = page;
+            n->child[1] = right;
+            searchHeader()->root[tree] = root;
+            break;
+        }
+        page = path[--depth];
+        p = searchPage(page);
+        at = searchChildIndex(p, &up);
+        if(p->count < SEARCH_INNER_KEYS) {
+            memmove(&p->sep[at + 1], &p->sep[at], (p->count - at) * sizeof(SearchKey));
+            memmove(&p->child[at + 2], &p->child[at + 1], (p->count - at) * sizeof(unsigned int));
+            p->sep[at] = up;
+            p->child[at + 1] = right;
+            p->count++;
+            break;
+        }
+        
+        // Split the full inner page; its middle separator moves up instead of being copied
+        SearchKey seps[SEARCH_INNER_KEYS + 1];
+        unsigned int children[SEARCH_INNER_KEYS + 2];
+        int total = SEARCH_INNER_KEYS + 1, mid = total / 2;
+        unsigned int sibling = searchAllocPage(0);
+        
+        if(sibling == 0)
+            return 0;
+        p = searchPage(page);
+        memcpy(seps, p->sep, at * sizeof(SearchKey));
+        seps[at] = up;
+        memcpy(seps + at + 1, p->sep + at, (p->count - at) * sizeof(SearchKey));
+        memcpy(children, p->child, (at + 1) * sizeof(unsigned int));
+        children[at + 1] = right;
+        memcpy(children + at + 2, p->child + at + 1, (p->count - at) * sizeof(unsigned int));
+        
+        memcpy(p->sep, seps, mid * sizeof(SearchKey));
+        memcpy(p->child, children, (mid + 1) * sizeof(unsigned int));
+        p->count = mid;
+        SearchPage *r = searchPage(sibling);
+        memcpy(r->sep, seps + mid + 1, (total - mid - 1) * sizeof(SearchKey));
+        memcpy(r->child, children + mid + 1, (total - mid) * sizeof(unsigned int));
+        r->count = total - mid - 1;
+        up = seps[mid];
+        right = sibling;
+    }
+    return 1;
+}
+
+// Removes one key; pages are never merged, so an emptied leaf simply stays in the chain
+// until the next rebuild packs the tree again
+int searchDelete(int tree, const SearchKey *key) {
+    int depth;
+    unsigned int page = searchDescend(tree, key, NULL, &depth);
+    
+    if(page == 0)
+        return 0;
+    SearchPage *p = searchPage(page);
+    int at = searchLeafIndex(p, key);
+    if(at >= (int)p->count || searchCompare(&p->keys[at], key) != 0)
+        return 0;
+    memmove(&p->keys[at], &p->keys[at + 1], (p->count - at - 1) * sizeof(SearchKey));
+    p->count--;
+    searchHeader()->entries--;
+    return 1;
+}
+
+// Builds one tree bottom-up from sorted keys, packing pages SEARCH_FILL_PERCENT full
+// Returns the root page, or 0 when memory or disk space ran out
+unsigned int searchBulkLoad(const SearchKey *keys, int n) {
+    int leafFill = SEARCH_LEAF_KEYS * SEARCH_FILL_PERCENT / 100;
+    int fanout = SEARCH_INNER_KEYS * SEARCH_FILL_PERCENT / 100 + 1;
+    int count = n ? (n + leafFill - 1) / leafFill : 1;
+    unsigned int *pages = (unsigned int*)malloc(count * sizeof(unsigned int));
+    SearchKey *firsts = (SearchKey*)calloc(count, sizeof(SearchKey));
+    unsigned int previous = 0, root = 0;
+    
+    if(pages == NULL || firsts == NULL)
+        goto done;
+    
+    // Leaves, chained left to right
+    for(int i = 0; i < count; i++) {
+        int used = n - i * leafFill;
+        if(used > leafFill) used = leafFill;
+        if(used < 0) used = 0;
+        if((pages[i] = searchAllocPage(1)) == 0)
+            goto done;
+        memcpy(searchPage(pages[i])->keys, keys + (size_t)i * leafFill, used * sizeof(SearchKey));
+        searchPage(pages[i])->count = used;
+        if(used > 0)
+            firsts[i] = keys[(size_t)i * leafFill];
+        if(previous != 0)
+            searchPage(previous)->next = pages[i];
+        previous = pages[i];
+    }
+    
+    // Inner levels; each node's separators are the first keys of its children after the first
+    while(count > 1) {
+        int groups = (count + fanout - 1) / fanout;
+        for(int g = 0; g < groups; g++) {
+            int children = count - g * fanout;
+            if(children > fanout) children = fanout;
+            unsigned int page = searchAllocPage(0);
+            if(page == 0)
+                goto done;
+            SearchPage *p = searchPage(page);
+            for(int j = 0; j < children; j++) {
+                p->child[j] = pages[g * fanout + j];
+                if(j > 0)
+                    p->sep[j - 1] = firsts[g * fanout + j];
+            }
+            p->count = children - 1;
+            pages[g] = page;
+            firsts[g] = firsts[g * fanout];
+        }
+        count = groups;
+    }
+    root = pages[0];
+    
+done:
+    free(pages);
+    free(firsts);
+    return root;
+}
+
+// Rebuilds every tree from the columns: one sort and one sequential bulk load per field
+int searchRebuild() {
+    int live = 0;
+    SearchKey *keys = (SearchKey*)malloc((storeSlotCount ? storeSlotCount : 1) * sizeof(SearchKey));
+    
+    if(keys == NULL)
+        return 0;
+    searchHeader()->pageCount = 1;
+    searchHeader()->entries = 0;
+    for(int tree = 0; tree < SEARCH_TREES; tree++) {
+        live = 0;
+        for(int slot = 0; slot < storeSlotCount; slot++) {
+            if(colState[slot] == COLUMN_EMPTY)
+                continue;
+            searchKeyText(searchFieldValue(tree, colText[slot].accountName, colText[slot].idNumber), keys[live].text);
+            keys[live].slot = slot;
+            live++;
+        }
+        qsort(keys, live, sizeof(SearchKey), searchCompareKeys);
+        unsigned int root = searchBulkLoad(keys, live);
+        if(root == 0) {
+            free(keys);
+            return 0;
+        }
+        searchHeader()->root[tree] = root;
+        searchHeader()->entries += live;
+    }
+    free(keys);
+    return 1;
+}
+
+// Opens the search file; it is trusted only if it was closed cleanly and indexes every live account,
+// otherwise it is rebuilt from the columns. It is marked in use until searchClose() runs at exit,
+// so a crash while it was being changed always leads to a rebuild
+int searchOpen() {
+    struct stat st;
+    size_t bytes = (size_t)SEARCH_MAP_MIN_PAGES * SEARCH_PAGE_SIZE;
+    SearchHeader *h;
+    
+    #ifdef _WIN32
+        searchFd = _open(SEARCH_FILE, _O_RDWR | _O_CREAT | _O_BINARY, 0600);
+    #else
+        searchFd = open(SEARCH_FILE, O_RDWR | O_CREAT, 0600);
+    #endif
+    if(searchFd < 0 || fstat(searchFd, &st) != 0)
+        return 0;
+    while(bytes < (size_t)st.st_size)
+        bytes *= 2;
+    if(!fileMap(searchFd, &searchMap, &searchMapBytes, bytes))
+        return 0;
+    
+    h = searchHeader();
+    if(h->magic != SEARCH_MAGIC || h->version != SEARCH_VERSION || h->pageSize != SEARCH_PAGE_SIZE ||
+       h->clean != 1 || (size_t)h->pageCount * SEARCH_PAGE_SIZE > searchMapBytes ||
+       h->entries != (unsigned long long)indexCount * SEARCH_TREES) {
+        memset(h, 0, sizeof(SearchHeader));
+        h->magic = SEARCH_MAGIC;
+        h->version = SEARCH_VERSION;
+        h->pageSize = SEARCH_PAGE_SIZE;
+        if(!searchRebuild())
+            return 0;
+    }
+    searchHeader()->clean = 0;
+    if(!fileSync(searchFd, searchMap, SEARCH_PAGE_SIZE))
+        return 0;
+    searchReady = 1;
+    atexit(searchClose);
+    return 1;
+}
+
+// Flushes the index and marks it clean; registered with atexit()
+void searchClose() {
+    if(searchMap == NULL)
+        return;
+    if(searchReady && fileSync(searchFd, searchMap, searchMapBytes)) {
+        searchHeader()->clean = 1;
+        fileSync(searchFd, searchMap, SEARCH_PAGE_SIZE);
+    }
+    fileUnmap(searchMap, searchMapBytes);
+    close(searchFd);
+    searchMap = NULL;
+    searchMapBytes = 0;
+    searchFd = -1;
+    searchReady = 0;
+}
+
+// Adds or removes the three keys of one account; a failure leaves the file unclean so it is rebuilt
+int searchUpdateAccount(int slot, const Account *acc, int add) {
+    SearchKey key;
+    int ok = 1;
+    
+    if(!searchReady)
+        return 1;
+    for(int tree = 0; tree < SEARCH_TREES; tree++) {
+        searchKeyText(searchFieldValue(tree, acc->accountName, acc->idNumber), key.text);
+        key.slot = slot;
+        ok = (add ? searchInsert(tree, &key) : searchDelete(tree, &key)) && ok;
+    }
+    if(!ok)
+        searchReady = 0;
+    return ok;
+}
+
+int searchAddAccount(int slot, const Account *acc) {
+    return searchUpdateAccount(slot, acc, 1);
+}
+
+int searchRemoveAccount(int slot, const Account *acc) {
+    return searchUpdateAccount(slot, acc, 0);
+}
+
+// Whether a lower-cased value lies in [low, high], where high also admits anything it prefixes
+int searchInRange(const char *value, const char *low, const char *high, size_t length) {
+    return strncmp(value, low, length) >= 0 &&
+           (strncmp(value, high, length) <= 0 || strncmp(value, high, strlen(high)) == 0);
+}
+
+// Finds accounts whose field is between low and high, both case-insensitive; high matches as a
+// prefix too, so low == high is a prefix search. Copies up to max slots in key order and counts
+// matches up to SEARCH_COUNT_LIMIT into *total. Keys only hold SEARCH_KEY_LEN characters, so
+// every candidate is checked against the full value in the columns.
+int searchFind(int tree, const char *low, const char *high, int *slots, int max, int *total) {
+    char lowFull[64], highFull[64], value[64], lowText[SEARCH_KEY_LEN + 1], highText[SEARCH_KEY_LEN + 1];
+    SearchKey from;
+    int found = 0, depth;
+    
+    *total = 0;
+    if(!searchReady)
+        return 0;
+    snprintf(lowFull, sizeof(lowFull), "%s", low);
+    snprintf(highFull, sizeof(highFull), "%s", high);
+    for(char *c = lowFull; *c; c++) *c = (char)tolower((unsigned char)*c);
+    for(char *c = highFull; *c; c++) *c = (char)tolower((unsigned char)*c);
+    searchKeyText(lowFull, from.text);
+    from.slot = -1;
+    memcpy(lowText, from.text, SEARCH_KEY_LEN);
+    lowText[SEARCH_KEY_LEN] = '\0';
+    searchKeyText(highFull, highText);
+    highText[SEARCH_KEY_LEN] = '\0';
+    
+    unsigned int page = searchDescend(tree, &from, NULL, &depth);
+    int at = page ? searchLeafIndex(searchPage(page), &from) : 0;
+    while(page != 0 && *total < SEARCH_COUNT_LIMIT) {
+        SearchPage *p = searchPage(page);
+        for(; at < (int)p->count && *total < SEARCH_COUNT_LIMIT; at++) {
+            char text[SEARCH_KEY_LEN + 1];
+            memcpy(text, p->keys[at].text, SEARCH_KEY_LEN);
+            text[SEARCH_KEY_LEN] = '\0';
+            if(!searchInRange(text, lowText, highText, SEARCH_KEY_LEN))
+                return found;
+    
+            int slot = p->keys[at].slot;
+            if(colState[slot] == COLUMN_EMPTY)
+                continue;
+            snprintf(value, sizeof(value), "%s", searchFieldValue(tree, colText[slot].accountName, colText[slot].idNumber));
+            for(char *c = value; *c; c++) *c = (char)tolower((unsigned char)*c);
+            if(!searchInRange(value, lowFull, highFull, sizeof(value)))
+                continue;
+            if(found < max)
+                slots[found++] = slot;
+            (*total)++;
+        }
+        page = p->next;
+        at = 0;
+    }
+    return found;
+}
+
+// Asks for a field and a prefix or range, then lists the first matches
+// With selectedAccountNum set, the operator may pick one; returns 1 when an account was picked
+int searchAccounts(int *selectedAccountNum) {
+    char term[64], *low = term, *high = term, *dots;
+    int field, slots[LIST_PAGE_SIZE] = { 0 }, count, total, selection;
+    
+    if(indexCount == 0) {
+        printf("No accounts found!\n");
+        return 0;
+    }
+    printf("Search by (1=ID number, 2=Last 4 digits of ID, 3=Name): ");
+    if(scanf("%d", &field) != 1 || field < 1 || field > 3) {
+        printf("Invalid choice!\n");
+        while(getchar() != '\n');
+        return 0;
+    }
+    while(getchar() != '\n');
+    printf("Search for (a prefix, or from..to for a range): ");
+    if(scanf("%63s", term) != 1) {
+        while(getchar() != '\n');
+        return 0;
+    }
+    while(getchar() != '\n');
+    
+    // "from..to" searches a range; anything else is a prefix
+    if((dots = strstr(term, "..")) != NULL) {
+        *dots = '\0';
+        high = dots + 2;
+    }
+    long long started = monotonicNanos();
+    count = searchFind(field - 1, low, high, slots, LIST_PAGE_SIZE, &total);
+    double micros = (monotonicNanos() - started) / 1000.0;
+    
+    listPrintRows(slots, count, "No accounts match the search.");
+    printf("  %d%s match%s in %.1f us", total, total >= SEARCH_COUNT_LIMIT ? " or more" : "",
+           total == 1 ? "" : "es", micros);
+    if(total > count)
+        printf(", showing the first %d", count);
+    printf("\n");
+    
+    if(selectedAccountNum == NULL || count == 0)
+        return 0;
+    while(1) {
+        printf("\nEnter account (1-%d), or 0 to go back: ", count);
         if(scanf("%d", &selection) != 1) {
             printf("Invalid input! Please enter a number.\n");
             while(getchar() != '\n');
             continue;
         }
-        getchar();
-        
-        if(selection == 0) {
-            // Allow operators to type the exact account number if they know it
-            printf("Enter account number: ");
-            if(scanf("%d", selectedAccountNum) != 1) {
-                printf("Invalid account number!\n");
-                while(getchar() != '\n');
+        getchar();
+        if(selection == 0)
+            return 0;
+        if(selection >= 1 && selection <= count) {
+            *selectedAccountNum = colNumber[slots[selection - 1]];
+            return 1;
+        }
+        printf("Invalid selection! Please try again.\n");
+    }
+}
+
+// Parses one database/<num>.txt file written by the old text-based saveAccount()
+// Returns LEGACY_OK, or why the file cannot be migrated; every field must be present
+int legacyReadAccount(int num, Account *acc) {
+    char filename[100];
+    char label[50], balanceText[32], pin[5];
+    int fields = 0;
+    sprintf(filename, "database/%d.txt", num);
+    FILE *fp = fopen(filename, "r");
+    
+    if(fp == NULL)
+        return LEGACY_MISSING;
+    
+    memset(acc, 0, sizeof(Account));
+    fields += fscanf(fp, "%49s %49s %d\n", label, label, &acc->accountNumber) == 3;
+    fields += fscanf(fp, "%49s %49s %49s\n", label, label, acc->accountName) == 3;
+    fields += fscanf(fp, "%49s %4s\n", label, pin) == 2;
+    fields += fscanf(fp, "%49s %31s\n", label, balanceText) == 2;
+    fields += fscanf(fp, "%49s %d\n", label, &acc->status) == 2;
+    fields += fscanf(fp, "%49s %49s %9s\n", label, label, acc->accountType) == 3;
+    fields += fscanf(fp, "%49s %49s %19s\n", label, label, acc->idNumber) == 3;
+    fclose(fp);
+    // Balances were written with "%.2f", so they convert to sen exactly
+    if(fields != 7 || !parseMoney(balanceText, &acc->balance))
+        return LEGACY_MALFORMED;
+    pinSet(acc, pin);
+    return acc->accountNumber == num ? LEGACY_OK : LEGACY_MISMATCH;
+}
+
+// Migration worker: parses the account files of one range of index.txt entries
+void* legacyParseWorker(void *arg) {
+    LoadWorker *w = (LoadWorker*)arg;
+    
+    for(int i = w->from; i < w->to; i++)
+        w->results[i] = (unsigned char)legacyReadAccount(w->numbers[i], &w->accounts[i]);
+    return NULL;
+}
+
+// Migration worker: removes the text files of one range of entries that are now in the data file
+void* legacyRemoveWorker(void *arg) {
+    LoadWorker *w = (LoadWorker*)arg;
+    char filename[100];
+    
+    for(int i = w->from; i < w->to; i++) {
+        if((w->results[i] != LEGACY_OK && w->results[i] != LEGACY_PRESENT) || indexLookup(w->numbers[i]) < 0)
+            continue;
+        sprintf(filename, "database/%d.txt", w->numbers[i]);
+        remove(filename);
+    }
+    return NULL;
+}
+
+// Counts database/<num>.txt files; with listed (sorted), only those whose number it does not hold
+int legacyCountFiles(const int *listed, int count) {
+    int files = 0;
+    
+    #ifdef _WIN32
+        struct _finddata_t found;
+        intptr_t handle = _findfirst("database/*.txt", &found);
+        if(handle == -1)
+            return 0;
+        do {
+            const char *name = found.name;
+    #else
+        DIR *dir = opendir("database");
+        struct dirent *entry;
+        if(dir == NULL)
+            return 0;
+        while((entry = readdir(dir)) != NULL) {
+            const char *name = entry->d_name;
+    #endif
+            int num, end = 0;
+            if(sscanf(name, "%d.txt%n", &num, &end) == 1 && end > 0 && name[end] == '\0' &&
+               (listed == NULL || bsearch(&num, listed, count, sizeof(int), compareAccountNumbers) == NULL))
+                files++;
+    #ifdef _WIN32
+        } while(_findnext(handle, &found) == 0);
+        _findclose(handle);
+    #else
+        }
+        closedir(dir);
+    #endif
+    return files;
+}
+
+// Copies every account listed in index.txt into the data file, then removes the old text files
+// Runs at startup while database/index.txt exists. A pool of workers reads and validates the files;
+// they are then appended in index.txt order, so slot numbers match the order the accounts were
+// created in. A file is only removed once its account is synced in the data file. If any readable
+// account could not be saved, index.txt is kept and -1 returned, and the next start carries on.
+int migrateLegacyDatabase() {
+    FILE *fp = fopen("database/index.txt", "r");
+    LoadWorker workers[LOAD_MAX_THREADS];
+    int *numbers = NULL, count = 0, capacity = 0, num, reported = 0, complete;
+    
+    if(fp == NULL)
+        return 0;
+    
+    long long started = nowMicros();
+    while(fscanf(fp, "%d", &num) == 1) {
+        if(!loadListPush(&numbers, &count, &capacity, num))
+            break;
+    }
+    fclose(fp);
+    
+    Account *accounts = (Account*)malloc((count + 1) * sizeof(Account));
+    unsigned char *results = (unsigned char*)malloc(count + 1);
+    if(accounts == NULL || results == NULL) {
+        printf("Error: Not enough memory to migrate %d accounts!\n", count);
+        free(numbers);
+        free(accounts);
+        free(results);
+        return 0;
+    }
+    
+    int threads = loadThreadCount(count);
+    memset(workers, 0, sizeof(workers));
+    for(int t = 0; t < threads; t++) {
+        workers[t].numbers = numbers;
+        workers[t].accounts = accounts;
+        workers[t].results = results;
+    }
+    loadRun(workers, threads, count, legacyParseWorker);
+    
+    memset(&loadReport.legacyFailed, 0, sizeof(loadReport.legacyFailed));
+    loadReport.legacyListed = count;
+    loadReport.legacyLoaded = 0;
+    // Accounts a previous start saved before it stopped are not saved again; their files go as usual
+    for(int i = 0; i < count; i++) {
+        if(results[i] == LEGACY_OK && indexLookup(numbers[i]) >= 0)
+            results[i] = LEGACY_PRESENT;
+    }
+    for(int i = 0; i < count; i++) {
+        // A repeated entry names a file already migrated, which is removed along with the first entry
+        if(results[i] == LEGACY_OK && indexLookup(numbers[i]) >= 0)
+            results[i] = LEGACY_REPEATED;
+        if(results[i] == LEGACY_PRESENT)
+            continue;
+        if(results[i] != LEGACY_OK) {
+            // Index entries without a readable file were already broken before migration
+            if(reported++ < CHECK_REPORT_LIMIT)
+                printf("Warning: Skipping account %d: %s\n", numbers[i], legacyResultNames[results[i]]);
+            loadReport.legacyFailed[results[i]]++;
+            continue;
+        }
+        if(!saveAccount(&accounts[i])) {
+            // Nothing from here on reached the data file, so none of these files may be removed
+            for(int j = i; j < count; j++) {
+                if(results[j] == LEGACY_OK) {
+                    results[j] = LEGACY_UNSAVED;
+                    loadReport.legacyFailed[LEGACY_UNSAVED]++;
+                }
+            }
+            printf("Error: Unable to save account %d; %d accounts were not migrated!\n",
+                   numbers[i], loadReport.legacyFailed[LEGACY_UNSAVED]);
+            break;
+        }
+        loadReport.legacyLoaded++;
+    }
+    
+    // Only drop the text files once their records are safely on disk
+    complete = storeSync();
+    if(complete)
+        loadRun(workers, threads, count, legacyRemoveWorker);
+    complete = complete && loadReport.legacyFailed[LEGACY_UNSAVED] == 0;
+    
+    // Files index.txt never named are not imported, only reported
+    qsort(numbers, count, sizeof(int), compareAccountNumbers);
+    loadReport.legacyOrphans = legacyCountFiles(numbers, count);
+    if(reported > CHECK_REPORT_LIMIT)
+        printf("Warning: %d more index.txt entries skipped\n", reported - CHECK_REPORT_LIMIT);
+    if(loadReport.legacyOrphans > 0)
+        printf("Warning: %d account files not listed in index.txt were left in database/\n",
+               loadReport.legacyOrphans);
+    
+    // The data file and in-memory index replace index.txt from now on, unless some accounts are only
+    // in their text files; then index.txt stays so the next start finishes the migration
+    if(complete)
+        remove("database/index.txt");
+    else
+        printf("Error: Migration incomplete; database/index.txt was kept and will be retried on the next start!\n");
+    loadReport.legacyMicros = nowMicros() - started;
+    
+    if(loadReport.legacyLoaded > 0) {
+        logEvent(LOG_MIGRATE, loadReport.legacyLoaded, 0, 0, 0, NULL);
+    }
+    free(numbers);
+    free(accounts);
+    free(results);
+    return complete ? loadReport.legacyLoaded : -1;
+}
+
+// Bucket of an account in the log cross-check table, added with no flags if it is not there yet
+IndexEntry* checkLogEntry(CheckLog *log, int num) {
+    if((unsigned int)(log->count + 1) * 2 > log->capacity) {
+        unsigned int capacity = log->capacity ? log->capacity * 2 : INDEX_MIN_CAPACITY;
+        IndexEntry *table = (IndexEntry*)calloc(capacity, sizeof(IndexEntry));
+        if(table == NULL)
+            return NULL;
+        for(unsigned int i = 0; i < log->capacity; i++) {
+            if(log->table[i].accountNumber == 0)
+                continue;
+            unsigned int b = indexHash(log->table[i].accountNumber) & (capacity - 1);
+            while(table[b].accountNumber != 0)
+                b = (b + 1) & (capacity - 1);
+            table[b] = log->table[i];
+        }
+        free(log->table);
+        log->table = table;
+        log->capacity = capacity;
+    }
+    
+    unsigned int b = indexHash(num) & (log->capacity - 1);
+    while(log->table[b].accountNumber != 0 && log->table[b].accountNumber != num)
+        b = (b + 1) & (log->capacity - 1);
+    if(log->table[b].accountNumber == 0) {
+        log->table[b].accountNumber = num;
+        log->table[b].slot = 0;
+        log->count++;
+    }
+    return &log->table[b];
+}
+
+// Log visitor of the cross-check: follows each account through its creation, activity and deletion
+void checkLogVisit(const LogRecord *rec, void *ctx) {
+    CheckLog *log = (CheckLog*)ctx;
+    int accounts[2];
+    int n = logRecordAccounts(rec, accounts);
+    
+    for(int i = 0; i < n && !log->failed; i++) {
+        IndexEntry *e = checkLogEntry(log, accounts[i]);
+        if(e == NULL) {
+            log->failed = 1;
+            return;
+        }
+        if(rec->type == LOG_CREATE)
+            e->slot = (e->slot & ~CHECK_LOG_DELETED) | CHECK_LOG_CREATED;
+        else if(rec->type == LOG_DELETE)
+            e->slot = (e->slot & ~CHECK_LOG_CREATED) | CHECK_LOG_DELETED;
+        else
+            e->slot |= CHECK_LOG_ACTIVITY | ((e->slot & CHECK_LOG_DELETED) ? CHECK_LOG_LATE : 0);
+    }
+}
+
+// Seeds the log cross-check from the snapshot: its accounts count as created, its tombstones as
+// deleted, and *from becomes the first log time still to be read. Returns 0 if the snapshot is damaged.
+int checkSnapshot(CheckLog *log, long long *from) {
+    SnapshotHeader header;
+    Account acc;
+    SnapshotTombstone t;
+    StoreTotals sums;
+    FILE *fp = fopen(SNAPSHOT_FILE, "rb");
+    unsigned int hash = 2166136261u;
+    int ok, i;
+    
+    if(fp == NULL)
+        return 1;
+    ok = snapshotReadHeader(fp, &header);
+    memset(&sums, 0, sizeof(sums));
+    for(i = 0; ok && i < header.accounts && fread(&acc, sizeof(acc), 1, fp) == 1; i++) {
+        IndexEntry *e = checkLogEntry(log, acc.accountNumber);
+        if(e == NULL)
+            log->failed = 1;
+        else
+            e->slot = CHECK_LOG_CREATED;
+        hash = snapshotHash(hash, &acc, sizeof(acc));
+        sums.accounts[acc.status == 1][accountTypeCode(&acc)]++;
+        sums.balances[acc.status == 1][accountTypeCode(&acc)] += acc.balance;
+    }
+    ok = ok && i == header.accounts;
+    for(i = 0; ok && i < header.tombstones && fread(&t, sizeof(t), 1, fp) == 1; i++) {
+        IndexEntry *e = checkLogEntry(log, t.accountNumber);
+        if(e == NULL)
+            log->failed = 1;
+        else
+            e->slot = CHECK_LOG_DELETED;
+        hash = snapshotHash(hash, &t, sizeof(t));
+    }
+    ok = ok && i == header.tombstones && hash == header.checksum && fgetc(fp) == EOF;
+    fclose(fp);
+    
+    if(!ok) {
+        // Nothing from a damaged snapshot can be trusted; the whole log that is left is read instead
+        printf("  Snapshot     : %s is damaged\n", SNAPSHOT_FILE);
+        free(log->table);
+        memset(log, 0, sizeof(CheckLog));
+        return 0;
+    }
+    time_t seconds = (time_t)(header.takenAt / 1000000000LL);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+    printf("  Snapshot     : %d accounts and %d tombstones as of %s\n", header.accounts, header.tombstones, when);
+    *from = header.takenAt + 1;
+    // The accounts were copied while transactions went on; they must still add up to the totals of
+    // the moment the snapshot was taken
+    if(memcmp(sums.accounts, header.totals.accounts, sizeof(sums.accounts)) != 0 ||
+       memcmp(sums.balances, header.totals.balances, sizeof(sums.balances)) != 0) {
+        printf("  Snapshot accounts do not add up to the totals taken with them\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Integrity check of the whole database directory, run after the normal startup scan and recovery:
+// every slot's fields, the hash index and free-slot stack against the slots, the running totals
+// against the columns, the audit log against the data file, and leftovers of the text format.
+// Lists the first CHECK_REPORT_LIMIT problems of each part; returns 1 when nothing is wrong.
+int runCheck() {
+    int problems = 0, listed = 0, live = 0, freeCount = 0, counts[CHECK_KINDS] = { 0 };
+    
+    printf("Database check\n");
+    printf("  Startup scan : %d slots by %d worker%s in %.1f ms\n", storeSlotCount, loadReport.threads,
+           loadReport.threads == 1 ? "" : "s", loadReport.scanMicros / 1000.0);
+    
+    // Slots: damaged records, implausible fields, and numbers held by two slots
+    for(int i = 0; i < storeSlotCount; i++) {
+        StoreSlot *slot = storeSlotAt(i);
+        int problem = storeSlotCheck(slot);
+        int holder = -1;
+        if(slot->state == STORE_SLOT_FREE) {
+            freeCount++;
+            continue;
+        }
+        if(problem != CHECK_BAD_STATE && problem != CHECK_BAD_CHECKSUM) {
+            holder = indexLookup(slot->acc.accountNumber);
+            if(holder == i)
+                live++;
+        }
+        if(problem == CHECK_OK && holder == i)
+            continue;
+        problems++;
+        if(problem != CHECK_OK)
+            counts[problem]++;
+        if(listed++ < CHECK_REPORT_LIMIT) {
+            if(problem != CHECK_OK)
+                printf("  Slot %d (account %d): %s\n", i, slot->acc.accountNumber, checkProblemNames[problem]);
+            else
+                printf("  Slot %d (account %d): number also held by slot %d\n", i, slot->acc.accountNumber, holder);
+        }
+    }
+    for(int k = 1; k < CHECK_KINDS; k++) {
+        if(counts[k] > 0)
+            printf("  %-28s: %d slot%s\n", checkProblemNames[k], counts[k], counts[k] == 1 ? "" : "s");
+    }
+    if(loadReport.duplicates > 0)
+        printf("  %-28s: %d slot%s\n", "duplicate account number", loadReport.duplicates,
+               loadReport.duplicates == 1 ? "" : "s");
+    printf("  Data file    : %d accounts, %d free slots\n", live, freeCount);
+    
+    // In-memory structures built at startup must describe exactly those slots
+    if(indexCount != live || freeSlotCount != freeCount) {
+        printf("  Index holds %d accounts and %d free slots\n", indexCount, freeSlotCount);
+        problems++;
+    }
+    ColumnSummary running, scanned;
+    storeTotalsSummarize(&running);
+    columnsSummarize(&scanned);
+    if(memcmp(&running, &scanned, sizeof(ColumnSummary)) != 0) {
+        printf("  Running totals do not match the columns\n");
+        problems++;
+    }
+    
+    // Log: each account's creation, activity and deletion against what the data file holds
+    // The snapshot stands in for the log up to its point, so only the log after it is read
+    CheckLog log;
+    LogQueryStats stats;
+    int logProblems = 0, unrecorded = 0;
+    long long logFrom = LLONG_MIN;
+    listed = 0;
+    memset(&log, 0, sizeof(log));
+    if(!checkSnapshot(&log, &logFrom))
+        problems++;
+    logQuery(0, logFrom, LLONG_MAX, 0, checkLogVisit, &log, &stats);
+    if(log.failed) {
+        printf("Error: Not enough memory to check the log!\n");
+        free(log.table);
+        return 0;
+    }
+    for(unsigned int b = 0; b < log.capacity; b++) {
+        int num = log.table[b].accountNumber, flags = log.table[b].slot;
+        int inStore = num != 0 && indexLookup(num) >= 0;
+        const char *what = NULL;
+        if(num == 0)
+            continue;
+        if((flags & CHECK_LOG_DELETED) && inStore)
+            what = "deleted in the log but still in the data file";
+        else if((flags & CHECK_LOG_CREATED) && !inStore)
+            what = "created in the log but missing from the data file";
+        else if(!(flags & (CHECK_LOG_CREATED | CHECK_LOG_DELETED)) && !inStore)
+            what = "logged activity but never existed";
+        else if(flags & CHECK_LOG_LATE)
+            what = "logged activity after its deletion";
+        else if(!(flags & CHECK_LOG_CREATED) && inStore)
+            unrecorded++;
+        if(what == NULL)
+            continue;
+        logProblems++;
+        if(listed++ < CHECK_REPORT_LIMIT)
+            printf("  Account %d: %s\n", num, what);
+    }
+    printf("  Log          : %lld records in %d segment%s, %d accounts mentioned, %d problem%s\n",
+           stats.recordsRead, stats.segments, stats.segments == 1 ? "" : "s", log.count,
+           logProblems, logProblems == 1 ? "" : "s");
+    if(unrecorded > 0)
+        printf("  %d live accounts have no creation record (migrated or generated)\n", unrecorded);
+    problems += logProblems;
+    free(log.table);
+    
+    // Text-format leftovers: migration removes index.txt and every file it imported
+    int leftovers = legacyCountFiles(NULL, 0);
+    if(access("database/index.txt", 0) == 0) {
+        printf("  database/index.txt is still present\n");
+        problems++;
+    }
+    if(leftovers > 0) {
+        printf("  %d account files of the text format are still in database/\n", leftovers);
+        problems++;
+    }
+    
+    if(problems == 0)
+        printf("Result: no problems found\n");
+    else
+        printf("Result: %d problem%s found\n", problems, problems == 1 ? "" : "s");
+    return problems == 0;
+}
+
+// Snapshots
+// A snapshot is a consistent copy of every live account as of one moment, written by a background
+// thread while transactions go on. The snapshot point is taken between operations, when every
+// accepted change is in the data file. From then on the writer copies the data file chunk by chunk,
+// and anyone about to change a slot in a chunk the writer has not reached yet first saves a copy of
+// that chunk for it (copy-on-write). Once the file is in place, log segments that lie wholly before
+// the snapshot point are removed: the snapshot holds the balances they led to and a tombstone for
+// every account they deleted, so --check only reads the snapshot plus the log written after it.
+
+// Continues an FNV-1a hash over more bytes
+unsigned int snapshotHash(unsigned int hash, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Called before any slot of the mapping changes. While a snapshot is being copied, the first change
+// to a chunk the writer has not reached saves the chunk as it was at the snapshot point.
+void snapshotPreserve(int slot) {
+    if(!atomic_load_explicit(&snapshotActive, memory_order_acquire))
+        return;
+    pthread_mutex_lock(&snapshotLock);
+    int chunk = slot / SNAPSHOT_CHUNK_SLOTS;
+    if(atomic_load_explicit(&snapshotActive, memory_order_relaxed) && slot < snapshotSlots &&
+       chunk >= snapshotCopied && snapshotSaved[chunk] == NULL) {
+        int first = chunk * SNAPSHOT_CHUNK_SLOTS;
+        int count = snapshotSlots - first < SNAPSHOT_CHUNK_SLOTS ? snapshotSlots - first : SNAPSHOT_CHUNK_SLOTS;
+        // Without memory for the copy the writer would see the change, so the snapshot is abandoned
+        snapshotSaved[chunk] = (StoreSlot*)malloc((size_t)count * sizeof(StoreSlot));
+        if(snapshotSaved[chunk] != NULL) {
+            memcpy(snapshotSaved[chunk], storeSlotAt(first), (size_t)count * sizeof(StoreSlot));
+            snapshotResult.chunksSaved++;
+        } else {
+            atomic_store_explicit(&snapshotActive, 0, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&snapshotLock);
+}
+
+// Reads a snapshot header and checks it describes a file this version can read
+int snapshotReadHeader(FILE *fp, SnapshotHeader *header) {
+    return fread(header, sizeof(SnapshotHeader), 1, fp) == 1 && header->magic == SNAPSHOT_MAGIC &&
+           header->version == SNAPSHOT_VERSION && header->accountSize == sizeof(Account) &&
+           header->accounts >= 0 && header->tombstones >= 0;
+}
+
+// Log visitor of the snapshot writer: collects the deletions since the previous snapshot
+void snapshotCollectDelete(const LogRecord *rec, void *ctx) {
+    LogCollection *deleted = (LogCollection*)ctx;
+    if(rec->type == LOG_DELETE)
+        logCollect(rec, deleted);
+}
+
+// Background writer: copies the slots as of the snapshot point, adds the tombstones, then puts the
+// file in place and compacts the log
+void* snapshotWriter(void *arg) {
+    SnapshotHeader header, previous;
+    StoreSlot *chunk = (StoreSlot*)malloc(SNAPSHOT_CHUNK_SLOTS * sizeof(StoreSlot));
+    LogCollection deleted = { NULL, 0, 0 };
+    LogQueryStats stats;
+    FILE *fp = fileCreatePrivate(SNAPSHOT_TEMP_FILE);
+    long long started = nowMicros();
+    int chunks = (snapshotSlots + SNAPSHOT_CHUNK_SLOTS - 1) / SNAPSHOT_CHUNK_SLOTS;
+    int ok = (fp != NULL && chunk != NULL);
+    (void)arg;
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.accountSize = sizeof(Account);
+    header.takenAt = snapshotAt;
+    header.totals = snapshotTotals;
+    header.checksum = 2166136261u;
+    ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+    
+    // Accounts: each chunk comes from the copy a writer saved, or straight from the mapping
+    for(int c = 0; c < chunks && ok; c++) {
+        int first = c * SNAPSHOT_CHUNK_SLOTS;
+        int count = snapshotSlots - first < SNAPSHOT_CHUNK_SLOTS ? snapshotSlots - first : SNAPSHOT_CHUNK_SLOTS;
+        pthread_mutex_lock(&snapshotLock);
+        ok = atomic_load_explicit(&snapshotActive, memory_order_relaxed);
+        if(ok) {
+            memcpy(chunk, snapshotSaved[c] ? snapshotSaved[c] : storeSlotAt(first), (size_t)count * sizeof(StoreSlot));
+            free(snapshotSaved[c]);
+            snapshotSaved[c] = NULL;
+            snapshotCopied = c + 1;
+        }
+        pthread_mutex_unlock(&snapshotLock);
+        for(int i = 0; i < count && ok; i++) {
+            if(chunk[i].state != STORE_SLOT_USED || chunk[i].checksum != storeChecksum(&chunk[i].acc, sizeof(Account)))
+                continue;
+            ok = fwrite(&chunk[i].acc, sizeof(Account), 1, fp) == 1;
+            header.checksum = snapshotHash(header.checksum, &chunk[i].acc, sizeof(Account));
+            header.accounts++;
+        }
+    }
+    pthread_mutex_lock(&snapshotLock);
+    atomic_store_explicit(&snapshotActive, 0, memory_order_release);
+    for(int c = 0; c < chunks; c++)
+        free(snapshotSaved[c]);
+    free(snapshotSaved);
+    snapshotSaved = NULL;
+    pthread_mutex_unlock(&snapshotLock);
+    snapshotResult.copyMicros = nowMicros() - started;
+    
+    // Tombstones: those of the previous snapshot, then every deletion logged since it was taken
+    FILE *old = fopen(SNAPSHOT_FILE, "rb");
+    if(old != NULL && snapshotReadHeader(old, &previous) &&
+       fseek(old, (long)(sizeof(SnapshotHeader) + (size_t)previous.accounts * sizeof(Account)), SEEK_SET) == 0) {
+        SnapshotTombstone t;
+        header.previousAt = previous.takenAt;
+        for(int i = 0; i < previous.tombstones && ok; i++) {
+            if(fread(&t, sizeof(t), 1, old) != 1)
+                break;
+            ok = fwrite(&t, sizeof(t), 1, fp) == 1;
+            header.checksum = snapshotHash(header.checksum, &t, sizeof(t));
+            header.tombstones++;
+        }
+    }
+    if(old != NULL)
+        fclose(old);
+    // Deletions the log failed to write cannot become tombstones, so the snapshot is abandoned
+    ok = logWaitWritten(snapshotAt) && ok;
+    logQuery(0, header.previousAt ? header.previousAt + 1 : LLONG_MIN, snapshotAt, 1,
+             snapshotCollectDelete, &deleted, &stats);
+    for(long i = 0; i < deleted.count && ok; i++) {
+        SnapshotTombstone t = { deleted.records[i].account[0], 0, deleted.records[i].timestamp };
+        ok = fwrite(&t, sizeof(t), 1, fp) == 1;
+        header.checksum = snapshotHash(header.checksum, &t, sizeof(t));
+        header.tombstones++;
+    }
+    free(deleted.records);
+    
+    // The finished file replaces the previous snapshot in one rename
+    if(fp != NULL) {
+        ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fflush(fp) == 0 && syncFd(fileno(fp));
+        ok = (fclose(fp) == 0) && ok;
+    }
+    #ifdef _WIN32
+        if(ok) remove(SNAPSHOT_FILE);
+    #endif
+    ok = ok && rename(SNAPSHOT_TEMP_FILE, SNAPSHOT_FILE) == 0;
+    if(!ok)
+        remove(SNAPSHOT_TEMP_FILE);
+    free(chunk);
+    
+    snapshotResult.ok = ok;
+    snapshotResult.accounts = header.accounts;
+    snapshotResult.tombstones = header.tombstones;
+    snapshotResult.bytes = (long long)sizeof(header) + (long long)header.accounts * sizeof(Account) +
+                           (long long)header.tombstones * sizeof(SnapshotTombstone);
+    if(ok) {
+        char text[28];
+        snapshotResult.segmentsRemoved = snapshotCompact(snapshotAt);
+        snprintf(text, sizeof(text), "snapshot %d accounts", header.accounts);
+        logTransaction(text);
+    }
+    snapshotResult.micros = nowMicros() - started;
+    atomic_store_explicit(&snapshotDone, 1, memory_order_release);
+    return NULL;
+}
+
+// Removes the oldest log segments while every record in them is at or before takenAt; the newest
+// segment, which the flusher appends to, always stays. Returns the number of segments removed.
+int snapshotCompact(long long takenAt) {
+    unsigned int first, last;
+    char path[64];
+    int removed = 0;
+    
+    if(logListSegments(&first, &last) < 2)
+        return 0;
+    for(unsigned int segment = first; segment < last; segment++) {
+        struct stat st;
+        LogIndexHeader header;
+        FILE *ix;
+        
+        // Only a sealed segment whose index covers all of it is known to end before takenAt
+        logSegmentPath(path, sizeof(path), segment, "bin");
+        if(stat(path, &st) != 0)
+            continue;
+        logSegmentPath(path, sizeof(path), segment, "idx");
+        if((ix = fopen(path, "rb")) == NULL)
+            break;
+        int covered = logIndexReadHeader(ix, &header, (unsigned long long)st.st_size / sizeof(LogRecord)) &&
+                      header.records == (unsigned long long)st.st_size / sizeof(LogRecord) && header.maxTime <= takenAt;
+        fclose(ix);
+        if(!covered)
+            break;
+        logSegmentPath(path, sizeof(path), segment, "bin");
+        if(remove(path) != 0)
+            break;
+        logSegmentPath(path, sizeof(path), segment, "idx");
+        remove(path);
+        removed++;
+    }
+    return removed;
+}
+
+// Waits for the snapshot writer at exit so the file is never left half written; for atexit()
+void snapshotFinishAtExit() {
+    snapshotFinish();
+}
+
+// Takes the snapshot point and starts the writer; the caller must be between operations, with every
+// accepted change already in the data file. Returns 0 if a snapshot is still being written.
+int snapshotStart() {
+    static int exitHook = 0;
+    int chunks = (storeSlotCount + SNAPSHOT_CHUNK_SLOTS - 1) / SNAPSHOT_CHUNK_SLOTS;
+    
+    if(snapshotRunning)
+        return 0;
+    StoreSlot **saved = (StoreSlot**)calloc(chunks + 1, sizeof(StoreSlot*));
+    if(saved == NULL)
+        return 0;
+    pthread_mutex_lock(&snapshotLock);
+    snapshotSaved = saved;
+    snapshotSlots = storeSlotCount;
+    snapshotCopied = 0;
+    snapshotAt = nowNanos();
+    snapshotTotals = storeTotals;
+    memset(&snapshotResult, 0, sizeof(snapshotResult));
+    atomic_store_explicit(&snapshotDone, 0, memory_order_relaxed);
+    atomic_store_explicit(&snapshotActive, 1, memory_order_release);
+    pthread_mutex_unlock(&snapshotLock);
+    
+    if(pthread_create(&snapshotThread, NULL, snapshotWriter, NULL) != 0) {
+        atomic_store_explicit(&snapshotActive, 0, memory_order_release);
+        free(snapshotSaved);
+        snapshotSaved = NULL;
+        return 0;
+    }
+    snapshotRunning = 1;
+    if(!exitHook) {
+        atexit(snapshotFinishAtExit);
+        exitHook = 1;
+    }
+    return 1;
+}
+
+// Waits for a running writer to finish; returns 1 if it wrote its snapshot
+int snapshotFinish() {
+    if(!snapshotRunning)
+        return 0;
+    pthread_join(snapshotThread, NULL);
+    snapshotRunning = 0;
+    return snapshotResult.ok;
+}
+
+// Called between operations by the menu and the server: joins a writer that has finished and starts
+// a new snapshot every SNAPSHOT_INTERVAL seconds (BANK_SNAPSHOT_SECONDS overrides, 0 disables)
+void snapshotTick() {
+    static long long interval = -1;
+    long long now = nowMicros();
+    
+    if(interval < 0) {
+        const char *env = getenv("BANK_SNAPSHOT_SECONDS");
+        interval = (env != NULL ? atoll(env) : SNAPSHOT_INTERVAL) * 1000000LL;
+        snapshotDueAt = now + interval;
+    }
+    if(snapshotRunning && atomic_load_explicit(&snapshotDone, memory_order_acquire))
+        snapshotFinish();
+    if(interval > 0 && !snapshotRunning && now >= snapshotDueAt) {
+        snapshotStart();
+        snapshotDueAt = now + interval;
+    }
+}
+
+// Writes a snapshot now, in the background as usual, and reports what it and the compaction did
+int runSnapshot() {
+    unsigned int first, last;
+    int before = logListSegments(&first, &last);
+    
+    if(!snapshotStart() || !snapshotFinish()) {
+        printf("Error: Unable to write snapshot %s!\n", SNAPSHOT_FILE);
+        return 0;
+    }
+    printf("Snapshot written to %s in %.1f ms\n", SNAPSHOT_FILE, snapshotResult.micros / 1000.0);
+    printf("  Accounts     : %d (copied in %.1f ms)\n", snapshotResult.accounts, snapshotResult.copyMicros / 1000.0);
+    printf("  Tombstones   : %d deleted accounts\n", snapshotResult.tombstones);
+    printf("  File size    : %.1f KB\n", snapshotResult.bytes / 1024.0);
+    printf("  Log segments : %d compacted, %d kept\n", snapshotResult.segmentsRemoved,
+           before - snapshotResult.segmentsRemoved);
+    return 1;
+}
+
+// Monotonic clock in microseconds, used to bound how long a commit group may stay open
+long long nowMicros() {
+    #ifdef _WIN32
+        return (long long)clock() * 1000000 / CLOCKS_PER_SEC;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    #endif
+}
+
+// Monotonic clock in nanoseconds, used for latency measurements
+long long monotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Forces file data to stable storage; metadata-only updates are skipped where the OS allows it
+int syncFd(int fd) {
+    #if defined(_WIN32)
+        return _commit(fd) == 0;
+    #elif defined(__APPLE__)
+        return fsync(fd) == 0;
+    #else
+        return fdatasync(fd) == 0;
+    #endif
+}
+
+// Creates path afresh with mode 0600, like the data file and the journal, and opens it for binary
+// writing; an older file is removed first, since opening it would keep its permissions
+FILE* fileCreatePrivate(const char *path) {
+    FILE *fp = NULL;
+    
+    remove(path);
+    #ifdef _WIN32
+        int fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0600);
+        if(fd >= 0 && (fp = _fdopen(fd, "wb")) == NULL)
+            _close(fd);
+    #else
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if(fd >= 0 && (fp = fdopen(fd, "wb")) == NULL)
+            close(fd);
+    #endif
+    return fp;
+}
+
+// Sequential read/write wrappers over the platform's unbuffered file API
+long rawRead(int fd, void *buf, size_t len) {
+    #ifdef _WIN32
+        return _read(fd, buf, (unsigned int)len);
+    #else
+        return (long)read(fd, buf, len);
+    #endif
+}
+
+long rawWrite(int fd, const void *buf, size_t len) {
+    long n;
+    #ifdef _WIN32
+        n = _write(fd, buf, (unsigned int)len);
+    #else
+        n = (long)write(fd, buf, len);
+    #endif
+    if(n > 0)
+        atomic_fetch_add_explicit(&ioBytesWritten, n, memory_order_relaxed);
+    return n;
+}
+
+// Performs one request on the calling thread: the whole write, then the optional data sync
+long ioWriteAll(IoRequest *req) {
+    size_t done = 0;
+    
+    while(done < req->len) {
+        long n;
+        #ifdef _WIN32
+            // Windows has no pwrite; seek and write as one step so pool threads cannot interleave
+            static pthread_mutex_t seekLock = PTHREAD_MUTEX_INITIALIZER;
+            pthread_mutex_lock(&seekLock);
+            if(req->offset >= 0)
+                _lseeki64(req->fd, req->offset + (long long)done, SEEK_SET);
+            n = _write(req->fd, (const char*)req->buf + done, (unsigned int)(req->len - done));
+            pthread_mutex_unlock(&seekLock);
+        #else
+            if(req->offset >= 0)
+                n = (long)pwrite(req->fd, (const char*)req->buf + done, req->len - done, (off_t)(req->offset + done));
+            else
+                n = (long)write(req->fd, (const char*)req->buf + done, req->len - done);
+        #endif
+        if(n <= 0)
+            return -1;
+        done += (size_t)n;
+    }
+    if(req->sync && !syncFd(req->fd))
+        return -1;
+    return (long)done;
+}
+
+// Records a request's result and wakes whoever waits for it
+void ioFinish(IoRequest *req, long result) {
+    if(result > 0)
+        atomic_fetch_add_explicit(&ioBytesWritten, result, memory_order_relaxed);
+    pthread_mutex_lock(&ioLock);
+    req->result = result;
+    req->done = 1;
+    ioInFlight--;
+    pthread_cond_broadcast(&ioCond);
+    pthread_mutex_unlock(&ioLock);
+}
+
+// Thread pool backend: each worker takes the oldest queued request and performs it
+void* ioWorker(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&ioLock);
+    for(;;) {
+        while(ioQueueHead == ioQueueTail && !ioStopping)
+            pthread_cond_wait(&ioCond, &ioLock);
+        if(ioQueueHead == ioQueueTail)
+            break;
+        IoRequest *req = ioQueue[ioQueueHead++ % IO_MAX_IN_FLIGHT];
+        pthread_mutex_unlock(&ioLock);
+        ioFinish(req, ioWriteAll(req));
+        pthread_mutex_lock(&ioLock);
+    }
+    pthread_mutex_unlock(&ioLock);
+    return NULL;
+}
+
+#ifdef BANK_HAVE_URING
+// Places one submission entry in the ring; the caller publishes the new tail
+// Caller must hold ioLock
+struct io_uring_sqe* ioUringEntry(unsigned int *tail) {
+    unsigned int index = *tail & *ioSqMask;
+    struct io_uring_sqe *sqe = &ioSqes[index];
+    
+    memset(sqe, 0, sizeof(*sqe));
+    ioSqArray[index] = index;
+    (*tail)++;
+    return sqe;
+}
+
+// Queues a write, linked to a data sync when asked for, and tells the kernel in one system call
+// The low bit of user_data marks the write half of a synced request; only the last entry completes it
+// Caller must hold ioLock
+int ioUringSubmit(IoRequest *req) {
+    unsigned int tail = *ioSqTail;
+    int entries = req->sync ? 2 : 1;
+    struct io_uring_sqe *sqe = ioUringEntry(&tail);
+    
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = req->fd;
+    sqe->addr = (unsigned long long)(uintptr_t)req->buf;
+    sqe->len = (unsigned int)req->len;
+    sqe->off = (unsigned long long)req->offset;
+    sqe->user_data = (unsigned long long)(uintptr_t)req | (req->sync ? 1 : 0);
+    if(req->sync) {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = ioUringEntry(&tail);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = req->fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = (unsigned long long)(uintptr_t)req;
+    }
+    __atomic_store_n(ioSqTail, tail, __ATOMIC_RELEASE);
+    return syscall(__NR_io_uring_enter, ioRingFd, entries, 0, 0, NULL, 0) == entries;
+}
+
+// io_uring backend: one thread waits for completions and finishes their requests
+// A completion with user_data 0 is the stop marker queued by ioShutdown()
+void* ioUringReaper(void *arg) {
+    (void)arg;
+    
+    for(;;) {
+        unsigned int head = *ioCqHead;
+        if(head == __atomic_load_n(ioCqTail, __ATOMIC_ACQUIRE)) {
+            syscall(__NR_io_uring_enter, ioRingFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            continue;
+        }
+        struct io_uring_cqe *cqe = &ioCqes[head & *ioCqMask];
+        unsigned long long data = cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(ioCqHead, head + 1, __ATOMIC_RELEASE);
+    
+        if(data == 0)
+            break;
+        IoRequest *req = (IoRequest*)(uintptr_t)(data & ~1ull);
+        if(data & 1) {
+            // Write half of a synced request: keep its result until the linked sync completes
+            req->result = (res == (int)req->len) ? res : -1;
+            continue;
+        }
+        if(req->sync)
+            ioFinish(req, res < 0 ? -1 : req->result);
+        else
+            ioFinish(req, res == (int)req->len ? res : -1);
+    }
+    return NULL;
+}
+
+// Creates the ring and maps its three shared regions; fails on kernels without IORING_OP_WRITE
+int ioUringSetup() {
+    struct io_uring_params params;
+    size_t sqBytes, cqBytes;
+    char *sq, *cq;
+    
+    memset(&params, 0, sizeof(params));
+    ioRingFd = (int)syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &params);
+    if(ioRingFd < 0)
+        return 0;
+    // IORING_FEAT_RW_CUR_POS arrived with IORING_OP_WRITE (Linux 5.6), which this backend needs
+    if(!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ioRingFd);
+        ioRingFd = -1;
+        return 0;
+    }
+    
+    sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(cqBytes > sqBytes)
+            sqBytes = cqBytes;
+    }
+    sq = (char*)mmap(NULL, sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ioRingFd, IORING_OFF_SQ_RING);
+    cq = sq;
+    if(sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        cq = (char*)mmap(NULL, cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ioRingFd, IORING_OFF_CQ_RING);
+    ioSqes = (struct io_uring_sqe*)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ioRingFd, IORING_OFF_SQES);
+    if(sq == MAP_FAILED || cq == MAP_FAILED || ioSqes == MAP_FAILED) {
+        close(ioRingFd);
+        ioRingFd = -1;
+        return 0;
+    }
+    
+    ioSqTail = (unsigned int*)(sq + params.sq_off.tail);
+    ioSqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ioSqArray = (unsigned int*)(sq + params.sq_off.array);
+    ioCqHead = (unsigned int*)(cq + params.cq_off.head);
+    ioCqTail = (unsigned int*)(cq + params.cq_off.tail);
+    ioCqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ioCqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    
+    if(pthread_create(&ioThreads[0], NULL, ioUringReaper, NULL) != 0) {
+        close(ioRingFd);
+        ioRingFd = -1;
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+// Starts the I/O backend: io_uring where the kernel offers it, otherwise the writer thread pool
+// BANK_IO=threads forces the pool
+int ioInit() {
+    const char *choice = getenv("BANK_IO");
+    
+    if(ioRunning)
+        return 1;
+    ioBackend = IO_BACKEND_THREADS;
+    #ifdef BANK_HAVE_URING
+        if((choice == NULL || strcmp(choice, "threads") != 0) && ioUringSetup())
+            ioBackend = IO_BACKEND_URING;
+    #else
+        (void)choice;
+    #endif
+    if(ioBackend == IO_BACKEND_THREADS) {
+        for(int i = 0; i < IO_POOL_THREADS; i++)
+            if(pthread_create(&ioThreads[i], NULL, ioWorker, NULL) != 0)
+                return 0;
+    }
+    ioStopping = 0;
+    ioRunning = 1;
+    atexit(ioShutdown);
+    return 1;
+}
+
+// Name of the backend in use, for reports
+const char* ioBackendName() {
+    if(!ioRunning)
+        return "synchronous";
+    return ioBackend == IO_BACKEND_URING ? "io_uring" : "thread pool";
+}
+
+// Queues a request and returns at once; before ioInit() the write is done on the spot instead
+// Blocks only when IO_MAX_IN_FLIGHT requests are already outstanding
+int ioSubmit(IoRequest *req) {
+    int ok = 1;
+    
+    req->done = 0;
+    req->result = 0;
+    if(!ioRunning) {
+        req->result = ioWriteAll(req);
+        if(req->result > 0)
+            atomic_fetch_add_explicit(&ioBytesWritten, req->result, memory_order_relaxed);
+        req->done = 1;
+        return 1;
+    }
+    
+    pthread_mutex_lock(&ioLock);
+    while(ioInFlight >= IO_MAX_IN_FLIGHT)
+        pthread_cond_wait(&ioCond, &ioLock);
+    ioInFlight++;
+    #ifdef BANK_HAVE_URING
+        if(ioBackend == IO_BACKEND_URING)
+            ok = ioUringSubmit(req);
+    #endif
+    if(ioBackend == IO_BACKEND_THREADS) {
+        ioQueue[ioQueueTail++ % IO_MAX_IN_FLIGHT] = req;
+        pthread_cond_broadcast(&ioCond);
+    }
+    if(!ok)
+        ioInFlight--;
+    pthread_mutex_unlock(&ioLock);
+    return ok;
+}
+
+// Waits until a submitted request has completed; returns bytes written, or -1 on failure
+long ioWait(IoRequest *req) {
+    pthread_mutex_lock(&ioLock);
+    while(!req->done)
+        pthread_cond_wait(&ioCond, &ioLock);
+    pthread_mutex_unlock(&ioLock);
+    return req->result;
+}
+
+// Lets every outstanding request finish, then stops the backend threads; registered with atexit()
+void ioShutdown() {
+    if(!ioRunning)
+        return;
+    pthread_mutex_lock(&ioLock);
+    while(ioInFlight > 0)
+        pthread_cond_wait(&ioCond, &ioLock);
+    ioStopping = 1;
+    pthread_cond_broadcast(&ioCond);
+    #ifdef BANK_HAVE_URING
+        if(ioBackend == IO_BACKEND_URING) {
+            // The reaper sleeps in the kernel; a no-op with user_data 0 wakes it and tells it to stop
+            unsigned int tail = *ioSqTail;
+            ioUringEntry(&tail)->opcode = IORING_OP_NOP;
+            __atomic_store_n(ioSqTail, tail, __ATOMIC_RELEASE);
+            syscall(__NR_io_uring_enter, ioRingFd, 1, 0, 0, NULL, 0);
+        }
+    #endif
+    pthread_mutex_unlock(&ioLock);
+    
+    for(int i = 0; i < (ioBackend == IO_BACKEND_URING ? 1 : IO_POOL_THREADS); i++)
+        pthread_join(ioThreads[i], NULL);
+    #ifdef BANK_HAVE_URING
+        if(ioBackend == IO_BACKEND_URING) {
+            close(ioRingFd);
+            ioRingFd = -1;
+        }
+    #endif
+    ioRunning = 0;
+}
+
+// Waits for a submitted commit group to reach the disk; a failure poisons the journal for good
+// Caller must hold journalLock
+int journalReap(JournalGroup *group) {
+    if(group->inFlight) {
+        long written = ioWait(&group->io);
+        METRIC_STOP(METRIC_JOURNAL_SYNC, group->submitted);
+        group->inFlight = 0;
+        if(written != (long)group->io.len)
+            journalFailed = 1;
+    }
+    return !journalFailed;
+}
+
+// Hands the open commit group to the I/O layer as one write plus one data sync and moves on to
+// the next group buffer; only waits when every buffer is still on its way to disk
+// Caller must hold journalLock
+int journalSubmitGroup() {
+    JournalGroup *group = &journalGroups[journalCurrent];
+    size_t len = (size_t)journalPending * sizeof(JournalRecord);
+    
+    if(journalPending == 0)
+        return !journalFailed;
+    group->io.fd = journalFd;
+    group->io.buf = group->records;
+    group->io.len = len;
+    group->io.offset = journalBytes;
+    group->io.sync = 1;
+    
+    // Fault injection: leave a torn group behind, as a crash in the middle of write() would
+    if(crashAt == CRASH_JOURNAL_TORN) {
+        group->io.len = len / 2;
+        group->io.sync = 0;
+        if(ioSubmit(&group->io))
+            ioWait(&group->io);
+        crashPoint(CRASH_JOURNAL_TORN);
+    }
+    group->submitted = monotonicNanos();
+    if(!ioSubmit(&group->io))
+        return 0;
+    group->inFlight = 1;
+    journalBytes += (long long)len;
+    journalPending = 0;
+    journalCurrent = (journalCurrent + 1) % JOURNAL_IO_GROUPS;
+    return journalReap(&journalGroups[journalCurrent]);
+}
+
+// Waits for every submitted group, oldest first; a group only counts once all before it are durable
+// Caller must hold journalLock
+int journalWaitAll() {
+    int ok = 1;
+    for(int i = 1; i <= JOURNAL_IO_GROUPS; i++)
+        ok = journalReap(&journalGroups[(journalCurrent + i) % JOURNAL_IO_GROUPS]) && ok;
+    return ok;
+}
+
+// Adds a finished record to the current commit group; the group is submitted once it holds
+// journalGroupRecords records or has been open for journalGroupUsec microseconds
+// Caller must hold journalLock
+int journalAdd(const JournalRecord *rec, long long now) {
+    memcpy(&journalGroups[journalCurrent].records[journalPending], rec, sizeof(JournalRecord));
+    journalFees += rec->fee;
+    storeTotals.feesCollected += rec->fee;
+    
+    if(journalPending == 0)
+        journalGroupStart = now;
+    journalPending++;
+    if(journalPending >= journalGroupRecords || now - journalGroupStart >= journalGroupUsec)
+        return journalSubmitGroup();
+    return 1;
+}
+
+// Journals one mutation. On a thread with a journal stage the record waits there for journalMerge()
+// and no lock is taken; otherwise it goes straight into the current commit group.
+// Submission does not wait for the disk, so engine threads only block in journalCommit()
+int journalAppend(int type, Account *a, Account *b, Money amount, Money fee) {
+    JournalStage *stage = journalStage;
+    JournalRecord rec;
+    long long now = nowMicros();
+    
+    if(journalFd < 0)
+        return 0;
+    
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = JOURNAL_MAGIC;
+    rec.type = (unsigned int)type;
+    rec.account[0] = a->accountNumber;
+    rec.balance[0] = a->balance;
+    if(b != NULL) {
+        rec.account[1] = b->accountNumber;
+        rec.balance[1] = b->balance;
+    }
+    rec.amount = amount;
+    rec.fee = fee;
+    
+    if(stage != NULL) {
+        if(stage->count == stage->capacity) {
+            int capacity = stage->capacity ? stage->capacity * 2 : JOURNAL_GROUP_RECORDS;
+            JournalRecord *records = (JournalRecord*)realloc(stage->records, capacity * sizeof(JournalRecord));
+            if(records == NULL) {
+                stage->failed = 1;
+                return 0;
+            }
+            stage->records = records;
+            stage->capacity = capacity;
+        }
+        // Callers hold the rows' stripe locks, so the numbers of one account's records follow the
+        // order its balance changed in, and journalMerge() can interleave the stages by them
+        rec.seq = atomic_fetch_add_explicit(&journalSeq, 1, memory_order_relaxed) + 1;
+        rec.checksum = storeChecksum(&rec, offsetof(JournalRecord, checksum));
+        memcpy(&stage->records[stage->count++], &rec, sizeof(JournalRecord));
+        return 1;
+    }
+    
+    pthread_mutex_lock(&journalLock);
+    rec.seq = atomic_fetch_add_explicit(&journalSeq, 1, memory_order_relaxed) + 1;
+    rec.checksum = storeChecksum(&rec, offsetof(JournalRecord, checksum));
+    int ok = journalAdd(&rec, now);
+    pthread_mutex_unlock(&journalLock);
+    return ok;
+}
+
+// Moves the records of several stages into the commit group in sequence order and empties them
+// Each stage is already in order, so this merges sorted runs; no thread may append to them meanwhile
+int journalMerge(JournalStage **stages, int count) {
+    long long now = nowMicros();
+    int ok = 1;
+    
+    pthread_mutex_lock(&journalLock);
+    // A stage that dropped a record fails the journal like a failed write would
+    for(int i = 0; i < count; i++)
+        if(stages[i]->failed)
+            journalFailed = 1;
+    ok = !journalFailed;
+    while(ok) {
+        JournalStage *next = NULL;
+        for(int i = 0; i < count; i++) {
+            JournalStage *stage = stages[i];
+            if(stage->merged < stage->count &&
+               (next == NULL || stage->records[stage->merged].seq < next->records[next->merged].seq))
+                next = stage;
+        }
+        if(next == NULL)
+            break;
+        ok = journalAdd(&next->records[next->merged++], now);
+    }
+    for(int i = 0; i < count; i++)
+        stages[i]->count = stages[i]->merged = 0;
+    pthread_mutex_unlock(&journalLock);
+    return ok;
+}
+
+// Submits whatever the open commit group holds and waits until every group is durable
+int journalFlush() {
+    pthread_mutex_lock(&journalLock);
+    int ok = journalSubmitGroup();
+    ok = journalWaitAll() && ok;
+    pthread_mutex_unlock(&journalLock);
+    return ok;
+}
+
+// Closes the current commit group immediately; used when an operator is waiting on the result
+int journalCommit() {
+    return journalFlush();
+}
+
+// Rewrites the balance stored in an account's slot; the journal already holds the change
+int journalApplyBalance(int num, Money balance) {
+    int index = indexLookup(num);
+    StoreSlot *slot;
+    
+    if(index < 0 || index >= storeSlotCount)
+        return 0;
+    // Update the balance where it lives in the mapping; only the checksum is recomputed
+    slot = storeSlotAt(index);
+    if(slot->state != STORE_SLOT_USED)
+        return 0;
+    METRIC_START(started);
+    snapshotPreserve(index);
+    slot->acc.balance = balance;
+    int ok = storeSlotChanged(index);
+    METRIC_STOP(METRIC_SLOT_WRITE, started);
+    return ok;
+}
+
+// Makes the data file durable and empties the journal, since every record is now reflected there
+int journalCheckpoint() {
+    if(journalFd < 0 || !journalFlush())
+        return 0;
+    // Fold every journaled fee into the header; records up to checkpointSeq are skipped by
+    // recovery, so a crash before the journal is truncated cannot count a fee twice
+    pthread_mutex_lock(&journalLock);
+    storeCheckpointSeq = journalSeq;
+    journalFees = 0;
+    pthread_mutex_unlock(&journalLock);
+    if(!storeWriteHeader() || !storeSync())
+        return 0;
+    if(journalBytes > 0)
+        crashPoint(CRASH_CHECKPOINT_SYNCED);
+    #ifdef _WIN32
+        if(_chsize(journalFd, 0) != 0) return 0;
+        _lseek(journalFd, 0, SEEK_SET);
+    #else
+        if(ftruncate(journalFd, 0) != 0) return 0;
+        lseek(journalFd, 0, SEEK_SET);
+    #endif
+    journalBytes = 0;
+    return syncFd(journalFd);
+}
+
+// Keep the journal short so recovery time stays bounded
+int journalMaybeCheckpoint() {
+    if(journalBytes >= JOURNAL_CHECKPOINT_BYTES)
+        return journalCheckpoint();
+    return 1;
+}
+
+// Replays a journal left by a crash of a version that kept float ringgit. Balances are rounded to
+// the sen like version 1 data files; fees are not counted, as those versions kept no fee total.
+// Returns the number of records replayed.
+int journalRecoverV1() {
+    JournalRecordV1 rec;
+    int replayed = 0;
+    
+    while(rawRead(journalFd, &rec, sizeof(rec)) == (long)sizeof(rec)) {
+        if(rec.magic != JOURNAL_MAGIC_V1 ||
+           rec.checksum != storeChecksum(&rec, offsetof(JournalRecordV1, checksum)))
+            break;
+        journalApplyBalance(rec.account[0], moneyFromRinggit(rec.balance[0]));
+        if(rec.type == JOURNAL_TRANSFER)
+            journalApplyBalance(rec.account[1], moneyFromRinggit(rec.balance[1]));
+        replayed++;
+    }
+    return replayed;
+}
+
+// Opens the journal and replays every intact record into the data file
+// Records carry after-image balances, so replaying one twice is harmless
+int journalRecover() {
+    JournalRecord rec;
+    int replayed = 0;
+    
+    #ifdef _WIN32
+        journalFd = _open(JOURNAL_FILE, _O_RDWR | _O_CREAT | _O_BINARY, 0600);
+    #else
+        journalFd = open(JOURNAL_FILE, O_RDWR | O_CREAT, 0600);
+    #endif
+    if(journalFd < 0)
+        return 0;
+    
+    // A journal of the float ringgit versions has its own record layout; the data file it belongs to
+    // has already been converted by storeUpgrade(), so its balances are replayed as sen
+    int older = rawRead(journalFd, &rec.magic, sizeof(rec.magic)) == (long)sizeof(rec.magic) &&
+                rec.magic == JOURNAL_MAGIC_V1;
+    #ifdef _WIN32
+        _lseek(journalFd, 0, SEEK_SET);
+    #else
+        lseek(journalFd, 0, SEEK_SET);
+    #endif
+    
+    // Sequence numbers carry on from the last checkpoint so they stay comparable with the header
+    journalSeq = storeCheckpointSeq;
+    if(older)
+        replayed = journalRecoverV1();
+    while(!older && rawRead(journalFd, &rec, sizeof(rec)) == (long)sizeof(rec)) {
+        // A torn or partially written tail marks the end of what was committed
+        if(rec.magic != JOURNAL_MAGIC ||
+           rec.checksum != storeChecksum(&rec, offsetof(JournalRecord, checksum)))
+            break;
+    
+        journalApplyBalance(rec.account[0], rec.balance[0]);
+        if(rec.type == JOURNAL_TRANSFER)
+            journalApplyBalance(rec.account[1], rec.balance[1]);
+        // Only fees the header does not hold yet; balances are after-images and need no such check
+        if(rec.seq > storeCheckpointSeq) {
+            journalFees += rec.fee;
+            storeTotals.feesCollected += rec.fee;
+        }
+        if(rec.seq > journalSeq)
+            journalSeq = rec.seq;
+        replayed++;
+    }
+    
+    if(replayed > 0) {
+        logEvent(LOG_RECOVERY, replayed, 0, 0, 0, NULL);
+        crashPoint(CRASH_RECOVERY_REPLAYED);
+    }
+    return journalCheckpoint();
+}
+
+// Journals a balance change for one or two accounts, commits it, then updates their slots
+// Both new balances travel in one checksummed journal record, so a crash before the record is
+// synced loses the whole change and a crash after it is finished by journalRecover() on restart
+int postTransaction(int type, Account *a, Account *b, Money amount, Money fee) {
+    METRIC_START(started);
+    crashPoint(CRASH_BEFORE_JOURNAL);
+    if(!journalAppend(type, a, b, amount, fee) || !journalCommit())
+        return 0;
+    crashPoint(CRASH_JOURNAL_SYNCED);
+    if(!journalApplyBalance(a->accountNumber, a->balance))
+        return 0;
+    crashPoint(CRASH_SENDER_APPLIED);
+    if(b != NULL && !journalApplyBalance(b->accountNumber, b->balance))
+        return 0;
+    crashPoint(CRASH_APPLIED);
+    
+    journalMaybeCheckpoint();
+    METRIC_STOP(METRIC_POST, started);
+    METRIC_TRANSACTION(type);
+    return 1;
+}
+
+// Business rules shared by the interactive menu and batch mode
+
+// Percentage fee charged on a remittance between the two account types
+int remittanceFeePercent(Account *from, Account *to) {
+    if(strcmp(from->accountType, "Savings") == 0 && strcmp(to->accountType, "Current") == 0)
+        return 2;   // Savings → Current incurs 2% fee per business rules
+    if(strcmp(from->accountType, "Current") == 0 && strcmp(to->accountType, "Savings") == 0)
+        return 3;   // Current → Savings incurs a slightly higher 3% fee
+    return 0;       // Same-type transfers are free
+}
+
+// Fee charged to the sender on top of the transferred amount, rounded half up to the sen
+Money remittanceFee(Account *from, Account *to, Money amount) {
+    return (amount * remittanceFeePercent(from, to) + 50) / 100;
+}
+
+// Validates a deposit; returns TXN_OK or the reason it must be rejected
+int checkDeposit(Account *acc, Money amount) {
+    if(acc == NULL) return TXN_NOT_FOUND;
+    if(acc->status == 1) return TXN_CLOSED;
+    if(amount <= 0) return TXN_BAD_AMOUNT;
+    if(amount > MAX_DEPOSIT_AMOUNT) return TXN_OVER_LIMIT;
+    return TXN_OK;
+}
+
+// Validates a withdrawal, refusing anything that would overdraw the account
+int checkWithdraw(Account *acc, Money amount) {
+    if(acc == NULL) return TXN_NOT_FOUND;
+    if(acc->status == 1) return TXN_CLOSED;
+    if(amount <= 0) return TXN_BAD_AMOUNT;
+    if(amount > acc->balance) return TXN_NO_FUNDS;
+    return TXN_OK;
+}
+
+// Validates a remittance including the fee the sender will pay
+int checkRemittance(Account *from, Account *to, Money amount, Money fee) {
+    if(from == NULL || to == NULL) return TXN_NOT_FOUND;
+    if(from->accountNumber == to->accountNumber) return TXN_SAME_ACCOUNT;
+    if(from->status == 1 || to->status == 1) return TXN_CLOSED;
+    if(amount <= 0) return TXN_BAD_AMOUNT;
+    if(from->balance < amount + fee) return TXN_NO_FUNDS;
+    return TXN_OK;
+}
+
+// Short reason codes written to the batch results file
+const char* txnResultText(int result) {
+    switch(result) {
+        case TXN_OK:           return "OK";
+        case TXN_NOT_FOUND:    return "REJECT,account not found";
+        case TXN_CLOSED:       return "REJECT,account closed";
+        case TXN_BAD_AMOUNT:   return "REJECT,invalid amount";
+        case TXN_OVER_LIMIT:   return "REJECT,exceeds RM50000 deposit limit";
+        case TXN_NO_FUNDS:     return "REJECT,insufficient funds";
+        case TXN_SAME_ACCOUNT: return "REJECT,sender and receiver are the same";
+        case TXN_BAD_PIN:      return "REJECT,wrong PIN";
+        case TXN_BAD_ID:       return "REJECT,ID verification failed";
+        case TXN_NO_NUMBERS:   return "REJECT,no account numbers left";
+        case TXN_LOCKED:       return "REJECT,account locked";
+        default:               return "REJECT,malformed line";
+    }
+}
+
+// Loads every slot of the data file into memory for batch processing
+// The rows are a private copy of the mapping so no balance reaches the file before its journal record
+int tableLoad() {
+    tableRows = (StoreSlot*)calloc(storeSlotCount ? storeSlotCount : 1, sizeof(StoreSlot));
+    tableDirty = (unsigned char*)calloc(storeSlotCount ? storeSlotCount : 1, 1);
+    if(tableRows == NULL || tableDirty == NULL || !viewReserve(0, storeSlotCount ? storeSlotCount : 1))
+        return 0;
+    tableRowCount = storeSlotCount;
+    tableRowCapacity = storeSlotCount ? storeSlotCount : 1;
+    memcpy(tableRows, storeSlots, (size_t)storeSlotCount * sizeof(StoreSlot));
+    return 1;
+}
+
+// Finds a live account row by number through the hash index; NULL when absent
+Account* tableFind(int num) {
+    int slot = indexLookup(num);
+    if(slot < 0 || slot >= tableRowCount || tableRows[slot].state != STORE_SLOT_USED)
+        return NULL;
+    return &tableRows[slot].acc;
+}
+
+// Marks the row holding an account as needing write-back
+void tableTouch(Account *acc) {
+    tableDirty[(StoreSlot*)((char*)acc - offsetof(StoreSlot, acc)) - tableRows] = 1;
+}
+
+// Commits the journal, copies every changed row into the mapping, then checkpoints
+// The journal must be durable before any slot changes so a crash can always be replayed
+int tableWriteBack() {
+    if(!journalCommit())
+        return 0;
+    
+    for(int i = 0; i < tableRowCount; i++) {
+        if(!tableWriteRow(i))
+            return 0;
+    }
+    return journalCheckpoint();
+}
+
+// Copies one row into the mapping if it changed since its last write-back
+// The journal records of the change must already be durable. The checksum is stamped on the mapped
+// copy only, so the row itself changes solely through the engine and read views never see it move.
+int tableWriteRow(int slot) {
+    StoreSlot *row = &tableRows[slot];
+    StoreSlot *mapped = storeSlotAt(slot);
+    
+    if(!tableDirty[slot])
+        return 1;
+    snapshotPreserve(slot);
+    memcpy(mapped, row, sizeof(StoreSlot));
+    if(mapped->state == STORE_SLOT_USED)
+        mapped->checksum = storeChecksum(&mapped->acc, sizeof(Account));
+    atomic_fetch_add_explicit(&ioBytesWritten, STORE_SLOT_SIZE, memory_order_relaxed);
+    tableDirty[slot] = 0;
+    return columnsSet(slot, row);
+}
+
+// Replaces one row with what the mapping holds after an account was created or deleted there
+// The table grows in doublings, so a run of creates does not copy it every time
+// Growing moves the rows, so it waits until no read view is open
+int tableAdopt(int slot) {
+    if(slot >= tableRowCapacity) {
+        int capacity = tableRowCapacity ? tableRowCapacity : 1024, ok = 0;
+        while(capacity <= slot)
+            capacity *= 2;
+        pthread_mutex_lock(&viewLock);
+        while(viewReaders > 0)
+            pthread_cond_wait(&viewClosed, &viewLock);
+        StoreSlot *rows = (StoreSlot*)realloc(tableRows, (size_t)capacity * sizeof(StoreSlot));
+        if(rows != NULL) {
+            tableRows = rows;
+            unsigned char *dirty = (unsigned char*)realloc(tableDirty, capacity);
+            if(dirty != NULL) {
+                tableDirty = dirty;
+                memset(tableRows + tableRowCapacity, 0, (size_t)(capacity - tableRowCapacity) * sizeof(StoreSlot));
+                memset(tableDirty + tableRowCapacity, 0, capacity - tableRowCapacity);
+                ok = viewReserve(tableRowCapacity, capacity);
+            }
+        }
+        if(ok)
+            tableRowCapacity = capacity;
+        pthread_mutex_unlock(&viewLock);
+        if(!ok)
+            return 0;
+    }
+    // The row's stripe keeps a view from being taken between saving the row and replacing it
+    EngineStripe *stripe = &engineStripes[slot & (ENGINE_LOCK_STRIPES - 1)];
+    pthread_mutex_lock(&stripe->lock);
+    viewPreserve(slot);
+    memcpy(&tableRows[slot], storeSlotAt(slot), sizeof(StoreSlot));
+    pthread_mutex_unlock(&stripe->lock);
+    if(slot >= tableRowCount)
+        tableRowCount = slot + 1;
+    tableDirty[slot] = 0;
+    return 1;
+}
+
+// Frees the in-memory table and the state read views keep for it
+void tableFree() {
+    free(tableRows);
+    free(tableDirty);
+    free(tableBefore);
+    free(tableEpoch);
+    tableRows = NULL;
+    tableDirty = NULL;
+    tableBefore = NULL;
+    tableEpoch = NULL;
+    tableRowCount = 0;
+    tableRowCapacity = 0;
+}
+
+// Parses an unsigned decimal integer field and advances past it
+int parseAccountField(char **p, int *out) {
+    long value = 0;
+    int digits = 0;
+    while(**p == ' ') (*p)++;
+    while(isdigit((unsigned char)**p) && digits < 10) {
+        value = value * 10 + (**p - '0');
+        (*p)++;
+        digits++;
+    }
+    while(**p == ' ') (*p)++;
+    *out = (int)value;
+    return digits > 0 && value <= 999999999;
+}
+
+// Appends a money value with two decimals without going through printf
+char* formatMoney(char *out, Money value) {
+    long long cents = value;
+    char digits[24];
+    int n = 0;
+    
+    if(cents < 0) {
+        *out++ = '-';
+        cents = -cents;
+    }
+    do {
+        digits[n++] = (char)('0' + cents % 10);
+        cents /= 10;
+    } while(cents > 0 || n < 3);
+    while(n > 2)
+        *out++ = digits[--n];
+    *out++ = '.';
+    *out++ = digits[1];
+    *out++ = digits[0];
+    return out;
+}
+
+// Applies one CSV operation through the transaction engine and formats its result line
+// Accepted forms: deposit,<acct>,<amount>  withdraw,<acct>,<amount>  transfer,<from>,<to>,<amount>
+// (D, W and T work as short forms of the operation names)
+int batchApplyLine(char *line, char *out, int *outLen) {
+    char *p = line, *o = out;
+    char op = (char)tolower((unsigned char)*p);
+    int from = 0, to = 0, result = TXN_MALFORMED, transfer = 0;
+    Money amount = 0, fee = 0, balanceA = 0, balanceB = 0;
+    
+    // Skip the operation word and its comma
+    while(*p && *p != ',') p++;
+    if(*p == ',') p++;
+    
+    if((op == 'd' || op == 'w') && parseAccountField(&p, &from) && *p == ',') {
+        p++;
+        if(!parseMoney(p, &amount))
+            amount = 0;     // Rejected below as an invalid amount
+        if(op == 'd')
+            result = engineDeposit(from, amount, &balanceA);
+        else
+            result = engineWithdraw(from, amount, &balanceA);
+    }
+    else if(op == 't' && parseAccountField(&p, &from) && *p == ',') {
+        p++;
+        if(parseAccountField(&p, &to) && *p == ',') {
+            p++;
+            if(!parseMoney(p, &amount))
+                amount = 0;
+            result = engineTransfer(from, to, amount, &balanceA, &balanceB, &fee);
+            transfer = 1;
+        }
+    }
+    if(result == TXN_IO_ERROR)
+        return 0;
+    
+    if(result == TXN_OK)
+        engineLogApplied(transfer ? LOG_REMITTANCE : op == 'd' ? LOG_DEPOSIT : LOG_WITHDRAW, from, to, amount, fee);
+    
+    // Result line: the original operation, then OK with the new balance(s) or REJECT with a reason
+    size_t len = strlen(line);
+    memcpy(o, line, len);
+    o += len;
+    *o++ = ',';
+    const char *text = txnResultText(result);
+    len = strlen(text);
+    memcpy(o, text, len);
+    o += len;
+    if(result == TXN_OK) {
+        *o++ = ',';
+        o = formatMoney(o, balanceA);
+        if(transfer) {
+            *o++ = ',';
+            o = formatMoney(o, balanceB);
+            *o++ = ',';
+            o = formatMoney(o, fee);
+        }
+    }
+    *o++ = '\n';
+    *outLen = (int)(o - out);
+    return result == TXN_OK ? 1 : 2;
+}
+
+// Formats the result line of an operation longer than BATCH_LINE_MAX: its first BATCH_LINE_MAX bytes,
+// marked as cut, then the malformed-line rejection. The operation itself is never applied.
+int batchRejectLong(const char *line, char *out) {
+    const char *text = txnResultText(TXN_MALFORMED);
+    char *o = out;
+    
+    memcpy(o, line, BATCH_LINE_MAX);
+    o += BATCH_LINE_MAX;
+    memcpy(o, "...,", 4);
+    o += 4;
+    memcpy(o, text, strlen(text));
+    o += strlen(text);
+    *o++ = '\n';
+    return (int)(o - out);
+}
+
+// Streams a file of operations through the same rules as deposit(), withdraw() and remittance()
+// Balances are kept in memory and journaled in large commit groups, then written back at the end
+int runBatch(const char *inputPath, const char *outputPath) {
+    FILE *in = fopen(inputPath, "rb");
+    FILE *out = fopen(outputPath, "wb");
+    char *buffer = (char*)malloc(BATCH_READ_SIZE + BATCH_LINE_MAX + 1);
+    char *outBuffer = (char*)malloc(BATCH_WRITE_SIZE + BATCH_LINE_MAX * 2);
+    size_t carry = 0, outUsed = 0;
+    long long applied = 0, rejected = 0, lineNo = 0;
+    long long started = nowMicros();
+    int ok = 1, skipping = 0;
+    
+    if(in == NULL || out == NULL || buffer == NULL || outBuffer == NULL || !tableLoad()) {
+        printf("Error: Unable to start batch (check %s and %s)!\n", inputPath, outputPath);
+        if(in) fclose(in);
+        if(out) fclose(out);
+        free(buffer);
+        free(outBuffer);
+        return 0;
+    }
+    
+    engineInit();
+    
+    // Posting runs are throughput-bound, so let commit groups grow much larger than interactive ones
+    journalGroupRecords = JOURNAL_BUFFER_RECORDS;
+    journalGroupUsec = BATCH_GROUP_USEC;
+    
+    while(ok) {
+        size_t got = fread(buffer + carry, 1, BATCH_READ_SIZE, in);
+        size_t end = carry + got;
+        size_t start = 0;
+        if(end == 0)
+            break;
+        // Terminate a final line that has no trailing newline
+        if(got == 0 && buffer[end - 1] != '\n')
+            buffer[end++] = '\n';
+    
+        for(size_t i = start; i < end; i++) {
+            if(buffer[i] != '\n')
+                continue;
+            char *line = buffer + start;
+            size_t len = i - start;
+            start = i + 1;
+            // The rest of a too-long line that was already rejected
+            if(skipping) {
+                skipping = 0;
+                continue;
+            }
+            lineNo++;
+            if(len > 0 && line[len - 1] == '\r') len--;
+            line[len] = '\0';
+            if(len == 0 || line[0] == '#')
+                continue;
+    
+            int outLen, status;
+            if(len > BATCH_LINE_MAX) {
+                outLen = batchRejectLong(line, outBuffer + outUsed);
+                status = 2;
+            } else {
+                status = batchApplyLine(line, outBuffer + outUsed, &outLen);
+            }
+            if(status == 0) {
+                printf("Error: Journal write failed at line %lld!\n", lineNo);
+                ok = 0;
+                break;
+            }
+            if(status == 1) applied++;
+            else rejected++;
+            outUsed += (size_t)outLen;
+    
+            if(outUsed >= BATCH_WRITE_SIZE) {
+                fwrite(outBuffer, 1, outUsed, out);
+                outUsed = 0;
+            }
+            // Fold the journal into the data file before it grows without bound
+            if(journalBytes >= JOURNAL_CHECKPOINT_BYTES && !tableWriteBack()) {
+                ok = 0;
+                break;
+            }
+        }
+    
+        // Keep the unfinished tail of the buffer for the next read. A tail that is already too long
+        // is rejected now, and the rest of its line is skipped once its newline arrives.
+        carry = end - start;
+        if(skipping) {
+            carry = 0;
+        } else if(carry > BATCH_LINE_MAX) {
+            lineNo++;
+            if(buffer[start] != '#') {
+                outUsed += (size_t)batchRejectLong(buffer + start, outBuffer + outUsed);
+                rejected++;
+            }
+            if(outUsed >= BATCH_WRITE_SIZE) {
+                fwrite(outBuffer, 1, outUsed, out);
+                outUsed = 0;
+            }
+            skipping = 1;
+            carry = 0;
+        }
+        memmove(buffer, buffer + start, carry);
+        if(got == 0)
+            break;
+    }
+    
+    fwrite(outBuffer, 1, outUsed, out);
+    if(fclose(out) != 0)
+        ok = 0;
+    fclose(in);
+    if(!tableWriteBack()) {
+        printf("Error: Failed to update account data file!\n");
+        ok = 0;
+    }
+    
+    double seconds = (nowMicros() - started) / 1000000.0;
+    long long total = applied + rejected;
+    printf("Batch complete: %lld operations (%lld applied, %lld rejected) in %.3f s",
+           total, applied, rejected, seconds);
+    if(seconds > 0)
+        printf(" (%.0f ops/sec)", total / seconds);
+    printf("\n");
+    
+    logEvent(LOG_BATCH, (int)applied, (int)rejected, 0, 0, inputPath);
+    
+    journalGroupRecords = JOURNAL_GROUP_RECORDS;
+    journalGroupUsec = JOURNAL_GROUP_USEC;
+    free(buffer);
+    free(outBuffer);
+    tableFree();
+    return ok;
+}
+
+// Thread-safe transaction core over the in-memory account table
+// Each account row maps to one lock stripe by slot number; a transfer always takes the lower
+// stripe first, so concurrent A→B and B→A transfers cannot deadlock
+
+// Prepares the lock stripes; must run before any worker thread calls the engine
+void engineInit() {
+    for(int i = 0; i < ENGINE_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&engineStripes[i].lock, NULL);
+        engineStripes[i].fees = 0;
+        engineStripes[i].net = 0;
+    }
+}
+
+// Slot of the table row holding an account
+int engineSlotOf(Account *acc) {
+    return (int)((StoreSlot*)((char*)acc - offsetof(StoreSlot, acc)) - tableRows);
+}
+
+// Stripe guarding the row of an account
+EngineStripe* engineStripeOf(Account *acc) {
+    return &engineStripes[engineSlotOf(acc) & (ENGINE_LOCK_STRIPES - 1)];
+}
+
+// Total remittance fees collected by the engine since engineInit()
+Money engineFeesCollected() {
+    Money total = 0;
+    for(int i = 0; i < ENGINE_LOCK_STRIPES; i++) {
+        pthread_mutex_lock(&engineStripes[i].lock);
+        total += engineStripes[i].fees;
+        pthread_mutex_unlock(&engineStripes[i].lock);
+    }
+    return total;
+}
+
+// Credits an account; the journal record is queued while the row is still locked
+// so journal order always matches the order balances changed. The record carries the new
+// balance, so the row changes first and is put back if the record cannot be queued.
+int engineDeposit(int num, Money amount, Money *balance) {
+    Account *acc = tableFind(num);
+    int result;
+    
+    if(acc == NULL)
+        return TXN_NOT_FOUND;
+    EngineStripe *stripe = engineStripeOf(acc);
+    pthread_mutex_lock(&stripe->lock);
+    result = checkDeposit(acc, amount);
+    if(result == TXN_OK) {
+        viewPreserve(engineSlotOf(acc));
+        acc->balance += amount;
+        stripe->net += amount;
+        if(journalFd >= 0 && !journalAppend(JOURNAL_DEPOSIT, acc, NULL, amount, 0)) {
+            acc->balance -= amount;
+            stripe->net -= amount;
+            result = TXN_IO_ERROR;
+        } else {
+            tableTouch(acc);
+        }
+        if(balance) *balance = acc->balance;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return result;
+}
+
+// Debits an account if the balance covers the amount
+int engineWithdraw(int num, Money amount, Money *balance) {
+    Account *acc = tableFind(num);
+    int result;
+    
+    if(acc == NULL)
+        return TXN_NOT_FOUND;
+    EngineStripe *stripe = engineStripeOf(acc);
+    pthread_mutex_lock(&stripe->lock);
+    result = checkWithdraw(acc, amount);
+    if(result == TXN_OK) {
+        viewPreserve(engineSlotOf(acc));
+        acc->balance -= amount;
+        stripe->net -= amount;
+        if(journalFd >= 0 && !journalAppend(JOURNAL_WITHDRAW, acc, NULL, amount, 0)) {
+            acc->balance += amount;
+            stripe->net += amount;
+            result = TXN_IO_ERROR;
+        } else {
+            tableTouch(acc);
+        }
+        if(balance) *balance = acc->balance;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return result;
+}
+
+// Moves money between two accounts, charging the sender the type-based fee
+int engineTransfer(int from, int to, Money amount, Money *fromBalance, Money *toBalance, Money *feeOut) {
+    Account *a = tableFind(from);
+    Account *b = tableFind(to);
+    EngineStripe *first, *second;
+    Money fee;
+    int result;
+    
+    if(a == NULL || b == NULL)
+        return TXN_NOT_FOUND;
+    if(a == b)
+        return TXN_SAME_ACCOUNT;
+    
+    // Fixed lock order by stripe address; both rows may share one stripe
+    first = engineStripeOf(a);
+    second = engineStripeOf(b);
+    if(second < first) {
+        EngineStripe *tmp = first;
+        first = second;
+        second = tmp;
+    }
+    pthread_mutex_lock(&first->lock);
+    if(second != first)
+        pthread_mutex_lock(&second->lock);
+    
+    fee = remittanceFee(a, b, amount);
+    result = checkRemittance(a, b, amount, fee);
+    if(result == TXN_OK) {
+        viewPreserve(engineSlotOf(a));
+        viewPreserve(engineSlotOf(b));
+        a->balance -= (amount + fee);
+        b->balance += amount;
+        engineStripeOf(a)->fees += fee;
+        if(journalFd >= 0 && !journalAppend(JOURNAL_TRANSFER, a, b, amount, fee)) {
+            a->balance += amount + fee;
+            b->balance -= amount;
+            engineStripeOf(a)->fees -= fee;
+            result = TXN_IO_ERROR;
+        } else {
+            tableTouch(a);
+            tableTouch(b);
+        }
+        if(fromBalance) *fromBalance = a->balance;
+        if(toBalance) *toBalance = b->balance;
+        if(feeOut) *feeOut = fee;
+    }
+    
+    if(second != first)
+        pthread_mutex_unlock(&second->lock);
+    pthread_mutex_unlock(&first->lock);
+    return result;
+}
+
+// Applied operations go to the audit log just like their menu counterparts
+// Deposits and withdrawals have no counterpart account and carry no fee
+void engineLogApplied(int type, int from, int to, Money amount, Money fee) {
+    if(type == LOG_REMITTANCE)
+        logEvent(LOG_REMITTANCE, from, to, amount, fee, NULL);
+    else
+        logEvent(type, from, 0, amount, 0, NULL);
+}
+
+// Read views
+// A long scan of the table (an audit, a listing, a total) sees every row as of one point while the
+// engine keeps posting. Taking a view briefly holds every stripe lock, so no operation is half
+// applied, and starts a new view epoch. Each row carries the epoch of its last change; the first
+// change to a row in an epoch first saves the row in tableBefore. A view therefore reads a row from
+// tableBefore when the row was changed in the view's epoch, and from the table otherwise. Writers only
+// compare one number per change and copy a row at most once per view; they never wait on a reader.
+// Only one point is kept at a time: a view opened while others are open shares their point, and the
+// next epoch starts once they have all closed.
+
+// Takes a view; the point is taken now unless other views are open, in which case it is theirs
+void viewOpen(ReadView *view) {
+    pthread_mutex_lock(&viewLock);
+    if(viewReaders == 0) {
+        for(int i = 0; i < ENGINE_LOCK_STRIPES; i++)
+            pthread_mutex_lock(&engineStripes[i].lock);
+        viewShared.epoch = atomic_fetch_add_explicit(&viewEpoch, 1, memory_order_relaxed) + 1;
+        viewShared.rows = tableRowCount;
+        viewShared.fees = 0;
+        viewShared.net = 0;
+        for(int i = 0; i < ENGINE_LOCK_STRIPES; i++) {
+            viewShared.fees += engineStripes[i].fees;
+            viewShared.net += engineStripes[i].net;
+        }
+        for(int i = ENGINE_LOCK_STRIPES - 1; i >= 0; i--)
+            pthread_mutex_unlock(&engineStripes[i].lock);
+    }
+    viewReaders++;
+    *view = viewShared;
+    pthread_mutex_unlock(&viewLock);
+}
+
+// Copies a row as it was at the view's point; returns 0 for rows added after it
+// A writer stamps the row's epoch before changing it, so a copy taken while the row changed is
+// recognised by the epoch read after it and replaced by the saved contents
+int viewRow(const ReadView *view, int slot, StoreSlot *out) {
+    if(slot < 0 || slot >= view->rows)
+        return 0;
+    if(atomic_load_explicit(&tableEpoch[slot], memory_order_acquire) != view->epoch) {
+        memcpy(out, &tableRows[slot], sizeof(StoreSlot));
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&tableEpoch[slot], memory_order_relaxed) != view->epoch)
+            return 1;
+    }
+    memcpy(out, &tableBefore[slot], sizeof(StoreSlot));
+    return 1;
+}
+
+// Releases a view; once the last one closes, writers stop keeping rows for its point
+void viewClose(ReadView *view) {
+    pthread_mutex_lock(&viewLock);
+    if(--viewReaders == 0)
+        pthread_cond_broadcast(&viewClosed);
+    pthread_mutex_unlock(&viewLock);
+    view->rows = 0;
+}
+
+// Called with the row's stripe lock held before the row changes
+void viewPreserve(int slot) {
+    unsigned int epoch = atomic_load_explicit(&viewEpoch, memory_order_relaxed);
+    
+    if(atomic_load_explicit(&tableEpoch[slot], memory_order_relaxed) == epoch)
+        return;
+    memcpy(&tableBefore[slot], &tableRows[slot], sizeof(StoreSlot));
+    atomic_store_explicit(&tableEpoch[slot], epoch, memory_order_release);
+    // The stamp must be visible before any byte of the change is
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// Grows tableBefore and tableEpoch from oldCapacity to newCapacity rows; new rows start in epoch 0
+int viewReserve(int oldCapacity, int newCapacity) {
+    StoreSlot *before = (StoreSlot*)realloc(tableBefore, (size_t)newCapacity * sizeof(StoreSlot));
+    if(before == NULL)
+        return 0;
+    tableBefore = before;
+    atomic_uint *epochs = (atomic_uint*)realloc(tableEpoch, (size_t)newCapacity * sizeof(atomic_uint));
+    if(epochs == NULL)
+        return 0;
+    tableEpoch = epochs;
+    for(int i = oldCapacity; i < newCapacity; i++)
+        atomic_init(&tableEpoch[i], 0);
+    return 1;
+}
+
+// xorshift64* generator; each stress worker owns one so no state is shared
+unsigned long long nextRandom(unsigned long long *state) {
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ull;
+}
+
+// One stress worker: random deposits, withdrawals and transfers over the whole table
+void* stressWorker(void *arg) {
+    StressWorker *w = (StressWorker*)arg;
+    unsigned long long rng = w->seed;
+    
+    for(long i = 0; i < w->ops; i++) {
+        unsigned long long r = nextRandom(&rng);
+        int a = stressAccounts[r % stressAccountCount];
+        int b = stressAccounts[(r >> 20) % stressAccountCount];
+        Money amount = 1 + (Money)((r >> 40) % 50000);   // RM0.01 - RM500.00
+        int kind = (int)((r >> 32) % 10);
+    
+        if(kind == 0) {
+            if(engineDeposit(a, amount, NULL) == TXN_OK)
+                w->deposited += amount;
+        } else if(kind == 1) {
+            if(engineWithdraw(a, amount, NULL) == TXN_OK)
+                w->withdrawn += amount;
+        } else {
+            if(engineTransfer(a, b, amount, NULL, NULL, NULL) == TXN_OK)
+                w->transfers++;
+        }
+    }
+    return NULL;
+}
+
+// Audits the table through read views while the workers post. Every view is one point between
+// operations, so its balances plus the fees collected equal the opening balances plus the net
+// deposits at that point, to the sen; a remittance seen on one side only would break the sum.
+void* stressAuditor(void *arg) {
+    StressAudit *audit = (StressAudit*)arg;
+    ReadView view;
+    StoreSlot row;
+    
+    do {
+        long long started = nowMicros();
+        Money total = 0;
+        viewOpen(&view);
+        for(int slot = 0; slot < view.rows; slot++) {
+            if(viewRow(&view, slot, &row) && row.state == STORE_SLOT_USED)
+                total += row.acc.balance;
+        }
+        if(total + view.fees != audit->opening + view.net)
+            audit->unbalanced++;
+        viewClose(&view);
+        audit->views++;
+        audit->scanMicros += nowMicros() - started;
+        usleep(STRESS_AUDIT_USEC);
+    } while(!atomic_load(&audit->stop));
+    return NULL;
+}
+
+// Hammers the engine from several threads over a synthetic in-memory population and checks that
+// money is conserved: final balances + fees == opening balances + deposits - withdrawals.
+// An auditor thread checks the same sum through read views while the workers are running.
+int runStressTest(int threads, long opsPerThread) {
+    const int accounts = STRESS_ACCOUNTS;
+    const Money opening = 1000 * SEN_PER_RM;
+    pthread_t *ids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    StressWorker *workers = (StressWorker*)calloc(threads, sizeof(StressWorker));
+    StressAudit audit;
+    pthread_t auditor;
+    Money expected, actual = 0, deposited = 0, withdrawn = 0, fees;
+    long long transfers = 0;
+    int negatives = 0;
+    
+    // Build a table that never touches the data file; the journal stays closed
+    tableRows = (StoreSlot*)calloc(accounts, sizeof(StoreSlot));
+    tableDirty = (unsigned char*)calloc(accounts, 1);
+    stressAccounts = (int*)calloc(accounts, sizeof(int));
+    if(ids == NULL || workers == NULL || tableRows == NULL || tableDirty == NULL || stressAccounts == NULL ||
+       !viewReserve(0, accounts)) {
+        printf("Error: Not enough memory for stress test!\n");
+        return 0;
+    }
+    tableRowCount = accounts;
+    tableRowCapacity = accounts;
+    stressAccountCount = accounts;
+    for(int i = 0; i < accounts; i++) {
+        Account *acc = &tableRows[i].acc;
+        tableRows[i].state = STORE_SLOT_USED;
+        acc->accountNumber = 1000000 + i;
+        acc->balance = opening;
+        strcpy(acc->accountType, (i % 2) ? "Current" : "Savings");
+        stressAccounts[i] = acc->accountNumber;
+        indexInsert(acc->accountNumber, i);
+    }
+    engineInit();
+    memset(&audit, 0, sizeof(audit));
+    audit.opening = (Money)accounts * opening;
+    
+    long long started = nowMicros();
+    for(int t = 0; t < threads; t++) {
+        workers[t].seed = 0x9E3779B97F4A7C15ull * (t + 1);
+        workers[t].ops = opsPerThread;
+        pthread_create(&ids[t], NULL, stressWorker, &workers[t]);
+    }
+    pthread_create(&auditor, NULL, stressAuditor, &audit);
+    for(int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        deposited += workers[t].deposited;
+        withdrawn += workers[t].withdrawn;
+        transfers += workers[t].transfers;
+    }
+    double seconds = (nowMicros() - started) / 1000000.0;
+    atomic_store(&audit.stop, 1);
+    pthread_join(auditor, NULL);
+    
+    for(int i = 0; i < accounts; i++) {
+        actual += tableRows[i].acc.balance;
+        if(tableRows[i].acc.balance < 0)
+            negatives++;
+    }
+    fees = engineFeesCollected();
+    actual += fees;
+    expected = (Money)accounts * opening + deposited - withdrawn;
+    
+    printf("Stress test: %d threads x %ld ops in %.3f s (%.0f ops/sec), %lld transfers\n",
+           threads, opsPerThread, seconds, seconds > 0 ? threads * opsPerThread / seconds : 0.0, transfers);
+    printf("  Expected total: RM%.2f\n  Actual total  : RM%.2f (including RM%.2f fees)\n",
+           MONEY_RM(expected), MONEY_RM(actual), MONEY_RM(fees));
+    printf("  Overdrawn accounts: %d\n", negatives);
+    printf("  Audits during the run: %lld read views (%.0f us each), %lld out of balance\n",
+           audit.views, audit.views ? (double)audit.scanMicros / audit.views : 0.0, audit.unbalanced);
+    
+    // Integer sen make conservation exact: not a single sen may appear or vanish
+    int passed = negatives == 0 && actual == expected && audit.unbalanced == 0;
+    printf("  Result: %s\n", passed ? "PASS" : "FAIL");
+    
+    free(ids);
+    free(workers);
+    free(stressAccounts);
+    tableFree();
+    return passed;
+}
+
+// Network server: the operations mainMenu() dispatches, as fixed-layout binary frames over a local
+// TCP port or a Unix socket. One thread runs an epoll loop over every connection. Each wakeup is a
+// tick: every complete request that arrived is applied to the in-memory table through the engine,
+// the tick's journal records are committed with one sync, the changed rows are copied into the
+// mapping, and only then are the responses sent. Clients may pipeline as many requests as they like;
+// a connection whose responses are not being read stops being read itself.
+#ifdef BANK_HAVE_EPOLL
+
+void serverSignal(int sig) {
+    (void)sig;
+    serverStop = 1;
+}
+
+// Parses "<port>" as 127.0.0.1:<port> and anything else as the path of a Unix socket
+int serverAddress(const char *address, struct sockaddr_storage *sa, socklen_t *len, int *family) {
+    const char *p = address;
+    
+    memset(sa, 0, sizeof(*sa));
+    while(isdigit((unsigned char)*p))
+        p++;
+    if(*address != '\0' && *p == '\0') {
+        struct sockaddr_in *in = (struct sockaddr_in*)sa;
+        long port = atol(address);
+        if(port < 1 || port > 65535)
+            return 0;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((unsigned short)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *len = sizeof(*in);
+        *family = AF_INET;
+        return 1;
+    }
+    struct sockaddr_un *un = (struct sockaddr_un*)sa;
+    if(strlen(address) >= sizeof(un->sun_path))
+        return 0;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, address);
+    *len = sizeof(*un);
+    *family = AF_UNIX;
+    return 1;
+}
+
+// Lifts the open file limit to its hard maximum so tens of thousands of sockets fit
+void serverRaiseFileLimit() {
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Appends a value to a growable pointer array
+int serverListPush(ServerConn ***list, int *count, int *capacity, ServerConn *conn) {
+    if(*count == *capacity) {
+        int newCapacity = *capacity ? *capacity * 2 : 256;
+        ServerConn **grown = (ServerConn**)realloc(*list, newCapacity * sizeof(ServerConn*));
+        if(grown == NULL)
+            return 0;
+        *list = grown;
+        *capacity = newCapacity;
+    }
+    (*list)[(*count)++] = conn;
+    return 1;
+}
+
+// Shard workers
+// With BANK_SHARDS=<n>, the deposits, withdrawals and remittances are applied by n shard workers, each
+// pinned to its own CPU, while the epoll thread reads, parses and routes requests. Accounts are split
+// among the shards by a hash of the account number, and a request goes to the shard owning the account
+// it is charged to (the sender of a remittance) through that shard's single-producer, single-consumer
+// queue. The shards still share one store, one journal and the engine's row locks: a remittance to an
+// account of another shard is applied by the sender's shard, which locks both rows in a fixed order and
+// writes both new balances into one journal record, so a crash cannot split it. Creates and deletes
+// change the store and the indexes, so the epoll thread applies them itself once every shard is idle.
+// Parsing, the journal commit, the row write-back and delivery all stay on the epoll thread. A
+// connection's request is not queued on a shard until its previous one, if queued on another shard,
+// has been applied, so each connection's requests are applied in the order it sent them.
+
+// Shard owning an account; authAcquire() splits the authentication entries the same way
+int serverShardOf(int num) {
+    return (int)(indexHash(num) % (unsigned int)serverShardCount);
+}
+
+// Queues a request for a shard and wakes its worker if it went to sleep
+void serverShardPush(ServerShard *shard, int op) {
+    unsigned int head = atomic_load_explicit(&shard->head, memory_order_relaxed);
+    
+    shard->queue[head & (SERVER_TICK_OPS - 1)] = op;
+    // Sequentially consistent, so either the worker sees the entry or this sees it sleeping
+    atomic_store(&shard->head, head + 1);
+    if(atomic_load(&shard->sleeping) && atomic_exchange(&shard->sleeping, 0))
+        sem_post(&shard->wake);
+}
+
+// Body of a shard worker: applies its queue in order, spins briefly when it runs dry, then sleeps
+void* serverShardWorker(void *arg) {
+    ServerShard *shard = (ServerShard*)arg;
+    unsigned int tail = 0;
+    int idle = 0;
+    cpu_set_t cpus;
+    
+    serverMyShard = shard;
+    journalStage = &shard->stage;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        shard->cpu = -1;
+    
+    for(;;) {
+        if(tail != atomic_load_explicit(&shard->head, memory_order_acquire)) {
+            ServerOp *op = &serverOps[shard->queue[tail & (SERVER_TICK_OPS - 1)]];
+            serverApply(&op->req, NULL, 0, &op->resp);
+            shard->applied++;
+            atomic_store_explicit(&shard->tail, ++tail, memory_order_release);
+            idle = 0;
+            continue;
+        }
+        if(atomic_load(&serverShardsStopping))
+            break;
+        if(++idle < SERVER_SHARD_SPINS)
+            continue;
+        atomic_store(&shard->sleeping, 1);
+        if(atomic_load(&shard->head) == tail && !atomic_load(&serverShardsStopping))
+            sem_wait(&shard->wake);
+        atomic_store(&shard->sleeping, 0);
+        idle = 0;
+    }
+    return NULL;
+}
+
+// Waits until a shard has applied the request that left its queue head at ticket
+void serverShardWait(ServerShard *shard, unsigned int ticket) {
+    while((int)(atomic_load_explicit(&shard->tail, memory_order_acquire) - ticket) < 0)
+        sched_yield();
+}
+
+// Waits until every shard has applied everything queued for it
+void serverShardDrain() {
+    for(int s = 0; s < serverShardCount; s++) {
+        ServerShard *shard = &serverShards[s];
+        while(atomic_load_explicit(&shard->tail, memory_order_acquire) !=
+              atomic_load_explicit(&shard->head, memory_order_relaxed))
+            sched_yield();
+    }
+}
+
+// Starts the shard workers BANK_SHARDS=<n> asks for; none unless it is set, since with the single
+// store they have not been shown to raise throughput. Returns how many run; with none, every request
+// is applied on the epoll thread.
+int serverShardsStart() {
+    const char *forced = getenv("BANK_SHARDS");
+    long cpus = cpuCount();
+    long count = (forced != NULL) ? atol(forced) : 0;
+    
+    if(count > SERVER_SHARD_MAX)
+        count = SERVER_SHARD_MAX;
+    if(count < 1)
+        return 0;
+    serverOps = (ServerOp*)malloc(SERVER_TICK_OPS * sizeof(ServerOp));
+    if(serverOps == NULL)
+        return 0;
+    atomic_store(&serverShardsStopping, 0);
+    for(int s = 0; s < count; s++) {
+        ServerShard *shard = &serverShards[s];
+        memset(shard, 0, sizeof(ServerShard));
+        shard->cpu = (int)((s + 1) % cpus);
+        shard->queue = (int*)malloc(SERVER_TICK_OPS * sizeof(int));
+        if(shard->queue == NULL || sem_init(&shard->wake, 0, 0) != 0) {
+            free(shard->queue);
+            break;
+        }
+        if(pthread_create(&shard->thread, NULL, serverShardWorker, shard) != 0) {
+            sem_destroy(&shard->wake);
+            free(shard->queue);
+            break;
+        }
+        serverShardCount = s + 1;
+    }
+    // Each shard verifies PINs in its own table; nothing is queued yet, so no worker is using one
+    if(serverShardCount > 0)
+        authSplit(serverShardCount);
+    return serverShardCount;
+}
+
+// Lets the workers finish their queues, then joins them and prints how the requests were spread
+void serverShardsStop() {
+    if(serverShardCount == 0)
+        return;
+    atomic_store(&serverShardsStopping, 1);
+    printf("  Shards       :");
+    for(int s = 0; s < serverShardCount; s++) {
+        ServerShard *shard = &serverShards[s];
+        sem_post(&shard->wake);
+        pthread_join(shard->thread, NULL);
+        printf(" %lld", shard->applied);
+        sem_destroy(&shard->wake);
+        free(shard->queue);
+        free(shard->rows);
+        free(shard->stage.records);
+    }
+    printf(" requests\n");
+    authSplit(0);
+    free(serverOps);
+    serverOps = NULL;
+    serverShardCount = 0;
+}
+
+// Puts a connection on serverTouched so it is dealt with after the tick's commit
+int serverMarkPending(ServerConn *conn) {
+    if(conn->pending)
+        return 1;
+    if(!serverListPush(&serverTouched, &serverTouchedCount, &serverTouchedCapacity, conn))
+        return 0;
+    conn->pending = 1;
+    return 1;
+}
+
+// Appends the responses of the tick's requests to their connections in the order they were read
+// Returns 0 if any of them could not reach the journal or the data file
+int serverDeliver(long long *applied, long long *rejected) {
+    int ok = 1;
+    
+    serverShardDrain();
+    for(int i = 0; i < serverOpCount; i++) {
+        ServerOp *op = &serverOps[i];
+        ServerConn *conn = op->conn;
+        if(op->resp.result == TXN_IO_ERROR)
+            ok = 0;
+        else if(op->resp.result == TXN_OK)
+            (*applied)++;
+        else
+            (*rejected)++;
+        memcpy(conn->out + conn->outUsed, &op->resp, sizeof(ServerResponse));
+        conn->outUsed += sizeof(ServerResponse);
+        conn->outQueued -= sizeof(ServerResponse);
+    }
+    serverOpCount = 0;
+    return ok;
+}
+
+// Remembers the table rows of an applied request for the write-back at the end of the tick
+int serverTouchRow(int num) {
+    int slot = indexLookup(num);
+    ServerShard *shard = serverMyShard;
+    
+    if(slot < 0)
+        return 1;
+    if(shard != NULL)
+        return loadListPush(&shard->rows, &shard->rowCount, &shard->rowCapacity, slot);
+    return loadListPush(&serverRows, &serverRowCount, &serverRowCapacity, slot);
+}
+
+// Checks the PIN of a request through the authentication cache; TXN_OK or the reason it was refused
+int serverCheckPin(int num, const char pin[4]) {
+    char text[5];
+    
+    memcpy(text, pin, 4);
+    text[4] = '\0';
+    switch(authVerify(num, text)) {
+        case AUTH_OK: return TXN_OK;
+        case AUTH_LOCKED: return TXN_LOCKED;
+        case AUTH_NOT_FOUND: return TXN_NOT_FOUND;
+        default: return TXN_BAD_PIN;
+    }
+}
+
+// Makes this tick's changes durable: one journal commit for every record appended since the last
+// one, then the changed rows go into the mapping. Responses queued so far may be sent afterwards.
+// The shard workers are drained first, and stay idle until the epoll thread queues more work; their
+// staged journal records are merged into the commit group here, so they never take journalLock.
+int serverCommit() {
+    JournalStage *stages[SERVER_SHARD_MAX];
+    int rows = serverRowCount;
+    
+    serverShardDrain();
+    for(int s = 0; s < serverShardCount; s++) {
+        rows += serverShards[s].rowCount;
+        stages[s] = &serverShards[s].stage;
+    }
+    if(rows == 0)
+        return 1;
+    if(!journalMerge(stages, serverShardCount) || !journalCommit())
+        return 0;
+    for(int i = 0; i < serverRowCount; i++) {
+        if(!tableWriteRow(serverRows[i]))
+            return 0;
+    }
+    serverRowCount = 0;
+    for(int s = 0; s < serverShardCount; s++) {
+        ServerShard *shard = &serverShards[s];
+        for(int i = 0; i < shard->rowCount; i++) {
+            if(!tableWriteRow(shard->rows[i]))
+                return 0;
+        }
+        shard->rowCount = 0;
+    }
+    return journalMaybeCheckpoint();
+}
+
+// Opens an account from a create request; the name and ID number follow the header
+int serverCreate(const ServerRequest *req, const char *payload, int payloadLen, ServerResponse *resp) {
+    Account acc;
+    char pin[5];
+    const char *name = payload;
+    const char *nameEnd = (const char*)memchr(payload, '\0', payloadLen);
+    const char *id, *idEnd;
+    
+    if(nameEnd == NULL)
+        return TXN_MALFORMED;
+    id = nameEnd + 1;
+    idEnd = (const char*)memchr(id, '\0', payload + payloadLen - id);
+    if(idEnd == NULL || nameEnd == name || nameEnd - name >= (long)sizeof(acc.accountName) ||
+       idEnd - id < 4 || idEnd - id >= (long)sizeof(acc.idNumber) || req->type > ACCOUNT_CURRENT)
+        return TXN_MALFORMED;
+    // Same rules as the menu prompts, which read single words and a 4-digit PIN
+    for(const char *c = name; c < idEnd; c++) {
+        if(c != nameEnd && isspace((unsigned char)*c))
+            return TXN_MALFORMED;
+    }
+    for(int i = 0; i < 4; i++) {
+        if(!isdigit((unsigned char)req->pin[i]))
+            return TXN_MALFORMED;
+    }
+    
+    memset(&acc, 0, sizeof(acc));
+    acc.accountNumber = accountNumberAllocate();
+    if(acc.accountNumber < 0)
+        return TXN_NO_NUMBERS;
+    strcpy(acc.accountName, name);
+    strcpy(acc.idNumber, id);
+    memcpy(pin, req->pin, 4);
+    pin[4] = '\0';
+    pinSet(&acc, pin);
+    strcpy(acc.accountType, req->type == ACCOUNT_CURRENT ? "Current" : "Savings");
+    if(!createAccountRecord(&acc) || !tableAdopt(indexLookup(acc.accountNumber)))
+        return TXN_IO_ERROR;
+    resp->account = acc.accountNumber;
+    return TXN_OK;
+}
+
+// Deletes an account after checking its PIN and the last 4 characters of its ID number
+// Deletion writes the slot directly, so the changes queued so far are committed first
+int serverDelete(const ServerRequest *req, ServerResponse *resp) {
+    Account *row = tableFind(req->account);
+    Account acc;
+    
+    if(row == NULL)
+        return TXN_NOT_FOUND;
+    int result = serverCheckPin(req->account, req->pin);
+    if(result != TXN_OK)
+        return result;
+    int len = (int)strlen(row->idNumber);
+    if(len < 4 || memcmp(&row->idNumber[len - 4], req->idLast4, 4) != 0)
+        return TXN_BAD_ID;
+    
+    int slot = indexLookup(req->account);
+    if(!serverCommit())
+        return TXN_IO_ERROR;
+    acc = *row;
+    if(!deleteAccountRecord(&acc) || !tableAdopt(slot))
+        return TXN_IO_ERROR;
+    resp->balance = acc.balance;
+    return TXN_OK;
+}
+
+// Applies one request and fills in its response; returns the TXN_* result
+int serverApply(const ServerRequest *req, const char *payload, int payloadLen, ServerResponse *resp) {
+    Account *acc;
+    int result;
+    
+    memset(resp, 0, sizeof(*resp));
+    resp->tag = req->tag;
+    resp->op = req->op;
+    resp->account = req->account;
+    resp->toAccount = req->toAccount;
+    
+    if(req->op == SERVER_OP_CREATE)
+        return resp->result = (unsigned char)serverCreate(req, payload, payloadLen, resp);
+    if(req->op == SERVER_OP_DELETE)
+        return resp->result = (unsigned char)serverDelete(req, resp);
+    if(req->op < SERVER_OP_DEPOSIT || req->op > SERVER_OP_REMIT)
+        return resp->result = TXN_MALFORMED;
+    
+    // Deposits, withdrawals and remittances all need the PIN of the account they are charged to
+    acc = tableFind(req->account);
+    if(acc == NULL)
+        return resp->result = TXN_NOT_FOUND;
+    result = serverCheckPin(req->account, req->pin);
+    if(result != TXN_OK)
+        return resp->result = (unsigned char)result;
+    
+    if(req->op == SERVER_OP_DEPOSIT)
+        result = engineDeposit(req->account, req->amount, &resp->balance);
+    else if(req->op == SERVER_OP_WITHDRAW)
+        result = engineWithdraw(req->account, req->amount, &resp->balance);
+    else
+        result = engineTransfer(req->account, req->toAccount, req->amount,
+                                &resp->balance, &resp->toBalance, &resp->fee);
+    
+    if(result == TXN_OK) {
+        engineLogApplied(req->op == SERVER_OP_REMIT ? LOG_REMITTANCE :
+                         req->op == SERVER_OP_DEPOSIT ? LOG_DEPOSIT : LOG_WITHDRAW,
+                         req->account, req->toAccount, req->amount, resp->fee);
+        if(!serverTouchRow(req->account) || (req->op == SERVER_OP_REMIT && !serverTouchRow(req->toAccount)))
+            result = TXN_IO_ERROR;
+    }
+    return resp->result = (unsigned char)result;
+}
+
+// Applies every complete request in a connection's input while its output has room for the response
+// With shard workers, deposits, withdrawals and remittances are queued for their shard instead and
+// answered by serverDeliver(); a tick that is full leaves the rest of the input for the next one.
+// Returns 0 only when the journal or the data file failed
+int serverParse(ServerConn *conn, long long *applied, long long *rejected) {
+    int used = 0;
+    
+    while(conn->inUsed - used >= (int)sizeof(ServerRequest) &&
+          conn->outUsed + conn->outQueued + (int)sizeof(ServerResponse) <= SERVER_OUT_BUFFER) {
+        ServerRequest req;
+        memcpy(&req, conn->in + used, sizeof(req));
+        if(req.length < sizeof(ServerRequest) || req.length > SERVER_FRAME_MAX) {
+            conn->closing = 1;
+            break;
+        }
+        if(conn->inUsed - used < req.length)
+            break;
+        const char *payload = conn->in + used + sizeof(req);
+        int payloadLen = req.length - (int)sizeof(req);
+    
+        if(serverShardCount > 0) {
+            if(serverOpCount == SERVER_TICK_OPS)
+                break;
+            ServerOp *op = &serverOps[serverOpCount];
+            op->req = req;
+            op->conn = conn;
+            if(req.op >= SERVER_OP_DEPOSIT && req.op <= SERVER_OP_REMIT) {
+                int s = serverShardOf(req.account);
+                // A request following one on another shard waits for it, keeping the connection's order
+                if(conn->fenceShard != 0 && conn->fenceShard != s + 1)
+                    serverShardWait(&serverShards[conn->fenceShard - 1], conn->fenceTicket);
+                serverShardPush(&serverShards[s], serverOpCount);
+                conn->fenceShard = s + 1;
+                conn->fenceTicket = atomic_load_explicit(&serverShards[s].head, memory_order_relaxed);
+            } else {
+                if(req.op == SERVER_OP_CREATE || req.op == SERVER_OP_DELETE)
+                    serverShardDrain();
+                serverApply(&req, payload, payloadLen, &op->resp);
+            }
+            serverOpCount++;
+            conn->outQueued += sizeof(ServerResponse);
+        } else {
+            ServerResponse resp;
+            int result = serverApply(&req, payload, payloadLen, &resp);
+            if(result == TXN_IO_ERROR)
+                return 0;
+            if(result == TXN_OK)
+                (*applied)++;
+            else
+                (*rejected)++;
+            memcpy(conn->out + conn->outUsed, &resp, sizeof(resp));
+            conn->outUsed += sizeof(resp);
+        }
+        used += req.length;
+        if(!serverMarkPending(conn))
+            return 0;
+    }
+    // Input left behind by a full tick is parsed again after the commit, like input that waits for room
+    if(serverShardCount > 0 && serverOpCount == SERVER_TICK_OPS && !serverMarkPending(conn))
+        return 0;
+    memmove(conn->in, conn->in + used, conn->inUsed - used);
+    conn->inUsed -= used;
+    return 1;
+}
+
+// Sends the durable part of a connection's output; returns 0 once the peer is gone
+int serverSend(ServerConn *conn) {
+    while(conn->outSent < conn->outReady) {
+        long n = send(conn->fd, conn->out + conn->outSent, conn->outReady - conn->outSent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(n <= 0) {
+            // The peer is gone; whatever it has not read yet is dropped
+            conn->outUsed = conn->outReady = conn->outSent = 0;
+            return 0;
+        }
+        conn->outSent += (int)n;
+    }
+    memmove(conn->out, conn->out + conn->outSent, conn->outUsed - conn->outSent);
+    conn->outUsed -= conn->outSent;
+    conn->outReady -= conn->outSent;
+    conn->outSent = 0;
+    return 1;
+}
+
+// Registers the events a connection needs now: input while there is room to take and answer it,
+// output while durable responses are waiting for the socket to drain
+int serverWatch(int ep, ServerConn *conn) {
+    unsigned int events = 0;
+    
+    if(!conn->closing && conn->inUsed < SERVER_IN_BUFFER &&
+       conn->outUsed + conn->outQueued + (int)sizeof(ServerResponse) <= SERVER_OUT_BUFFER)
+        events |= EPOLLIN;
+    if(conn->outReady > 0)
+        events |= EPOLLOUT;
+    if(events == conn->events)
+        return 1;
+    
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = conn;
+    conn->events = events;
+    return epoll_ctl(ep, EPOLL_CTL_MOD, conn->fd, &ev) == 0;
+}
+
+// Serves the transaction protocol on address until SIGINT or SIGTERM, then commits and checkpoints
+int runServer(const char *address) {
+    struct sockaddr_storage sa;
+    struct epoll_event ev, events[SERVER_MAX_EVENTS];
+    socklen_t saLen;
+    int family, listenFd, ep, one = 1, ok = 1, listening = 1, pausedAt = 0;
+    long long applied = 0, rejected = 0, accepted = 0;
+    int open = 0, peak = 0;
+    
+    if(!serverAddress(address, &sa, &saLen, &family)) {
+        printf("Error: %s is neither a port nor a usable socket path!\n", address);
+        return 0;
+    }
+    if(!tableLoad()) {
+        printf("Error: Not enough memory to load the account table!\n");
+        return 0;
+    }
+    engineInit();
+    serverRaiseFileLimit();
+    serverShardsStart();
+    
+    listenFd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(family == AF_UNIX)
+        unlink(address);
+    else
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(listenFd < 0 || bind(listenFd, (struct sockaddr*)&sa, saLen) != 0 ||
+       listen(listenFd, SERVER_BACKLOG) != 0 || (ep = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        printf("Error: Unable to listen on %s!\n", address);
+        return 0;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listenFd, &ev);
+    
+    signal(SIGINT, serverSignal);
+    signal(SIGTERM, serverSignal);
+    // A tick's records are committed together, so groups only need to fit in the journal buffer
+    journalGroupRecords = JOURNAL_BUFFER_RECORDS;
+    printf("Serving %d accounts on %s (%s); press Ctrl+C to stop\n", indexCount,
+           family == AF_UNIX ? address : "127.0.0.1", family == AF_UNIX ? "Unix socket" : address);
+    if(serverShardCount > 0)
+        printf("Applying requests on %d shard workers\n", serverShardCount);
+    long long started = nowMicros();
+    
+    while(ok && !serverStop) {
+        // Requests left unparsed while a connection's output was full are handled without waiting
+        int n = epoll_wait(ep, events, SERVER_MAX_EVENTS, serverTouchedCount > 0 ? 0 : 1000);
+        if(n < 0 && errno != EINTR) {
+            printf("Error: epoll_wait failed!\n");
+            ok = 0;
+        }
+        for(int i = 0; i < n && ok; i++) {
+            ServerConn *conn = (ServerConn*)events[i].data.ptr;
+    
+            // New sessions; running out of descriptors pauses accepting until one closes
+            if(conn == NULL) {
+                for(;;) {
+                    int fd = accept(listenFd, NULL, NULL);
+                    if(fd < 0) {
+                        if(errno == EMFILE || errno == ENFILE) {
+                            epoll_ctl(ep, EPOLL_CTL_DEL, listenFd, NULL);
+                            listening = 0;
+                            pausedAt = open;
+                        }
+                        break;
+                    }
+                    ServerConn *c = (ServerConn*)calloc(1, sizeof(ServerConn));
+                    if(c == NULL) {
+                        close(fd);
+                        break;
+                    }
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    c->fd = fd;
+                    c->events = EPOLLIN;
+                    if(family == AF_INET)
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                    accepted++;
+                    if(++open > peak)
+                        peak = open;
+                }
+                continue;
+            }
+    
+            if((events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && !serverSend(conn))
+                conn->closing = 1;
+            if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->closing &&
+               conn->inUsed < SERVER_IN_BUFFER) {
+                long got = recv(conn->fd, conn->in + conn->inUsed, SERVER_IN_BUFFER - conn->inUsed, 0);
+                if(got > 0)
+                    conn->inUsed += (int)got;
+                else if(got == 0 || (errno != EAGAIN && errno != EINTR))
+                    conn->closing = 1;
+            }
+            ok = serverParse(conn, &applied, &rejected);
+            if(!conn->pending && ok) {
+                // Nothing of this connection waits for the commit, so it can be settled right away
+                if(conn->closing && conn->outReady == 0) {
+                    close(conn->fd);
+                    free(conn);
+                    open--;
+                } else if(!serverWatch(ep, conn)) {
+                    conn->closing = 1;
+                }
+            }
+        }
+    
+        // End of the tick: one commit covers every request above, then the responses go out
+        if(ok && !serverCommit())
+            ok = 0;
+        if(ok && !serverDeliver(&applied, &rejected))
+            ok = 0;
+        // Everything applied so far is now in the data file, so this is a consistent snapshot point
+        if(ok)
+            snapshotTick();
+        // A connection parsed again below is pushed back onto the list at an index no higher than
+        // the entry being handled, so the list can be refilled while it is walked
+        int touched = serverTouchedCount;
+        serverTouchedCount = 0;
+        for(int i = 0; i < touched && ok; i++) {
+            ServerConn *conn = serverTouched[i];
+            conn->pending = 0;
+            conn->outReady = conn->outUsed;
+            if(!serverSend(conn))
+                conn->closing = 1;
+            // Input that waited for room in the output is taken up again (and committed next tick)
+            if(!conn->closing)
+                ok = serverParse(conn, &applied, &rejected);
+            if(conn->closing && !conn->pending) {
+                close(conn->fd);
+                free(conn);
+                open--;
+            } else if(!conn->pending && !serverWatch(ep, conn)) {
+                conn->closing = 1;
+            }
+        }
+        if(!listening && open < pausedAt) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            listening = epoll_ctl(ep, EPOLL_CTL_ADD, listenFd, &ev) == 0;
+        }
+    }
+    
+    if(!ok)
+        printf("Error: Journal or data file write failed; stopping the server!\n");
+    else
+        ok = serverCommit();
+    ok = serverDeliver(&applied, &rejected) && ok;
+    double seconds = (nowMicros() - started) / 1000000.0;
+    printf("Server stopped after %.1f s: %lld connections (%d at peak), %lld requests (%lld applied, %lld rejected)\n",
+           seconds, accepted, peak, applied + rejected, applied, rejected);
+    serverShardsStop();
+    
+    close(listenFd);
+    if(family == AF_UNIX)
+        unlink(address);
+    journalGroupRecords = JOURNAL_GROUP_RECORDS;
+    if(ok && !journalCheckpoint())
+        ok = 0;
+    free(serverTouched);
+    free(serverRows);
+    serverTouched = NULL;
+    serverRows = NULL;
+    tableFree();
+    return ok;
+}
+
+// Load generator phases: every connection creates an account, funds it, sends its share of the
+// deposit/withdraw/remittance mix, and finally deletes the account again
+#define CLIENT_PHASE_CREATE 0
+#define CLIENT_PHASE_FUND   1
+#define CLIENT_PHASE_MIX    2
+#define CLIENT_PHASE_DELETE 3
+
+// Queues one request of the current phase in a client connection's output
+void clientRequest(ClientConn *c, int index, int phase, const ClientConn *conns, int count) {
+    ServerRequest req;
+    char id[20];
+    int len;
+    
+    // Each connection's account gets ID number LT<index> and the last 4 digits of it as its PIN
+    sprintf(id, "LT%08d", index % 100000000);
+    memset(&req, 0, sizeof(req));
+    req.length = sizeof(req);
+    req.tag = (unsigned int)c->sent;
+    req.account = c->account;
+    memcpy(req.idLast4, id + 6, 4);
+    memcpy(req.pin, id + 6, 4);
+    
+    if(phase == CLIENT_PHASE_CREATE) {
+        req.op = SERVER_OP_CREATE;
+        req.type = (unsigned char)(index % 2);
+        len = sprintf(c->out + c->outUsed + sizeof(req), "load%d", index) + 1;
+        strcpy(c->out + c->outUsed + sizeof(req) + len, id);
+        req.length += (unsigned short)(len + strlen(id) + 1);
+    } else if(phase == CLIENT_PHASE_FUND) {
+        req.op = SERVER_OP_DEPOSIT;
+        req.amount = 1000 * SEN_PER_RM;
+    } else if(phase == CLIENT_PHASE_DELETE) {
+        req.op = SERVER_OP_DELETE;
+    } else {
+        unsigned long long r = nextRandom(&c->rng);
+        int pick = (int)((r >> 32) % 100);
+        req.op = pick < 40 ? SERVER_OP_DEPOSIT : pick < 70 ? SERVER_OP_WITHDRAW : SERVER_OP_REMIT;
+        req.amount = 1 + (Money)((r >> 44) % (500 * SEN_PER_RM));
+        req.toAccount = conns[r % count].account;
+    }
+    memcpy(c->out + c->outUsed, &req, sizeof(req));
+    c->outUsed += req.length;
+}
+
+// Keeps up to depth requests of the phase in flight and sends what the socket takes
+int clientPump(ClientConn *c, int index, int phase, const ClientConn *conns, int count, int depth) {
+    while(c->sent < c->quota && c->sent - c->received < depth &&
+          c->outUsed + SERVER_FRAME_MAX <= SERVER_OUT_BUFFER) {
+        c->sentAt[c->sent % depth] = monotonicNanos();
+        clientRequest(c, index, phase, conns, count);
+        c->sent++;
+    }
+    int done = 0;
+    while(done < c->outUsed) {
+        long n = send(c->fd, c->out + done, c->outUsed - done, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(n <= 0)
+            return 0;
+        done += (int)n;
+    }
+    memmove(c->out, c->out + done, c->outUsed - done);
+    c->outUsed -= done;
+    return 1;
+}
+
+// Runs one phase on every connection until each has had all its responses
+// Latencies of the phase are appended to latencies; returns 0 if a connection failed or stalled
+int clientPhase(int ep, ClientConn *conns, int count, int phase, int depth,
+                long long *latencies, long *latencyCount, long *rejected) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int remaining = 0;
+    
+    for(int i = 0; i < count; i++) {
+        conns[i].sent = conns[i].received = 0;
+        if(conns[i].quota > 0)
+            remaining++;
+        if(!clientPump(&conns[i], i, phase, conns, count, depth))
+            return 0;
+    }
+    while(remaining > 0) {
+        int n = epoll_wait(ep, events, SERVER_MAX_EVENTS, 10000);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR)
+                continue;
+            printf("Error: %s waiting for %d connections!\n", n == 0 ? "Timed out" : "Failed", remaining);
+            return 0;
+        }
+        for(int e = 0; e < n; e++) {
+            ClientConn *c = (ClientConn*)events[e].data.ptr;
+            int index = (int)(c - conns);
+            long got = recv(c->fd, c->in + c->inUsed, SERVER_IN_BUFFER - c->inUsed, 0);
+            if(got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+                printf("Error: The server closed connection %d!\n", index);
+                return 0;
+            }
+            if(got > 0)
+                c->inUsed += (int)got;
+    
+            // Responses come back in request order, so the oldest send time belongs to each one
+            int used = 0;
+            long long now = monotonicNanos();
+            while(c->inUsed - used >= (int)sizeof(ServerResponse)) {
+                ServerResponse resp;
+                memcpy(&resp, c->in + used, sizeof(resp));
+                used += sizeof(resp);
+                if(latencies != NULL)
+                    latencies[(*latencyCount)++] = now - c->sentAt[c->received % depth];
+                if(resp.result != TXN_OK)
+                    (*rejected)++;
+                else if(phase == CLIENT_PHASE_CREATE)
+                    c->account = resp.account;
+                if(++c->received == c->quota)
+                    remaining--;
+            }
+            memmove(c->in, c->in + used, c->inUsed - used);
+            c->inUsed -= used;
+            if(!clientPump(c, index, phase, conns, count, depth))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Load generator: opens connections to a running --serve, then drives every operation through
+// them with depth requests pipelined per connection and reports throughput and latency
+int runLoadTest(const char *address, int connections, long requests, int depth) {
+    static const char *phaseNames[4] = { "Create", "Fund", "Mix", "Delete" };
+    struct sockaddr_storage sa;
+    struct epoll_event ev;
+    socklen_t saLen;
+    int family, ep, one = 1, ok = 1;
+    long rejected = 0, latencyCount = 0;
+    
+    if(!serverAddress(address, &sa, &saLen, &family)) {
+        printf("Error: %s is neither a port nor a usable socket path!\n", address);
+        return 0;
+    }
+    ClientConn *conns = (ClientConn*)calloc(connections, sizeof(ClientConn));
+    long long *latencies = (long long*)malloc((requests + 1) * sizeof(long long));
+    if(conns == NULL || latencies == NULL || (ep = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        printf("Error: Not enough memory for %d connections!\n", connections);
+        free(conns);
+        free(latencies);
+        return 0;
+    }
+    serverRaiseFileLimit();
+    printf("Load test: %d connections to %s, %ld requests, %d in flight per connection\n",
+           connections, address, requests, depth);
+    
+    // Blocking connects, so a full accept queue makes the client wait instead of failing
+    long long started = nowMicros();
+    int opened = 0;
+    for(; opened < connections; opened++) {
+        ClientConn *c = &conns[opened];
+        c->fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(c->fd < 0 || connect(c->fd, (struct sockaddr*)&sa, saLen) != 0) {
+            printf("Error: Connection %d to %s failed!\n", opened + 1, address);
+            if(c->fd >= 0)
+                close(c->fd);
+            ok = 0;
+            break;
+        }
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+        if(family == AF_INET)
+            setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->rng = 0x9E3779B97F4A7C15ull * (unsigned long long)(opened + 1);
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+    printf("  Connect      : %.3f s\n", (nowMicros() - started) / 1000000.0);
+    
+    for(int phase = CLIENT_PHASE_CREATE; phase <= CLIENT_PHASE_DELETE && ok; phase++) {
+        for(int i = 0; i < opened; i++)
+            conns[i].quota = phase != CLIENT_PHASE_MIX ? 1 :
+                             requests / opened + (i < requests % opened ? 1 : 0);
+        started = nowMicros();
+        ok = clientPhase(ep, conns, opened, phase, depth,
+                         phase == CLIENT_PHASE_MIX ? latencies : NULL, &latencyCount, &rejected);
+        double seconds = (nowMicros() - started) / 1000000.0;
+        if(!ok)
+            break;
+        if(phase != CLIENT_PHASE_MIX) {
+            printf("  %-13s: %d requests in %.3f s (%ld rejected)\n", phaseNames[phase], opened, seconds, rejected);
+        } else if(latencyCount > 0) {
+            qsort(latencies, latencyCount, sizeof(long long), benchCompareLatency);
+            printf("  Throughput   : %.0f requests/s (%ld applied, %ld rejected)\n",
+                   seconds > 0 ? latencyCount / seconds : 0.0, latencyCount - rejected, rejected);
+            printf("  Latency (us) : p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+                   benchPercentile(latencies, latencyCount, 0.50), benchPercentile(latencies, latencyCount, 0.99),
+                   benchPercentile(latencies, latencyCount, 0.999), latencies[latencyCount - 1] / 1000.0);
+        }
+        rejected = 0;
+    }
+    
+    for(int i = 0; i < opened; i++)
+        close(conns[i].fd);
+    close(ep);
+    free(conns);
+    free(latencies);
+    return ok;
+}
+
+#else
+
+int runServer(const char *address) {
+    (void)address;
+    printf("Error: Server mode needs Linux (epoll)!\n");
+    return 0;
+}
+
+int runLoadTest(const char *address, int connections, long requests, int depth) {
+    (void)address; (void)connections; (void)requests; (void)depth;
+    printf("Error: The load test needs Linux (epoll)!\n");
+    return 0;
+}
+
+#endif
+
+// Parses a ringgit amount such as "120", "120.5" or "-3.25" into exact sen
+// Returns 0 for anything that is not a plain decimal with at most two fraction digits
+int parseMoney(const char *text, Money *out) {
+    Money whole = 0, frac = 0;
+    int negative = 0, digits = 0, fracDigits = 0;
+    
+    while(*text == ' ') text++;
+    if(*text == '-' || *text == '+') {
+        negative = (*text == '-');
+        text++;
+    }
+    while(isdigit((unsigned char)*text)) {
+        if(++digits > 15)
+            return 0;
+        whole = whole * 10 + (*text++ - '0');
+    }
+    if(*text == '.') {
+        text++;
+        while(isdigit((unsigned char)*text)) {
+            if(++fracDigits > 2)
+                return 0;
+            frac = frac * 10 + (*text++ - '0');
+        }
+    }
+    while(*text == ' ') text++;
+    if(*text != '\0' || digits + fracDigits == 0)
+        return 0;
+    if(fracDigits == 1)
+        frac *= 10;
+    
+    *out = (whole * SEN_PER_RM + frac) * (negative ? -1 : 1);
+    return 1;
+}
+
+// Rounds a float ringgit amount, as version 1 files and journals held them, to the nearest sen;
+// the floats were already off by a fraction of a sen
+Money moneyFromRinggit(float ringgit) {
+    return (Money)(ringgit * 100.0 + (ringgit < 0 ? -0.5 : 0.5));
+}
+
+// Converts a version 1 (float balances) or version 2 (plain PINs) data file to the current layout
+// in place. Version 2 slots that fail their checksum are left as they are, so they stay damaged.
+int storeUpgrade(int version) {
+    for(int slot = 0; slot < storeSlotCount; slot++) {
+        long offset = (long)(slot + 1) * STORE_SLOT_SIZE;
+        StoreSlotV1 v1;
+        StoreSlotV2 v2;
+        StoreSlot fresh;
+        long got = (version == 1) ? storePread(&v1, sizeof(v1), offset) : storePread(&v2, sizeof(v2), offset);
+    
+        if(got != (long)(version == 1 ? sizeof(v1) : sizeof(v2)))
+            return 0;
+        memset(&fresh, 0, sizeof(fresh));
+        fresh.state = (version == 1) ? v1.state : v2.state;
+        if(fresh.state == STORE_SLOT_USED && version == 1) {
+            fresh.acc.accountNumber = v1.acc.accountNumber;
+            strcpy(fresh.acc.accountName, v1.acc.accountName);
+            pinSet(&fresh.acc, v1.acc.pin);
+            fresh.acc.balance = moneyFromRinggit(v1.acc.balance);
+            fresh.acc.status = v1.acc.status;
+            strcpy(fresh.acc.accountType, v1.acc.accountType);
+            strcpy(fresh.acc.idNumber, v1.acc.idNumber);
+        } else if(fresh.state == STORE_SLOT_USED) {
+            if(v2.checksum != storeChecksum(&v2.acc, sizeof(AccountV2)))
+                continue;
+            fresh.acc.accountNumber = v2.acc.accountNumber;
+            memcpy(fresh.acc.accountName, v2.acc.accountName, sizeof(fresh.acc.accountName));
+            pinSet(&fresh.acc, v2.acc.pin);
+            fresh.acc.balance = v2.acc.balance;
+            fresh.acc.status = v2.acc.status;
+            memcpy(fresh.acc.accountType, v2.acc.accountType, sizeof(fresh.acc.accountType));
+            memcpy(fresh.acc.idNumber, v2.acc.idNumber, sizeof(fresh.acc.idNumber));
+        }
+        if(!storeWriteSlot(slot, &fresh))
+            return 0;
+    }
+    return storeSync() && storeWriteHeader() && storeSync();
+}
+
+// Month-end kernel: pays interest and charges maintenance fees over contiguous balance arrays
+//   interest = round(balance * interestBps[type] / 10000) on positive balances
+//   fee      = maintenanceFee for Current accounts below minimumBalance, capped at the balance
+// The fee is assessed on the balance before interest. Returns totals through the out parameters.
+void monthEndScalar(Money *balances, const unsigned char *types, size_t from, size_t end,
+                    const MonthEndRates *rates, Money *interestTotal, Money *feeTotal) {
+    for(size_t i = from; i < end; i++) {
+        Money b = balances[i];
+        Money interest = 0, fee = 0;
+        if(b > 0)
+            interest = (b * rates->interestBps[types[i]] + 5000) / 10000;
+        if(types[i] == ACCOUNT_CURRENT && b < rates->minimumBalance)
+            fee = (b < rates->maintenanceFee) ? (b > 0 ? b : 0) : rates->maintenanceFee;
+        balances[i] = b + interest - fee;
+        *interestTotal += interest;
+        *feeTotal += fee;
+    }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// AVX2 version of monthEndScalar(), four balances per step
+// Interest is computed in double precision, which is exact while balance * rate < 2^53; lanes
+// at or above MONTH_END_SIMD_LIMIT sen are rare and fall back to the scalar path for their group
+__attribute__((target("avx2")))
+void monthEndAvx2(Money *balances, const unsigned char *types, size_t n,
+                  const MonthEndRates *rates, Money *interestTotal, Money *feeTotal) {
+    const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000LL);  // 2^52 as a double
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i limit = _mm256_set1_epi64x(MONTH_END_SIMD_LIMIT);
+    const __m256i currentType = _mm256_set1_epi64x(ACCOUNT_CURRENT);
+    const __m256i minimum = _mm256_set1_epi64x(rates->minimumBalance);
+    const __m256i feeAmount = _mm256_set1_epi64x(rates->maintenanceFee);
+    const __m256d savingsRate = _mm256_set1_pd((double)rates->interestBps[ACCOUNT_SAVINGS]);
+    const __m256d currentRate = _mm256_set1_pd((double)rates->interestBps[ACCOUNT_CURRENT]);
+    const __m256d half = _mm256_set1_pd(5000.0);
+    const __m256d scale = _mm256_set1_pd(10000.0);
+    __m256i interestSum = zero, feeSum = zero;
+    size_t i = 0;
+    
+    for(; i + 4 <= n; i += 4) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)(balances + i));
+        int packedTypes;
+        memcpy(&packedTypes, types + i, 4);
+        __m256i t = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packedTypes));
+    
+        // Every lane must satisfy 0 <= b < limit for the double path to be exact
+        __m256i outOfRange = _mm256_or_si256(_mm256_cmpgt_epi64(zero, b),
+                                             _mm256_cmpgt_epi64(b, _mm256_sub_epi64(limit, _mm256_set1_epi64x(1))));
+        if(!_mm256_testz_si256(outOfRange, outOfRange)) {
+            Money in = 0, fe = 0;
+            monthEndScalar(balances, types, i, i + 4, rates, &in, &fe);
+            interestSum = _mm256_add_epi64(interestSum, _mm256_set_epi64x(0, 0, 0, in));
+            feeSum = _mm256_add_epi64(feeSum, _mm256_set_epi64x(0, 0, 0, fe));
+            continue;
+        }
+    
+        // int64 -> double via the 2^52 trick (valid for 0 <= b < 2^52)
+        __m256d bd = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(b, magicBits)), magic);
+        __m256i isCurrent = _mm256_cmpeq_epi64(t, currentType);
+        __m256d rate = _mm256_blendv_pd(savingsRate, currentRate, _mm256_castsi256_pd(isCurrent));
+        __m256d q = _mm256_floor_pd(_mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(bd, rate), half), scale));
+        // double -> int64 via the same trick in reverse
+        __m256i interest = _mm256_xor_si256(_mm256_castpd_si256(_mm256_add_pd(q, magic)), magicBits);
+    
+        // Fee only for Current lanes below the minimum, never more than the balance itself
+        __m256i below = _mm256_and_si256(isCurrent, _mm256_cmpgt_epi64(minimum, b));
+        __m256i capped = _mm256_blendv_epi8(feeAmount, b, _mm256_cmpgt_epi64(feeAmount, b));
+        __m256i fee = _mm256_and_si256(below, capped);
+    
+        _mm256_storeu_si256((__m256i*)(balances + i), _mm256_sub_epi64(_mm256_add_epi64(b, interest), fee));
+        interestSum = _mm256_add_epi64(interestSum, interest);
+        feeSum = _mm256_add_epi64(feeSum, fee);
+    }
+    
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, interestSum);
+    *interestTotal += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i*)lanes, feeSum);
+    *feeTotal += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    
+    monthEndScalar(balances, types, i, n, rates, interestTotal, feeTotal);
+}
+#endif
+
+// Runs the month-end kernel, using AVX2 when the CPU supports it
+void monthEndKernel(Money *balances, const unsigned char *types, size_t n,
+                    const MonthEndRates *rates, Money *interestTotal, Money *feeTotal) {
+    #if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+        if(__builtin_cpu_supports("avx2")) {
+            monthEndAvx2(balances, types, n, rates, interestTotal, feeTotal);
+            return;
+        }
+    #endif
+    monthEndScalar(balances, types, 0, n, rates, interestTotal, feeTotal);
+}
+
+// Account type code used by the kernel's type array
+unsigned char accountTypeCode(const Account *acc) {
+    return strcmp(acc->accountType, "Current") == 0 ? ACCOUNT_CURRENT : ACCOUNT_SAVINGS;
+}
+
+// Month-end job: gathers active balances into contiguous arrays, runs the kernel over them,
+// journals every changed account and writes the table back
+int runMonthEnd() {
+    MonthEndRates rates;
+    Money interestTotal = 0, feeTotal = 0;
+    Money *balances, *before;
+    unsigned char *types;
+    int *rows;
+    size_t n = 0;
+    int ok = 1;
+    
+    rates.interestBps[ACCOUNT_SAVINGS] = MONTH_END_SAVINGS_BPS;
+    rates.interestBps[ACCOUNT_CURRENT] = MONTH_END_CURRENT_BPS;
+    rates.minimumBalance = MONTH_END_MINIMUM_BALANCE;
+    rates.maintenanceFee = MONTH_END_MAINTENANCE_FEE;
+    
+    if(!tableLoad())
+        return 0;
+    balances = (Money*)malloc((tableRowCount + 1) * sizeof(Money));
+    before = (Money*)malloc((tableRowCount + 1) * sizeof(Money));
+    types = (unsigned char*)malloc(tableRowCount + 1);
+    rows = (int*)malloc((tableRowCount + 1) * sizeof(int));
+    if(balances == NULL || before == NULL || types == NULL || rows == NULL) {
+        printf("Error: Not enough memory for month-end processing!\n");
+        ok = 0;
+    }
+    
+    if(ok) {
+        // Closed accounts neither earn interest nor pay fees
+        for(int i = 0; i < tableRowCount; i++) {
+            Account *acc = &tableRows[i].acc;
+            if(tableRows[i].state != STORE_SLOT_USED || acc->status == 1)
+                continue;
+            balances[n] = acc->balance;
+            before[n] = acc->balance;
+            types[n] = accountTypeCode(acc);
+            rows[n] = i;
+            n++;
+        }
+    
+        long long started = nowMicros();
+        monthEndKernel(balances, types, n, &rates, &interestTotal, &feeTotal);
+        long long kernelMicros = nowMicros() - started;
+    
+        journalGroupRecords = JOURNAL_BUFFER_RECORDS;
+        journalGroupUsec = BATCH_GROUP_USEC;
+        for(size_t i = 0; i < n && ok; i++) {
+            if(balances[i] == before[i])
                 continue;
+            Account *acc = &tableRows[rows[i]].acc;
+            acc->balance = balances[i];
+            tableDirty[rows[i]] = 1;
+            ok = journalAppend(JOURNAL_MONTH_END, acc, NULL, balances[i] - before[i], 0);
+        }
+        journalGroupRecords = JOURNAL_GROUP_RECORDS;
+        journalGroupUsec = JOURNAL_GROUP_USEC;
+        if(ok)
+            ok = tableWriteBack();
+    
+        printf("Month-end complete: %zu accounts, interest RM%.2f, fees RM%.2f (kernel %lld us)\n",
+               n, MONEY_RM(interestTotal), MONEY_RM(feeTotal), kernelMicros);
+        logEvent(LOG_MONTH_END, (int)n, 0, interestTotal, feeTotal, NULL);
+    }
+    
+    free(balances);
+    free(before);
+    free(types);
+    free(rows);
+    tableFree();
+    return ok;
+}
+
+// Parses a count such as 20000, 20k or 1M; returns -1 for anything else
+long parseCount(const char *text) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    
+    if(*end == 'k' || *end == 'K') {
+        value *= 1000;
+        end++;
+    } else if(*end == 'm' || *end == 'M') {
+        value *= 1000000;
+        end++;
+    }
+    return (end != text && *end == '\0' && value > 0) ? value : -1;
+}
+
+// Fills in synthetic account i; the same seed always produces the same population
+void benchMakeAccount(long i, unsigned long long *rng, Account *acc) {
+    unsigned long long r = nextRandom(rng);
+    
+    memset(acc, 0, sizeof(Account));
+    acc->accountNumber = BENCH_FIRST_ACCOUNT + (int)i;
+    sprintf(acc->accountName, "User%ld", i);
+    pinSet(acc, "0000");
+    acc->balance = (Money)(r % (10000 * SEN_PER_RM));       // RM0 - RM9,999.99
+    acc->status = ((r >> 32) % 50 == 0);                    // About 2% closed
+    strcpy(acc->accountType, ((r >> 40) & 1) ? "Current" : "Savings");
+    sprintf(acc->idNumber, "ID%08ld", i);
+}
+
+// Writes the population in the original one-text-file-per-account layout plus index.txt
+// The next initDatabase() migrates it, exactly as it would a real pre-binary database
+long long benchWriteText(long count) {
+    unsigned long long rng = 0x2545F4914F6CDD1Dull;
+    FILE *index = fopen("database/index.txt", "w");
+    char filename[100];
+    long long bytes = 0;
+    Account acc;
+    
+    if(index == NULL)
+        return -1;
+    for(long i = 0; i < count; i++) {
+        benchMakeAccount(i, &rng, &acc);
+        sprintf(filename, "database/%d.txt", acc.accountNumber);
+        FILE *fp = fopen(filename, "w");
+        if(fp == NULL) {
+            fclose(index);
+            return -1;
+        }
+        bytes += fprintf(fp, "Account No: %d\nAccount Name: %s\nPIN: %s\nBalance: %.2f\nStatus: %d\n"
+                         "Account Type: %s\nID Number: %s\n",
+                         acc.accountNumber, acc.accountName, "0000", MONEY_RM(acc.balance),
+                         acc.status, acc.accountType, acc.idNumber);
+        fclose(fp);
+        bytes += fprintf(index, "%d\n", acc.accountNumber);
+    }
+    fclose(index);
+    return bytes;
+}
+
+// Writes the population straight into a fresh data file through the mapping
+long long benchWriteBinary(long count) {
+    unsigned long long rng = 0x2545F4914F6CDD1Dull;
+    
+    if(!storeOpen())
+        return -1;
+    if(!storeReserve((int)count)) {
+        storeClose();
+        return -1;
+    }
+    for(long i = 0; i < count; i++) {
+        StoreSlot *slot = storeSlotAt((int)i);
+        memset(slot, 0, sizeof(StoreSlot));
+        slot->state = STORE_SLOT_USED;
+        benchMakeAccount(i, &rng, &slot->acc);
+        slot->checksum = storeChecksum(&slot->acc, sizeof(Account));
+    }
+    storeSlotCount = (int)count;
+    if(!storeWriteHeader() || !storeSync()) {
+        storeClose();
+        return -1;
+    }
+    storeClose();
+    return (long long)(count + 1) * STORE_SLOT_SIZE;
+}
+
+// Runs one operation down the same path as the menu: load, validate, journal, apply, log
+// Returns 1 when the operation was applied, 0 when the business rules rejected it
+int benchPost(int kind, int from, int to, Money amount) {
+    Account *a = getAccount(from), *b;
+    Money fee;
+    
+    if(a->accountNumber == 0)
+        return 0;
+    if(kind == JOURNAL_DEPOSIT) {
+        if(checkDeposit(a, amount) != TXN_OK)
+            return 0;
+        a->balance += amount;
+        if(!postTransaction(JOURNAL_DEPOSIT, a, NULL, amount, 0))
+            return 0;
+        logEvent(LOG_DEPOSIT, from, 0, amount, 0, NULL);
+    } else if(kind == JOURNAL_WITHDRAW) {
+        if(checkWithdraw(a, amount) != TXN_OK)
+            return 0;
+        a->balance -= amount;
+        if(!postTransaction(JOURNAL_WITHDRAW, a, NULL, amount, 0))
+            return 0;
+        logEvent(LOG_WITHDRAW, from, 0, amount, 0, NULL);
+    } else {
+        b = getAccount(to);
+        if(b->accountNumber == 0)
+            return 0;
+        fee = remittanceFee(a, b, amount);
+        if(checkRemittance(a, b, amount, fee) != TXN_OK)
+            return 0;
+        a->balance -= amount + fee;
+        b->balance += amount;
+        if(!postTransaction(JOURNAL_TRANSFER, a, b, amount, fee))
+            return 0;
+        logEvent(LOG_REMITTANCE, from, to, amount, fee, NULL);
+    }
+    return 1;
+}
+
+// Orders latencies for the percentile report
+int benchCompareLatency(const void *x, const void *y) {
+    long long a = *(const long long*)x, b = *(const long long*)y;
+    return (a > b) - (a < b);
+}
+
+// Latency at quantile q of a sorted sample, in microseconds
+double benchPercentile(long long *sorted, long n, double q) {
+    long i = (long)(q * n + 0.999999) - 1;
+    if(i < 0) i = 0;
+    if(i >= n) i = n - 1;
+    return sorted[i] / 1000.0;
+}
+
+// Enters bench-<accounts>-<format>/ and generates the synthetic population there unless an earlier
+// run already did; returns the bytes generated (0 when reused) or -1 on failure
+long long benchEnterPopulation(long accounts, int textFormat) {
+    char dir[64];
+    long long started, generated = 0;
+    
+    sprintf(dir, "bench-%ld-%s", accounts, textFormat ? "text" : "binary");
+    #ifdef _WIN32
+        mkdir(dir);
+    #else
+        mkdir(dir, 0700);
+    #endif
+    if(chdir(dir) != 0) {
+        printf("Error: Unable to enter benchmark directory %s!\n", dir);
+        return 0;
+    }
+    #ifdef _WIN32
+        mkdir("database");
+    #else
+        mkdir("database", 0700);
+    #endif
+    
+    // A population from an earlier run is reused; text populations have been migrated by then
+    if(access(STORE_FILE, 0) != 0) {
+        started = nowMicros();
+        generated = textFormat ? benchWriteText(accounts) : benchWriteBinary(accounts);
+        if(generated < 0) {
+            printf("Error: Unable to generate the population in %s!\n", dir);
+            return -1;
+        }
+        double seconds = (nowMicros() - started) / 1000000.0;
+        printf("  Population   : generated in %.3f s (%.0f accounts/s, %.1f MB)\n",
+               seconds, seconds > 0 ? accounts / seconds : 0.0, generated / 1048576.0);
+    } else {
+        printf("  Population   : reusing %s/%s\n", dir, STORE_FILE);
+    }
+    return generated;
+}
+
+// Storage benchmark: generates a synthetic population (once per size and format), opens it the
+// way a normal start does, then replays a random deposit/withdraw/remittance mix through the
+// durable menu path and reports throughput, latency percentiles and bytes written per operation
+// Everything happens inside bench-<accounts>-<format>/ so the real database is never touched
+int runBenchmark(long accounts, long ops, int textFormat, const int mix[3]) {
+    unsigned long long rng = 0x9E3779B97F4A7C15ull;
+    long long *latencies = (long long*)malloc(ops * sizeof(long long));
+    long long started, bytesBefore, generated;
+    long applied = 0;
+    
+    if(latencies == NULL || accounts > 2000000000L - BENCH_FIRST_ACCOUNT) {
+        printf("Error: Benchmark size is too large!\n");
+        return 0;
+    }
+    printf("Benchmark: %ld accounts (%s), %ld ops (%d%% deposit, %d%% withdraw, %d%% remittance)\n",
+           accounts, textFormat ? "text" : "binary", ops, mix[0], mix[1], mix[2]);
+    if((generated = benchEnterPopulation(accounts, textFormat)) < 0)
+        return 0;
+    
+    started = nowMicros();
+    initDatabase();
+    printf("  Startup      : %.3f s (%sindex build, journal recovery)\n",
+           (nowMicros() - started) / 1000000.0, generated > 0 && textFormat ? "migration, " : "");
+    printf("  I/O backend  : %s\n", ioBackendName());
+    if(indexCount < accounts)
+        printf("  Note: only %d of %ld accounts are present\n", indexCount, accounts);
+    
+    bytesBefore = atomic_load(&ioBytesWritten);
+    started = nowMicros();
+    for(long i = 0; i < ops; i++) {
+        unsigned long long r = nextRandom(&rng);
+        int from = BENCH_FIRST_ACCOUNT + (int)(r % accounts);
+        int to = BENCH_FIRST_ACCOUNT + (int)((r >> 24) % accounts);
+        Money amount = 1 + (Money)((r >> 44) % (500 * SEN_PER_RM));
+        int pick = (int)((r >> 32) % 100);
+        int kind = (pick < mix[0]) ? JOURNAL_DEPOSIT :
+                   (pick < mix[0] + mix[1]) ? JOURNAL_WITHDRAW : JOURNAL_TRANSFER;
+    
+        long long t0 = monotonicNanos();
+        applied += benchPost(kind, from, to, amount);
+        latencies[i] = monotonicNanos() - t0;
+        arenaReset(&opArena);
+    }
+    double seconds = (nowMicros() - started) / 1000000.0;
+    
+    // Count the checkpoint and every queued log record as part of the run
+    journalCheckpoint();
+    logClose();
+    long long bytes = atomic_load(&ioBytesWritten) - bytesBefore;
+    
+    qsort(latencies, ops, sizeof(long long), benchCompareLatency);
+    printf("  Throughput   : %.0f ops/s (%ld applied, %ld rejected)\n",
+           seconds > 0 ? ops / seconds : 0.0, applied, ops - applied);
+    printf("  Latency (us) : p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           benchPercentile(latencies, ops, 0.50), benchPercentile(latencies, ops, 0.99),
+           benchPercentile(latencies, ops, 0.999), latencies[ops - 1] / 1000.0);
+    printf("  Bytes written: %.1f bytes/op (data file, journal and log)\n", (double)bytes / ops);
+    free(latencies);
+    return 1;
+}
+
+// Search benchmark: opens a generated binary population (building the search index the first time),
+// then times exact ID lookups, ID suffix lookups, name prefix searches and ID ranges against the
+// index, and one linear scan of the name column for comparison
+int runSearchBenchmark(long accounts, long lookups) {
+    const char *kinds[4] = { "ID number", "Last 4 of ID", "Name prefix", "ID range" };
+    unsigned long long rng = 0x5DEECE66Dull;
+    long long *latencies = (long long*)malloc(lookups * sizeof(long long));
+    long long started, matches[4] = { 0, 0, 0, 0 };
+    int slots[LIST_PAGE_SIZE], total;
+    
+    if(latencies == NULL || accounts > 2000000000L - BENCH_FIRST_ACCOUNT) {
+        printf("Error: Benchmark size is too large!\n");
+        free(latencies);
+        return 0;
+    }
+    printf("Search benchmark: %ld accounts, %ld lookups per kind\n", accounts, lookups);
+    if(benchEnterPopulation(accounts, 0) < 0)
+        return 0;
+    
+    started = nowMicros();
+    initDatabase();
+    printf("  Startup      : %.3f s (index build, search index check or rebuild)\n",
+           (nowMicros() - started) / 1000000.0);
+    printf("  Index file   : %.1f MB, %llu keys in %d trees\n",
+           searchHeader()->pageCount * (double)SEARCH_PAGE_SIZE / 1048576.0,
+           searchHeader()->entries, SEARCH_TREES);
+    
+    for(int kind = 0; kind < 4; kind++) {
+        for(long i = 0; i < lookups; i++) {
+            long n = (long)(nextRandom(&rng) % accounts);
+            char low[32], high[32];
+            int tree = SEARCH_BY_ID;
+    
+            // Every key exists in the generated population, so every lookup has at least one match
+            if(kind == 0) {
+                sprintf(low, "ID%08ld", n);
+                strcpy(high, low);
+            } else if(kind == 1) {
+                sprintf(low, "%04ld", n % 10000);
+                strcpy(high, low);
+                tree = SEARCH_BY_ID_LAST4;
+            } else if(kind == 2) {
+                sprintf(low, "User%ld", n);
+                strcpy(high, low);
+                tree = SEARCH_BY_NAME;
+            } else {
+                sprintf(low, "ID%08ld", n);
+                sprintf(high, "ID%08ld", n + LIST_PAGE_SIZE - 1);
             }
-            getchar();
-            return 1;
+            long long t0 = monotonicNanos();
+            searchFind(tree, low, high, slots, LIST_PAGE_SIZE, &total);
+            latencies[i] = monotonicNanos() - t0;
+            matches[kind] += total;
         }
-        else if(selection >= 1 && selection <= count) {
-            *selectedAccountNum = accountNumbers[selection - 1];
-            return 1;
+        qsort(latencies, lookups, sizeof(long long), benchCompareLatency);
+        printf("  %-13s: p50 %.1f us, p99 %.1f us, max %.1f us (%.1f matches each)\n", kinds[kind],
+               benchPercentile(latencies, lookups, 0.50), benchPercentile(latencies, lookups, 0.99),
+               latencies[lookups - 1] / 1000.0, (double)matches[kind] / lookups);
+    }
+    
+    // What a name search cost before the index: compare every name in the column
+    long long t0 = monotonicNanos();
+    total = 0;
+    for(int slot = 0; slot < storeSlotCount; slot++) {
+        char value[64];
+        if(colState[slot] == COLUMN_EMPTY)
+            continue;
+        snprintf(value, sizeof(value), "%s", colText[slot].accountName);
+        for(char *c = value; *c; c++) *c = (char)tolower((unsigned char)*c);
+        total += searchInRange(value, "user1", "user1", sizeof(value));
+    }
+    printf("  Linear scan  : %.1f us for one name prefix over the whole column (%d matches)\n",
+           (monotonicNanos() - t0) / 1000.0, total);
+    free(latencies);
+    return 1;
+}
+
+// PIN verification over a generated population, reusing the --bench directories
+// Every account's PIN is "0000". Each check is timed once with the account's cached state dropped,
+// so it reads the record, and once more straight after, so it is answered from memory.
+int runAuthBenchmark(long accounts, long checks) {
+    const char *kinds[2] = { "From record", "From memory" };
+    long long *latencies = (long long*)malloc(checks * sizeof(long long));
+    int *numbers = (int*)malloc(checks * sizeof(int));
+    unsigned long long rng = 0x9E3779B97F4A7C15ull;
+    long failures = 0;
+    
+    if(latencies == NULL || numbers == NULL || accounts > 2000000000L - BENCH_FIRST_ACCOUNT) {
+        printf("Error: Benchmark size is too large!\n");
+        free(latencies);
+        free(numbers);
+        return 0;
+    }
+    printf("Auth benchmark: %ld accounts, %ld checks of each kind\n", accounts, checks);
+    if(benchEnterPopulation(accounts, 0) < 0)
+        return 0;
+    initDatabase();
+    for(long i = 0; i < checks; i++)
+        numbers[i] = BENCH_FIRST_ACCOUNT + (int)(nextRandom(&rng) % accounts);
+    
+    for(int kind = 0; kind < 2; kind++) {
+        long long hits = authShared.hits, misses = authShared.misses;
+        for(long i = 0; i < checks; i++) {
+            if(kind == 0)
+                authForget(numbers[i]);
+            long long t0 = monotonicNanos();
+            failures += authVerify(numbers[i], "0000") != AUTH_OK;
+            latencies[i] = monotonicNanos() - t0;
         }
-        else {
-            printf("Invalid selection! Please try again.\n");
+        qsort(latencies, checks, sizeof(long long), benchCompareLatency);
+        printf("  %-13s: p50 %.2f us, p99 %.2f us, max %.1f us (%lld hits, %lld misses)\n", kinds[kind],
+               benchPercentile(latencies, checks, 0.50), benchPercentile(latencies, checks, 0.99),
+               latencies[checks - 1] / 1000.0, authShared.hits - hits, authShared.misses - misses);
+    }
+    
+    // Lockout: the third wrong PIN locks the account, which then refuses even the right one
+    int num = numbers[0];
+    int results[AUTH_MAX_FAILURES + 1];
+    for(int i = 0; i < AUTH_MAX_FAILURES; i++)
+        results[i] = authVerify(num, "9999");
+    results[AUTH_MAX_FAILURES] = authVerify(num, "0000");
+    int locked = storeSlotAt(indexLookup(num))->acc.pinLockedUntil != 0;
+    int lockout = results[0] == AUTH_WRONG_PIN && results[AUTH_MAX_FAILURES - 1] == AUTH_LOCKED &&
+                  results[AUTH_MAX_FAILURES] == AUTH_LOCKED && locked;
+    printf("  Lockout      : %s after %d wrong PINs, %s in the record\n",
+           lockout ? "locked" : "NOT locked", AUTH_MAX_FAILURES, locked ? "saved" : "not saved");
+    // Leave the population unlocked for the next run
+    authStoreLock(num, 0);
+    authForget(num);
+    
+    printf("  Result: %s\n", (failures == 0 && lockout) ? "PASS" : "FAIL");
+    free(latencies);
+    free(numbers);
+    return failures == 0 && lockout;
+}
+
+// Counts records handed over by an unindexed scan
+void logCountRecord(const LogRecord *rec, void *ctx) {
+    (void)rec;
+    (*(long long*)ctx)++;
+}
+
+// Log benchmark: writes records through the normal rings and flusher into bench-log-<records>/
+// (once), then times statements for random accounts through the segment indexes, one full scan
+// for comparison, and a replay of 1% of the time span
+int runLogBenchmark(long records, long queries) {
+    char dir[64];
+    unsigned int first, last;
+    unsigned long long rng = 0xD1B54A32D192ED03ull;
+    long long *latencies = (long long*)malloc(queries * sizeof(long long)), scanned = 0, count = 0;
+    LogQueryStats stats;
+    
+    if(latencies == NULL)
+        return 0;
+    sprintf(dir, "bench-log-%ld", records);
+    #ifdef _WIN32
+        mkdir(dir);
+    #else
+        mkdir(dir, 0700);
+    #endif
+    if(chdir(dir) != 0) {
+        printf("Error: Unable to enter benchmark directory %s!\n", dir);
+        return 0;
+    }
+    #ifdef _WIN32
+        mkdir("database");
+    #else
+        mkdir("database", 0700);
+    #endif
+    printf("Log benchmark: %ld records over %d accounts, %ld statements\n", records, BENCH_LOG_ACCOUNTS, queries);
+    
+    if(logListSegments(&first, &last) == 0) {
+        if(!ioInit() || !logOpen()) {
+            printf("Error: Unable to open the log in %s!\n", dir);
+            return 0;
+        }
+        long long started = nowMicros();
+        for(long i = 0; i < records; i++) {
+            unsigned long long r = nextRandom(&rng);
+            int a = BENCH_FIRST_ACCOUNT + (int)(r % BENCH_LOG_ACCOUNTS);
+            int b = BENCH_FIRST_ACCOUNT + (int)((r >> 24) % BENCH_LOG_ACCOUNTS);
+            Money amount = 1 + (Money)((r >> 44) % (500 * SEN_PER_RM));
+            int kind = (int)((r >> 32) % 3);
+            if(kind == 0)
+                logEvent(LOG_DEPOSIT, a, 0, amount, 0, NULL);
+            else if(kind == 1)
+                logEvent(LOG_WITHDRAW, a, 0, amount, 0, NULL);
+            else
+                logEvent(LOG_REMITTANCE, a, b, amount, amount / 50, NULL);
+        }
+        logClose();
+        double seconds = (nowMicros() - started) / 1000000.0;
+        printf("  Written      : %.3f s (%.0f records/s, %.1f MB/s)\n", seconds,
+               seconds > 0 ? records / seconds : 0.0,
+               seconds > 0 ? records * (double)sizeof(LogRecord) / 1048576.0 / seconds : 0.0);
+    } else {
+        printf("  Log          : reusing %s/%s\n", dir, LOG_DIR);
+    }
+    
+    for(long q = 0; q < queries; q++) {
+        int account = BENCH_FIRST_ACCOUNT + (int)(nextRandom(&rng) % BENCH_LOG_ACCOUNTS);
+        long long t0 = monotonicNanos();
+        logQuery(account, LLONG_MIN, LLONG_MAX, 1, logCountRecord, &count, &stats);
+        latencies[q] = monotonicNanos() - t0;
+        scanned += stats.recordsRead;
+    }
+    qsort(latencies, queries, sizeof(long long), benchCompareLatency);
+    printf("  Statement    : p50 %.2f ms, p99 %.2f ms (%.1f records found, %.0f read per statement, %d segments)\n",
+           benchPercentile(latencies, queries, 0.50) / 1000.0, benchPercentile(latencies, queries, 0.99) / 1000.0,
+           (double)count / queries, (double)scanned / queries, stats.segments);
+    
+    // The same statement without the indexes has to read every record
+    long long t0 = monotonicNanos();
+    count = 0;
+    logQuery(BENCH_FIRST_ACCOUNT, LLONG_MIN, LLONG_MAX, 0, logCountRecord, &count, &stats);
+    printf("  Full scan    : %.2f ms for one statement (%lld records read)\n",
+           (monotonicNanos() - t0) / 1e6, stats.recordsRead);
+    
+    // A window of 1% of the logged time span, from the middle of the log
+    long long low = LLONG_MAX, high = LLONG_MIN;
+    logListSegments(&first, &last);
+    for(unsigned int segment = first; segment <= last; segment++) {
+        LogIndexHeader header;
+        char path[64];
+        logSegmentPath(path, sizeof(path), segment, "idx");
+        FILE *ix = fopen(path, "rb");
+        if(ix != NULL && logIndexReadHeader(ix, &header, ULLONG_MAX) && header.records > 0) {
+            if(header.minTime < low) low = header.minTime;
+            if(header.maxTime > high) high = header.maxTime;
+        }
+        if(ix != NULL)
+            fclose(ix);
+    }
+    if(low < high) {
+        long long from = low + (high - low) / 200 * 99, to = low + (high - low) / 200 * 101;
+        t0 = monotonicNanos();
+        count = 0;
+        logQuery(0, from, to, 1, logCountRecord, &count, &stats);
+        printf("  Time range   : %.2f ms for 1%% of the span (%lld records, %lld read)\n",
+               (monotonicNanos() - t0) / 1e6, count, stats.recordsRead);
+    }
+    free(latencies);
+    return 1;
+}
+
+// Random 64-bit key for the account number permutation, drawn once per database
+// Taken from the OS entropy source where there is one, otherwise from the clock and process id
+unsigned long long accountNumberNewSeed() {
+    unsigned long long seed = 0;
+    
+    #ifndef _WIN32
+        int fd = open("/dev/urandom", O_RDONLY);
+        if(fd >= 0) {
+            if(rawRead(fd, &seed, sizeof(seed)) != (long)sizeof(seed))
+                seed = 0;
+            close(fd);
+        }
+        seed ^= (unsigned long long)getpid() << 32;
+    #endif
+    seed ^= (unsigned long long)time(NULL) ^ (unsigned long long)monotonicNanos();
+    
+    // splitmix64 finalizer; 0 is reserved for "no key yet"
+    seed += 0x9E3779B97F4A7C15ull;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBull;
+    seed ^= seed >> 31;
+    return seed ? seed : 1;
+}
+
+// Round function of the Feistel network: mixes one half with the key and round number
+unsigned int accountNumberRound(unsigned int half, int round) {
+    unsigned long long x = half + accountNumberSeed + (unsigned long long)round * 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 33)) * 0xFF51AFD7ED558CCDull;
+    x = (x ^ (x >> 33)) * 0xC4CEB9FE1A85EC53ull;
+    return (unsigned int)(x >> 40) & ((1u << ACCOUNT_NUMBER_HALF) - 1);
+}
+
+// Keyed bijection on [0, ACCOUNT_NUMBER_SPAN): a 4-round Feistel network over 30 bits, re-applied
+// while the result falls outside the span (cycle walking; about 1.07 rounds on average)
+// Distinct positions therefore always give distinct numbers, with no table and no search
+unsigned int accountNumberPermute(unsigned int position) {
+    unsigned int v = position;
+    
+    do {
+        unsigned int left = v >> ACCOUNT_NUMBER_HALF;
+        unsigned int right = v & ((1u << ACCOUNT_NUMBER_HALF) - 1);
+        for(int round = 0; round < 4; round++) {
+            unsigned int next = left ^ accountNumberRound(right, round);
+            left = right;
+            right = next;
+        }
+        v = (left << ACCOUNT_NUMBER_HALF) | right;
+    } while(v >= ACCOUNT_NUMBER_SPAN);
+    return v;
+}
+
+// Hands out the next account number in O(1): position accountNumberNext of the keyed permutation
+// Numbers from before the allocator existed were chosen at random, so the index is still
+// consulted and any such number is skipped; deleted numbers are never handed out again
+int accountNumberAllocate() {
+    while(accountNumberNext < ACCOUNT_NUMBER_SPAN) {
+        int num = ACCOUNT_NUMBER_MIN + (int)accountNumberPermute((unsigned int)accountNumberNext++);
+        if(indexLookup(num) < 0)
+            return num;
+    }
+    return -1;
+}
+
+// Orders account numbers for the uniqueness check
+int compareAccountNumbers(const void *x, const void *y) {
+    int a = *(const int*)x, b = *(const int*)y;
+    return (a > b) - (a < b);
+}
+
+// Bulk onboarding benchmark: allocates count numbers, then checks they are all 7-9 digits and distinct
+int runNumberBenchmark(long count) {
+    int *numbers = (int*)malloc(count * sizeof(int));
+    long duplicates = 0, outOfRange = 0;
+    
+    if(numbers == NULL || count > ACCOUNT_NUMBER_SPAN) {
+        printf("Error: Too many numbers requested!\n");
+        free(numbers);
+        return 0;
+    }
+    accountNumberSeed = accountNumberNewSeed();
+    accountNumberNext = 0;
+    
+    long long started = monotonicNanos();
+    for(long i = 0; i < count; i++)
+        numbers[i] = accountNumberAllocate();
+    double seconds = (monotonicNanos() - started) / 1e9;
+    
+    qsort(numbers, count, sizeof(int), compareAccountNumbers);
+    for(long i = 0; i < count; i++) {
+        if(numbers[i] < ACCOUNT_NUMBER_MIN || numbers[i] > 999999999)
+            outOfRange++;
+        if(i > 0 && numbers[i] == numbers[i - 1])
+            duplicates++;
+    }
+    
+    printf("Account numbers: %ld allocated in %.3f s (%.0f per second, %.1f ns each)\n",
+           count, seconds, seconds > 0 ? count / seconds : 0.0, seconds * 1e9 / count);
+    printf("  Duplicates: %ld, outside 7-9 digits: %ld\n", duplicates, outOfRange);
+    printf("  Result: %s\n", (duplicates == 0 && outOfRange == 0) ? "PASS" : "FAIL");
+    free(numbers);
+    return duplicates == 0 && outOfRange == 0;
+}
+
+// Step number for a BANK_CRASH_AT value, CRASH_NONE when the name is unknown
+int crashPointByName(const char *name) {
+    for(int i = 1; i < CRASH_POINTS; i++)
+        if(name != NULL && strcmp(name, crashPointNames[i]) == 0)
+            return i;
+    return CRASH_NONE;
+}
+
+// Dies on the spot, without flushing or unmapping anything, when point is the armed step
+void crashPoint(int point) {
+    if(crashAt == point)
+        _exit(CRASH_EXIT_CODE);
+}
+
+#ifndef _WIN32
+// Writes a fresh data file holding exactly the given accounts and no journal
+int crashTestSetup(const Account *accounts, int count) {
+    int ok;
+    
+    remove(STORE_FILE);
+    remove(JOURNAL_FILE);
+    if(!storeOpen() || !storeReserve(count)) {
+        storeClose();
+        return 0;
+    }
+    for(int i = 0; i < count; i++) {
+        StoreSlot *slot = storeSlotAt(i);
+        memset(slot, 0, sizeof(StoreSlot));
+        slot->state = STORE_SLOT_USED;
+        slot->acc = accounts[i];
+        slot->checksum = storeChecksum(&slot->acc, sizeof(Account));
+    }
+    storeSlotCount = count;
+    ok = storeWriteHeader() && storeSync();
+    storeClose();
+    return ok;
+}
+
+// Starts the database in a child process, arms point and, when transfer is set, posts a remittance
+// from accounts[0] to accounts[1] down the menu's path. Returns the child's exit status.
+int crashTestChild(int point, int transfer, const Account *accounts, Money amount) {
+    fflush(stdout);
+    pid_t pid = fork();
+    int status;
+    
+    if(pid < 0)
+        return -1;
+    if(pid == 0) {
+        // Recovery crash points must be armed before startup, transfer ones only after it
+        if(!transfer)
+            crashAt = point;
+        initDatabase();
+        if(transfer) {
+            crashAt = point;
+            Account *a = getAccount(accounts[0].accountNumber);
+            Account *b = getAccount(accounts[1].accountNumber);
+            Money fee = remittanceFee(a, b, amount);
+            if(checkRemittance(a, b, amount, fee) != TXN_OK)
+                exit(2);
+            a->balance -= amount + fee;
+            b->balance += amount;
+            if(!postTransaction(JOURNAL_TRANSFER, a, b, amount, fee) || !journalCheckpoint())
+                exit(3);
         }
+        exit(0);
     }
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
 }
 
-// Serializes the in-memory Account struct into a flat text file
-int saveAccount(Account* acc) {
-    char filename[100];
-    sprintf(filename, "database/%d.txt", acc->accountNumber);
-    FILE *fp = fopen(filename, "w");
+// Reads the stored balances of the first count slots and the fee total saved in the header
+// Fails on a missing or damaged record
+int crashTestBalances(Money *balances, int count, Money *fees) {
+    StoreSlot slot;
+    int ok = storeOpen();
     
-    if(fp != NULL) {
-        // Persist each field in a simple key/value format for easy parsing
-        fprintf(fp, "Account No: %d\n", acc->accountNumber);
-        fprintf(fp, "Account Name: %s\n", acc->accountName);
-        fprintf(fp, "PIN: %s\n", acc->pin);
-        fprintf(fp, "Balance: %.2f\n", acc->balance);
-        fprintf(fp, "Status: %d\n", acc->status);
-        fprintf(fp, "Account Type: %s\n", acc->accountType);
-        fprintf(fp, "ID Number: %s\n", acc->idNumber);
-        fclose(fp);
-        return 1;
+    *fees = storeTotals.feesCollected;
+    for(int i = 0; ok && i < count; i++) {
+        ok = storeReadSlot(i, &slot);
+        balances[i] = slot.acc.balance;
     }
-    return 0;
+    storeClose();
+    return ok;
 }
+#endif
 
-// Loads an account from disk into heap memory; caller must free the result
-Account* getAccount(int num) {
-    Account *acc = (Account*)malloc(sizeof(Account));
-    char filename[100];
-    char label[50];
-    sprintf(filename, "database/%d.txt", num);
-    FILE *fp = fopen(filename, "r");
+// Fault-injection test of the remittance commit path: for every step a child process posts one
+// remittance and is killed there (optionally a second time inside recovery), then a clean start
+// recovers. Both balances must end up either untouched or fully transferred, as the step demands.
+int runCrashTest() {
+    #ifdef _WIN32
+        printf("Error: --crash-test needs fork() and is not available on Windows!\n");
+        return 0;
+    #else
+    // Where the remittance dies, where the first recovery dies, and whether the transfer was committed
+    static const int cases[][3] = {
+        { CRASH_NONE,              CRASH_NONE,              1 },
+        { CRASH_BEFORE_JOURNAL,    CRASH_NONE,              0 },
+        { CRASH_JOURNAL_TORN,      CRASH_NONE,              0 },
+        { CRASH_JOURNAL_SYNCED,    CRASH_NONE,              1 },
+        { CRASH_SENDER_APPLIED,    CRASH_NONE,              1 },
+        { CRASH_APPLIED,           CRASH_NONE,              1 },
+        { CRASH_CHECKPOINT_SYNCED, CRASH_NONE,              1 },
+        { CRASH_JOURNAL_SYNCED,    CRASH_RECOVERY_REPLAYED, 1 },
+        { CRASH_SENDER_APPLIED,    CRASH_RECOVERY_REPLAYED, 1 },
+    };
+    Account accounts[2];
+    Money amount = 100 * SEN_PER_RM, fee, balances[2], fees = 0;
+    int failures = 0;
     
-    if(fp != NULL) {
-        fscanf(fp, "%s %s %d\n", label, label, &acc->accountNumber);
-        fscanf(fp, "%s %s %s\n", label, label, acc->accountName);
-        fscanf(fp, "%s %s\n", label, acc->pin);
-        fscanf(fp, "%s %f\n", label, &acc->balance);
-        fscanf(fp, "%s %d\n", label, &acc->status);
-        fscanf(fp, "%s %s %s\n", label, label, acc->accountType);
-        fscanf(fp, "%s %s %s\n", label, label, acc->idNumber);
-        fclose(fp);
-    } else {
-        // Signal missing account by zeroing the account number
-        acc->accountNumber = 0;
+    memset(accounts, 0, sizeof(accounts));
+    accounts[0].accountNumber = ACCOUNT_NUMBER_MIN;
+    strcpy(accounts[0].accountName, "Sender");
+    pinSet(&accounts[0], "0000");
+    accounts[0].balance = 1000 * SEN_PER_RM;
+    strcpy(accounts[0].accountType, "Savings");
+    strcpy(accounts[0].idNumber, "CRASH0");
+    accounts[1] = accounts[0];
+    accounts[1].accountNumber = ACCOUNT_NUMBER_MIN + 1;
+    strcpy(accounts[1].accountName, "Receiver");
+    accounts[1].balance = 500 * SEN_PER_RM;
+    strcpy(accounts[1].accountType, "Current");
+    strcpy(accounts[1].idNumber, "CRASH1");
+    fee = remittanceFee(&accounts[0], &accounts[1], amount);
+    
+    mkdir(CRASH_TEST_DIR, 0700);
+    if(chdir(CRASH_TEST_DIR) != 0) {
+        printf("Error: Unable to enter crash test directory %s!\n", CRASH_TEST_DIR);
+        return 0;
     }
-    return acc;
+    mkdir("database", 0700);
+    
+    printf("Crash test: RM%.2f remittance (fee RM%.2f) killed at each commit step, then recovered\n",
+           MONEY_RM(amount), MONEY_RM(fee));
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int point = cases[i][0], recoveryPoint = cases[i][1], committed = cases[i][2];
+        char label[64];
+        struct stat st;
+        int ok;
+        
+        if(recoveryPoint == CRASH_NONE)
+            snprintf(label, sizeof(label), "%s", crashPointNames[point]);
+        else
+            snprintf(label, sizeof(label), "%s, then %s", crashPointNames[point], crashPointNames[recoveryPoint]);
+        
+        // The injected crashes must actually happen; the last start must finish cleanly
+        ok = crashTestSetup(accounts, 2) &&
+             crashTestChild(point, 1, accounts, amount) == (point == CRASH_NONE ? 0 : CRASH_EXIT_CODE);
+        if(ok && recoveryPoint != CRASH_NONE)
+            ok = crashTestChild(recoveryPoint, 0, accounts, amount) == CRASH_EXIT_CODE;
+        ok = ok && crashTestChild(CRASH_NONE, 0, accounts, amount) == 0 &&
+             crashTestBalances(balances, 2, &fees);
+        
+        // After recovery the journal is empty and the data file alone holds the outcome
+        ok = ok && stat(JOURNAL_FILE, &st) == 0 && st.st_size == 0;
+        int untouched = ok && balances[0] == accounts[0].balance && balances[1] == accounts[1].balance;
+        int transferred = ok && balances[0] == accounts[0].balance - amount - fee &&
+                          balances[1] == accounts[1].balance + amount;
+        // The fee must be counted exactly once, even when recovery replayed an already checkpointed record
+        int passed = committed ? transferred && fees == fee : untouched && fees == 0;
+        
+        printf("  %-40s : %-12s RM%9.2f / RM%9.2f, fees RM%.2f  %s\n", label,
+               transferred ? "transferred" : untouched ? "untouched" : "INCONSISTENT",
+               MONEY_RM(balances[0]), MONEY_RM(balances[1]), MONEY_RM(fees), passed ? "PASS" : "FAIL");
+        failures += !passed;
+    }
+    printf("  Result: %s\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0;
+    #endif
 }
 
 // Creates a brand new account with validated fields and persists it
 void createAccount() {
     Account acc;
-    int num, exists;
-    int digits;
-    FILE *fp;
-    char logMsg[100];
-    
-    srand(time(NULL));
-    digits = 7 + rand() % 3;
-    
-    if(digits == 7)
-        num = 1000000 + rand() % 9000000;
-    else if(digits == 8)
-        num = 10000000 + rand() % 90000000;
-    else
-        num = 100000000 + rand() % 900000000;
-    // Randomize 7-9 digit account numbers to keep IDs unique without manual input
+    char pin[5];
+    int num;
     
-    fp = fopen("database/index.txt", "r");
-    if(fp != NULL) {
-        // Make sure randomly chosen number not already in use
-        while(fscanf(fp, "%d", &exists) == 1) {
-            if(exists == num) {
-                num++;
-                break;
-            }
-        }
-        fclose(fp);
+    // Random-looking 7-9 digit numbers that can never repeat, without manual input
+    num = accountNumberAllocate();
+    if(num < 0) {
+        printf("Failed to create account: no account numbers left!\n");
+        return;
     }
     
     acc.accountNumber = num;
@@ -335,11 +8184,11 @@ void createAccount() {
     // Force numeric PINs with exactly four digits to simplify authentication
     while(1) {
         printf("Enter 4-digit PIN: ");
-        scanf("%4s", acc.pin);
-        if(strlen(acc.pin) == 4) {
+        scanf("%4s", pin);
+        if(strlen(pin) == 4) {
             int valid = 1;
             for(int i = 0; i < 4; i++) {
-                if(!isdigit(acc.pin[i])) {
+                if(!isdigit(pin[i])) {
                     valid = 0;
                     break;
                 }
@@ -349,32 +8198,336 @@ void createAccount() {
         printf("PIN must be exactly 4 digits!\n");
     }
     getchar();
+    pinSet(&acc, pin);
     
-    acc.balance = 0.00;
+    acc.balance = 0;
     acc.status = 0;
     
-    if(saveAccount(&acc)) {
-        // Append new account number to index for quick listing later
-        fp = fopen("database/index.txt", "a");
-        if(fp != NULL) {
-            fprintf(fp, "%d\n", acc.accountNumber);
-            fclose(fp);
-        }
+    if(createAccountRecord(&acc)) {
         displayAccount(&acc);
         printf("Account created successfully!\n");
-        
-        sprintf(logMsg, "create account - Account: %d", acc.accountNumber);
-        logTransaction(logMsg);
     } else {
         printf("Failed to create account!\n");
     }
 }
 
+// Stores a new account whose number and fields are filled in, shared by the menu and the server
+// saveAccount() registers the number in the index, and the header then remembers how far the
+// number allocator has gone
+int createAccountRecord(Account *acc) {
+    if(!saveAccount(acc) || !storeWriteHeader())
+        return 0;
+    logEvent(LOG_CREATE, acc->accountNumber, 0, 0, 0, NULL);
+    return 1;
+}
+
+// Releases the slot on disk and drops the account from the hash and search indexes
+int deleteAccountRecord(Account *acc) {
+    int num = acc->accountNumber;
+    int index = indexLookup(num);
+    
+    if(index < 0 || !storeFreeSlot(index))
+        return 0;
+    indexRemove(num);
+    searchRemoveAccount(index, acc);
+    authForget(num);
+    logEvent(LOG_DELETE, num, 0, 0, 0, NULL);
+    return 1;
+}
+
+// PIN authentication
+// The data file keeps only a salted hash of each PIN and the time a lockout ends. Wrong PINs are
+// counted in memory; the one that completes AUTH_MAX_FAILURES locks the account in its record, so
+// a restart does not lift the lockout. A PIN that verified recently is checked against a copy of
+// the account's salt and hash kept in memory, without reading the record again. A 4-digit PIN has
+// only 10,000 values, so the hash mostly keeps PINs out of the file and the lockout is what stops
+// guessing.
+
+// Salted, stretched hash of a PIN; every round feeds the salt and PIN through the splitmix64 finalizer
+unsigned int pinHashOf(unsigned int salt, const char *pin) {
+    unsigned long long value = 0, h = salt;
+    
+    for(int i = 0; i < 4 && pin[i] != '\0'; i++)
+        value = (value << 8) | (unsigned char)pin[i];
+    for(int round = 0; round < PIN_HASH_ROUNDS; round++) {
+        h += value + 0x9E3779B97F4A7C15ull + ((unsigned long long)salt << 32);
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+        h ^= h >> 31;
+    }
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+// Keyed one-round stand-in for a PIN, kept in memory after it verifies so that repeat checks skip the
+// stretched hash. The finalizer is a bijection, so two different PINs never share a tag.
+unsigned long long pinSessionTag(const char *pin) {
+    unsigned long long h = 0;
+    
+    for(int i = 0; i < 4 && pin[i] != '\0'; i++)
+        h = (h << 8) | (unsigned char)pin[i];
+    h ^= authSessionKey;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+// Gives an account a fresh random salt and stores the hash of pin; clears any lockout
+// Each thread draws salts from its own generator, so creating accounts takes no lock
+void pinSet(Account *acc, const char *pin) {
+    if(authSalts == 0)
+        authSalts = accountNumberNewSeed();
+    unsigned int salt;
+    do {
+        salt = (unsigned int)(nextRandom(&authSalts) >> 32);
+    } while(salt == 0);
+    acc->pinSalt = salt;
+    acc->pinHash = pinHashOf(salt, pin);
+    acc->pinLockedUntil = 0;
+}
+
+// Entry of an account in an authentication table, added if it is not there yet; NULL if the table
+// cannot grow. Caller must own the table (see authAcquire()).
+AuthEntry* authEntry(AuthTable *table, int num) {
+    if((unsigned int)(table->count + 1) * 2 > table->capacity) {
+        unsigned int capacity = table->capacity ? table->capacity * 2 : INDEX_MIN_CAPACITY;
+        AuthEntry *entries = (AuthEntry*)calloc(capacity, sizeof(AuthEntry));
+        if(entries == NULL)
+            return NULL;
+        for(unsigned int i = 0; i < table->capacity; i++) {
+            if(table->entries[i].accountNumber == 0)
+                continue;
+            unsigned int b = indexHash(table->entries[i].accountNumber) & (capacity - 1);
+            while(entries[b].accountNumber != 0)
+                b = (b + 1) & (capacity - 1);
+            entries[b] = table->entries[i];
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+    
+    unsigned int b = indexHash(num) & (table->capacity - 1);
+    while(table->entries[b].accountNumber != 0 && table->entries[b].accountNumber != num)
+        b = (b + 1) & (table->capacity - 1);
+    if(table->entries[b].accountNumber == 0) {
+        memset(&table->entries[b], 0, sizeof(AuthEntry));
+        table->entries[b].accountNumber = num;
+        table->count++;
+    }
+    return &table->entries[b];
+}
+
+// Table holding an account's entry. The shared table comes back with authLock held; a shard table
+// is only used by its own shard, or by the epoll thread while every shard is idle, so it needs none.
+AuthTable* authAcquire(int num) {
+    if(authShards > 0)
+        return &authShardTables[indexHash(num) % (unsigned int)authShards];
+    pthread_mutex_lock(&authLock);
+    return &authShared;
+}
+
+// Gives back a table returned by authAcquire()
+void authRelease(AuthTable *table) {
+    if(table == &authShared)
+        pthread_mutex_unlock(&authLock);
+}
+
+// Moves every entry to where authAcquire() will look for it once the accounts are split over
+// shard tables the same way serverShardOf() splits them, or with 0 back into authShared.
+// No other thread may be verifying PINs meanwhile; an entry that finds no room is dropped.
+void authSplit(int shards) {
+    AuthTable old[1 + SERVER_SHARD_MAX];
+    int tables = 1 + authShards;
+    
+    old[0] = authShared;
+    memcpy(&old[1], authShardTables, authShards * sizeof(AuthTable));
+    memset(&authShared, 0, sizeof(AuthTable));
+    memset(authShardTables, 0, sizeof(authShardTables));
+    // Shards read the session key without a lock, so it is drawn before any of them can
+    if(authSessionKey == 0)
+        authSessionKey = accountNumberNewSeed();
+    authShards = shards;
+    
+    for(int t = 0; t < tables; t++) {
+        for(unsigned int i = 0; i < old[t].capacity; i++) {
+            int num = old[t].entries[i].accountNumber;
+            if(num == 0)
+                continue;
+            AuthTable *table = authAcquire(num);
+            AuthEntry *e = authEntry(table, num);
+            if(e != NULL)
+                *e = old[t].entries[i];
+            authRelease(table);
+        }
+        authShared.hits += old[t].hits;
+        authShared.misses += old[t].misses;
+        free(old[t].entries);
+    }
+}
+
+// Writes a lockout time into the account record; returns its slot, or -1 if the account is gone
+// The server's in-memory table gets the same value, since it later copies whole rows back
+int authWriteLock(int num, unsigned int lockedUntil) {
+    int slot = indexLookup(num);
+    StoreSlot *row;
+    
+    if(slot < 0 || (row = storeSlotAt(slot))->state != STORE_SLOT_USED)
+        return -1;
+    // Shard workers may lock out accounts at the same time
+    pthread_mutex_lock(&authRecordLock);
+    snapshotPreserve(slot);
+    row->acc.pinLockedUntil = lockedUntil;
+    if(tableRows != NULL && slot < tableRowCount) {
+        EngineStripe *stripe = &engineStripes[slot & (ENGINE_LOCK_STRIPES - 1)];
+        pthread_mutex_lock(&stripe->lock);
+        viewPreserve(slot);
+        tableRows[slot].acc.pinLockedUntil = lockedUntil;
+        pthread_mutex_unlock(&stripe->lock);
+    }
+    int ok = storeSlotChanged(slot);
+    pthread_mutex_unlock(&authRecordLock);
+    return ok ? slot : -1;
+}
+
+// Writes a lockout time into the account record and syncs its page, so it survives a crash or restart
+int authStoreLock(int num, unsigned int lockedUntil) {
+    int slot = authWriteLock(num, lockedUntil);
+    return slot >= 0 && storeSyncSlot(slot);
+}
+
+// Checks a PIN; returns AUTH_OK, AUTH_WRONG_PIN, AUTH_LOCKED (already, or by this attempt) or AUTH_NOT_FOUND
+int authVerify(int num, const char *pin) {
+    long long now = nowMicros();
+    unsigned int wallNow = (unsigned int)time(NULL);
+    int result, lockSlot = -1;
+    
+    // Unknown numbers get no entry, so probing them cannot grow the table
+    if(indexLookup(num) < 0)
+        return AUTH_NOT_FOUND;
+    AuthTable *table = authAcquire(num);
+    if(authSessionKey == 0)
+        authSessionKey = accountNumberNewSeed();
+    AuthEntry *e = authEntry(table, num);
+    if(e == NULL) {
+        authRelease(table);
+        return AUTH_NOT_FOUND;
+    }
+    
+    // Credentials come from the record unless a recent verification left a fresh copy here
+    if(now >= e->freshUntil) {
+        int slot = indexLookup(num);
+        StoreSlot *row = (slot >= 0) ? storeSlotAt(slot) : NULL;
+        if(row == NULL || row->state != STORE_SLOT_USED) {
+            authRelease(table);
+            return AUTH_NOT_FOUND;
+        }
+        e->pinSalt = row->acc.pinSalt;
+        e->pinHash = row->acc.pinHash;
+        e->lockedUntil = row->acc.pinLockedUntil;
+        e->freshUntil = now + AUTH_SESSION_USEC;
+        e->sessionTag = 0;
+        table->misses++;
+    } else {
+        table->hits++;
+    }
+    
+    if(e->lockedUntil > wallNow) {
+        authRelease(table);
+        return AUTH_LOCKED;
+    }
+    if(e->failures > 0 && now - e->failedAt > AUTH_FAILURE_USEC)
+        e->failures = 0;
+    
+    // The PIN that verified last is recognised by its tag; anything else goes through the full hash
+    unsigned long long tag = pinSessionTag(pin);
+    if(strlen(pin) == 4 && e->pinSalt != 0 &&
+       ((e->sessionTag != 0 && tag == e->sessionTag) || pinHashOf(e->pinSalt, pin) == e->pinHash)) {
+        e->failures = 0;
+        e->freshUntil = now + AUTH_SESSION_USEC;
+        e->sessionTag = tag;
+        // An expired lockout is only cleared from the record by the next correct PIN
+        if(e->lockedUntil != 0) {
+            e->lockedUntil = 0;
+            lockSlot = authWriteLock(num, 0);
+        }
+        result = AUTH_OK;
+    } else {
+        if(e->failures++ == 0)
+            e->failedAt = now;
+        result = AUTH_WRONG_PIN;
+        if(e->failures >= AUTH_MAX_FAILURES) {
+            e->failures = 0;
+            e->lockedUntil = wallNow + AUTH_LOCKOUT_SECONDS;
+            lockSlot = authWriteLock(num, e->lockedUntil);
+            result = AUTH_LOCKED;
+        }
+    }
+    authRelease(table);
+    // The page is synced once the table is released, so other accounts' checks do not wait on the disk
+    if(lockSlot >= 0)
+        storeSyncSlot(lockSlot);
+    return result;
+}
+
+// Wrong PINs an account may still take before it locks
+int authTriesLeft(int num) {
+    AuthTable *table = authAcquire(num);
+    AuthEntry *e = authEntry(table, num);
+    int left = e ? AUTH_MAX_FAILURES - e->failures : AUTH_MAX_FAILURES;
+    authRelease(table);
+    return left;
+}
+
+// Minutes left on an account's lockout, rounded up
+int authLockMinutes(int num) {
+    AuthTable *table = authAcquire(num);
+    AuthEntry *e = authEntry(table, num);
+    long long left = e ? (long long)e->lockedUntil - (long long)time(NULL) : 0;
+    authRelease(table);
+    return left > 0 ? (int)((left + 59) / 60) : 0;
+}
+
+// Menu PIN entry: asks until the PIN is right or the account locks; returns 1 once verified
+int authPrompt(int num, const char *prompt) {
+    char pin[5];
+    
+    for(;;) {
+        printf("%s", prompt);
+        scanf("%4s", pin);
+        getchar();
+        
+        int result = authVerify(num, pin);
+        if(result == AUTH_OK)
+            return 1;
+        if(result == AUTH_NOT_FOUND) {
+            printf("Account not found!\n");
+            return 0;
+        }
+        if(result == AUTH_LOCKED) {
+            printf("Account locked after %d wrong PINs! Try again in %d minutes.\n",
+                   AUTH_MAX_FAILURES, authLockMinutes(num));
+            return 0;
+        }
+        printf("Wrong PIN! %d tries left.\n", authTriesLeft(num));
+    }
+}
+
+// Forgets everything cached about an account once it has been deleted
+void authForget(int num) {
+    AuthTable *table = authAcquire(num);
+    AuthEntry *e = authEntry(table, num);
+    if(e != NULL) {
+        memset(e, 0, sizeof(AuthEntry));
+        e->accountNumber = num;
+    }
+    authRelease(table);
+}
+
 // Removes an existing account after verifying ID and PIN
 void deleteAccount() {
-    int num, confirm, i;
-    char pin[5], id[5], filename[100];
-    char logMsg[100];
+    int num, confirm;
+    char id[5];
     Account *acc;
     
     if(!listAllAccountsAndSelect(&num)) {
@@ -384,7 +8537,6 @@ void deleteAccount() {
     acc = getAccount(num);
     if(acc->accountNumber == 0) {
         printf("Account not found!\n");
-        free(acc);
         return;
     }
     
@@ -395,75 +8547,38 @@ void deleteAccount() {
     // Compare the provided ID suffix with the stored ID for extra validation
     if(len < 4 || strcmp(&acc->idNumber[len-4], id) != 0) {
         printf("ID verification failed!\n");
-        free(acc);
         return;
     }
     
-    for(i = 0; i < 3; i++) {
-        // Give the user up to three attempts to authenticate
-        printf("Enter PIN: ");
-        scanf("%4s", pin);
-        getchar();
-        
-        if(strcmp(acc->pin, pin) == 0) {
-            displayAccount(acc);
-            
-            if(acc->balance > 0)
-                // Warn operators so they can refund customers before deletion
-                printf("Warning: Balance is RM%.2f\n", acc->balance);
-            
-            printf("Confirm delete? (1=Yes/0=No): ");
-            scanf("%d", &confirm);
-            getchar();
-            
-            if(confirm == 1) {
-                sprintf(filename, "database/%d.txt", acc->accountNumber);
-                remove(filename);
-                
-                FILE *fp1 = fopen("database/index.txt", "r");
-                FILE *fp2 = fopen("database/temp.txt", "w");
-                int tmp;
-                
-                if(fp1 != NULL && fp2 != NULL) {
-                    // Copy all other account numbers into a temp file
-                    while(fscanf(fp1, "%d", &tmp) == 1) {
-                        if(tmp != num)
-                            fprintf(fp2, "%d\n", tmp);
-                    }
-                    fclose(fp1);
-                    fclose(fp2);
-                    // Replace original index atomically
-                    remove("database/index.txt");
-                    rename("database/temp.txt", "database/index.txt");
-                    
-                    printf("Account deleted successfully!\n");
-                    
-                    sprintf(logMsg, "delete account - Account: %d", num);
-                    logTransaction(logMsg);
-                } else {
-                    printf("Error updating index file!\n");
-                    if(fp1) fclose(fp1);
-                    if(fp2) fclose(fp2);
-                }
-            } else {
-                printf("Cancelled.\n");
-            }
-            free(acc);
-            return;
+    if(!authPrompt(num, "Enter PIN: "))
+        return;
+    
+    displayAccount(acc);
+    
+    if(acc->balance > 0)
+        // Warn operators so they can refund customers before deletion
+        printf("Warning: Balance is RM%.2f\n", MONEY_RM(acc->balance));
+    
+    printf("Confirm delete? (1=Yes/0=No): ");
+    scanf("%d", &confirm);
+    getchar();
+    
+    if(confirm == 1) {
+        if(deleteAccountRecord(acc)) {
+            printf("Account deleted successfully!\n");
+        } else {
+            printf("Error updating account data file!\n");
         }
-        if(i < 2)
-            printf("Wrong PIN! %d tries left.\n", 2-i);
+    } else {
+        printf("Cancelled.\n");
     }
-    printf("Max attempts exceeded.\n");
-    free(acc);
 }
 
 // Adds funds to an active account after authenticating via PIN
 void deposit() {
-    int num, i;
-    char pin[5];
-    float amount;
-    char logMsg[100];
+    int num;
+    Money amount;
+    char amountText[32];
     Account *acc;
     
     if(!listAllAccountsAndSelect(&num)) {
@@ -473,79 +8588,62 @@ void deposit() {
     acc = getAccount(num);
     if(acc->accountNumber == 0) {
         printf("Account not found!\n");
-        free(acc);
         return;
     }
     
     // Refuse deposits into closed accounts to maintain audit integrity
     if(acc->status == 1) {
         printf("Account closed!\n");
-        free(acc);
         return;
     }
     
-    for(i = 0; i < 3; i++) {
-        printf("Enter PIN: ");
-        scanf("%4s", pin);
+    if(!authPrompt(num, "Enter PIN: "))
+        return;
+    
+    displayAccount(acc);
+    
+    while(1) {
+        // Enforce numeric input, positive amount, and max limit
+        printf("Deposit amount (Max RM50,000): RM");
+        if(scanf("%31s", amountText) != 1 || !parseMoney(amountText, &amount)) {
+            printf("Invalid input! Please enter an amount such as 120.50\n");
+            while(getchar() != '\n');
+            continue;
+        }
         getchar();
         
-        if(strcmp(acc->pin, pin) == 0) {
-            displayAccount(acc);
-            
-            while(1) {
-                // Enforce numeric input, positive amount, and max limit
-                printf("Deposit amount (Max RM50,000): RM");
-                if(scanf("%f", &amount) != 1) {
-                    printf("Invalid input! Please enter a number.\n");
-                    while(getchar() != '\n');
-                    continue;
-                }
-                getchar();
-                
-                if(amount <= 0) {
-                    printf("Amount must be greater than RM0!\n");
-                    continue;
-                }
-                
-                if(amount > 50000) {
-                    printf("Amount exceeds maximum limit of RM50,000!\n");
-                    continue;
-                }
-                
-                break;
-            }
-            
-            // At this point validation passed, so we can safely credit the funds
-            acc->balance += amount;
-            
-            if(!saveAccount(acc)) {
-                printf("Error: Failed to update account!\n");
-                free(acc);
-                return;
-            }
-            
-            displayAccount(acc);
-            printf("Deposit successful!\n");
-            
-            sprintf(logMsg, "deposit - Account: %d, Amount: RM%.2f", num, amount);
-            logTransaction(logMsg);
-            
-            free(acc);
-            return;
+        if(amount <= 0) {
+            printf("Amount must be greater than RM0!\n");
+            continue;
+        }
+        
+        if(amount > MAX_DEPOSIT_AMOUNT) {
+            printf("Amount exceeds maximum limit of RM50,000!\n");
+            continue;
         }
-        if(i < 2)
-            printf("Wrong PIN! %d tries left.\n", 2-i);
+        
+        break;
+    }
+    
+    // At this point validation passed, so we can safely credit the funds
+    acc->balance += amount;
+    
+    if(!postTransaction(JOURNAL_DEPOSIT, acc, NULL, amount, 0)) {
+        printf("Error: Failed to update account!\n");
+        return;
     }
-    printf("Max attempts exceeded.\n");
-    free(acc);
+    
+    displayAccount(acc);
+    printf("Deposit successful!\n");
+    
+    logEvent(LOG_DEPOSIT, num, 0, amount, 0, NULL);
 }
 
 // Deducts funds from an active account while preventing overdrafts
 void withdraw() {
-    int num, i;
-    char pin[5];
-    float amount;
-    char logMsg[100];
+    int num;
+    Money amount;
+    char amountText[32];
     Account *acc;
     
     if(!listAllAccountsAndSelect(&num)) {
@@ -555,80 +8653,63 @@ void withdraw() {
     acc = getAccount(num);
     if(acc->accountNumber == 0) {
         printf("Account not found!\n");
-        free(acc);
         return;
     }
     
     // Withdrawal cannot continue once the account is marked closed
     if(acc->status == 1) {
         printf("Account closed!\n");
-        free(acc);
         return;
     }
     
-    for(i = 0; i < 3; i++) {
-        printf("Enter PIN: ");
-        scanf("%4s", pin);
+    if(!authPrompt(num, "Enter PIN: "))
+        return;
+    
+    displayAccount(acc);
+    printf("Available balance: RM%.2f\n", MONEY_RM(acc->balance));
+    
+    while(1) {
+        // Keep prompting until the requested amount is valid
+        printf("Withdraw amount: RM");
+        if(scanf("%31s", amountText) != 1 || !parseMoney(amountText, &amount)) {
+            printf("Invalid input! Please enter an amount such as 120.50\n");
+            while(getchar() != '\n');
+            continue;
+        }
         getchar();
         
-        if(strcmp(acc->pin, pin) == 0) {
-            displayAccount(acc);
-            printf("Available balance: RM%.2f\n", acc->balance);
-            
-            while(1) {
-                // Keep prompting until the requested amount is valid
-                printf("Withdraw amount: RM");
-                if(scanf("%f", &amount) != 1) {
-                    printf("Invalid input! Please enter a number.\n");
-                    while(getchar() != '\n');
-                    continue;
-                }
-                getchar();
-                
-                if(amount <= 0) {
-                    printf("Invalid amount! Must be greater than RM0.\n");
-                    continue;
-                }
-                
-                if(amount > acc->balance) {
-                    printf("Insufficient funds! Available: RM%.2f\n", acc->balance);
-                    continue;
-                }
-                
-                break;
-            }
-            
-            // Debit the balance only after confirming sufficient funds
-            acc->balance -= amount;
-            
-            if(!saveAccount(acc)) {
-                printf("Error: Failed to update account!\n");
-                free(acc);
-                return;
-            }
-            
-            displayAccount(acc);
-            printf("Withdrawal successful!\n");
-            
-            sprintf(logMsg, "withdrawal - Account: %d, Amount: RM%.2f", num, amount);
-            logTransaction(logMsg);
-            
-            free(acc);
-            return;
+        if(amount <= 0) {
+            printf("Invalid amount! Must be greater than RM0.\n");
+            continue;
         }
-        if(i < 2)
-            printf("Wrong PIN! %d tries left.\n", 2-i);
+        
+        if(amount > acc->balance) {
+            printf("Insufficient funds! Available: RM%.2f\n", MONEY_RM(acc->balance));
+            continue;
+        }
+        
+        break;
+    }
+    
+    // Debit the balance only after confirming sufficient funds
+    acc->balance -= amount;
+    
+    if(!postTransaction(JOURNAL_WITHDRAW, acc, NULL, amount, 0)) {
+        printf("Error: Failed to update account!\n");
+        return;
     }
-    printf("Max attempts exceeded.\n");
-    free(acc);
+    
+    displayAccount(acc);
+    printf("Withdrawal successful!\n");
+    
+    logEvent(LOG_WITHDRAW, num, 0, amount, 0, NULL);
 }
 
 // Transfers funds between two accounts and applies conditional fees
 void remittance() {
-    int sender, receiver, i;
-    char pin[5];
-    float amount, fee = 0;
-    char logMsg[200];
+    int sender, receiver;
+    Money amount, fee = 0;
+    char amountText[32];
     Account *acc1, *acc2;
     
     printf("=== Select Sender Account ===\n");
@@ -653,122 +8734,87 @@ void remittance() {
     // Validate both endpoints exist on disk before moving any money
     if(acc1->accountNumber == 0) {
         printf("Sender account not found!\n");
-        free(acc1);
-        free(acc2);
         return;
     }
     
     if(acc2->accountNumber == 0) {
         printf("Receiver account not found!\n");
-        free(acc1);
-        free(acc2);
         return;
     }
     
     if(acc1->status == 1) {
         printf("Sender account is closed!\n");
-        free(acc1);
-        free(acc2);
         return;
     }
     
     if(acc2->status == 1) {
         printf("Receiver account is closed!\n");
-        free(acc1);
-        free(acc2);
         return;
     }
     
-    for(i = 0; i < 3; i++) {
-        // Sender must pass PIN check before funds can move
-        printf("Enter sender PIN: ");
-        scanf("%4s", pin);
+    // Sender must pass PIN check before funds can move
+    if(!authPrompt(sender, "Enter sender PIN: "))
+        return;
+    
+    displayAccount(acc1);
+    
+    while(1) {
+        // Validate amount and calculate any dynamic fees
+        printf("\nEnter transfer amount: RM");
+        if(scanf("%31s", amountText) != 1 || !parseMoney(amountText, &amount)) {
+            printf("Invalid input! Please enter an amount such as 120.50\n");
+            while(getchar() != '\n');
+            continue;
+        }
         getchar();
         
-        if(strcmp(acc1->pin, pin) == 0) {
-            displayAccount(acc1);
-            
-            while(1) {
-                // Validate amount and calculate any dynamic fees
-                printf("\nEnter transfer amount: RM");
-                if(scanf("%f", &amount) != 1) {
-                    printf("Invalid input! Please enter a number.\n");
-                    while(getchar() != '\n');
-                    continue;
-                }
-                getchar();
-                
-                if(amount <= 0) {
-                    printf("Invalid amount! Must be greater than RM0.\n");
-                    continue;
-                }
-                
-                if(strcmp(acc1->accountType, "Savings") == 0 && 
-                   strcmp(acc2->accountType, "Current") == 0) {
-                    // Savings → Current incurs 2% fee per business rules
-                    fee = amount * 0.02;
-                    printf("Remittance fee (2%%): RM%.2f\n", fee);
-                } 
-                else if(strcmp(acc1->accountType, "Current") == 0 && 
-                        strcmp(acc2->accountType, "Savings") == 0) {
-                    // Current → Savings incurs a slightly higher 3% fee
-                    fee = amount * 0.03;
-                    printf("Remittance fee (3%%): RM%.2f\n", fee);
-                }
-                else {
-                    // Same-type transfers are free
-                    printf("No remittance fee applied.\n");
-                }
-                
-                if(acc1->balance < amount + fee) {
-                    printf("Insufficient funds! Need: RM%.2f (including fee)\n", amount + fee);
-                    printf("Available: RM%.2f\n", acc1->balance);
-                    char retry;
-                    printf("Try different amount? (y/n): ");
-                    scanf(" %c", &retry);
-                    getchar();
-                    if(retry == 'y' || retry == 'Y') {
-                        continue;
-                    } else {
-                        free(acc1);
-                        free(acc2);
-                        return;
-                    }
-                }
-                
-                break;
-            }
-            
-            acc1->balance -= (amount + fee);
-            acc2->balance += amount;
-            
-            if(!saveAccount(acc1) || !saveAccount(acc2)) {
-                printf("Error: Failed to update accounts!\n");
-                free(acc1);
-                free(acc2);
+        if(amount <= 0) {
+            printf("Invalid amount! Must be greater than RM0.\n");
+            continue;
+        }
+        
+        // Savings → Current costs 2%, Current → Savings 3%, same-type transfers are free
+        fee = remittanceFee(acc1, acc2, amount);
+        if(fee > 0) {
+            printf("Remittance fee (%d%%): RM%.2f\n", remittanceFeePercent(acc1, acc2), MONEY_RM(fee));
+        }
+        else {
+            printf("No remittance fee applied.\n");
+        }
+        
+        if(acc1->balance < amount + fee) {
+            printf("Insufficient funds! Need: RM%.2f (including fee)\n", MONEY_RM(amount + fee));
+            printf("Available: RM%.2f\n", MONEY_RM(acc1->balance));
+            char retry;
+            printf("Try different amount? (y/n): ");
+            scanf(" %c", &retry);
+            getchar();
+            if(retry == 'y' || retry == 'Y') {
+                continue;
+            } else {
                 return;
             }
-            
-            printf("\n--- Sender Account ---\n");
-            displayAccount(acc1);
-            printf("\n--- Receiver Account ---\n");
-            displayAccount(acc2);
-            printf("\nRemittance successful!\n");
-            
-            sprintf(logMsg, "remittance - From: %d to %d, Amount: RM%.2f, Fee: RM%.2f", 
-                    sender, receiver, amount, fee);
-            logTransaction(logMsg);
-            
-            free(acc1);
-            free(acc2);
-            return;
         }
-        if(i < 2)
-            printf("Wrong PIN! %d tries left.\n", 2-i);
+        
+        break;
+    }
+    
+    acc1->balance -= (amount + fee);
+    acc2->balance += amount;
+    
+    // Both balances go into one journal record so the transfer is all-or-nothing
+    if(!postTransaction(JOURNAL_TRANSFER, acc1, acc2, amount, fee)) {
+        printf("Error: Failed to update accounts!\n");
+        return;
     }
-    printf("Max attempts exceeded.\n");
-    free(acc1);
-    free(acc2);
+    
+    printf("\n--- Sender Account ---\n");
+    displayAccount(acc1);
+    printf("\n--- Receiver Account ---\n");
+    displayAccount(acc2);
+    printf("\nRemittance successful!\n");
+    
+    logEvent(LOG_REMITTANCE, sender, receiver, amount, fee, NULL);
 }
 
 // User input to the right operation based on menu selection
@@ -778,10 +8824,15 @@ void mainMenu() {
     
     while(1) {
         // Loop indefinitely until operator chooses to exit
+        // Accounts loaded by the previous operation are released together here
+        arenaReset(&opArena);
+        // Between operations every change is in the data file, so a snapshot may start here
+        snapshotTick();
         printf("\n+========================================+\n");
         printf("| 1. Deposit    | 4. Create  Account     |\n");
         printf("| 2. Withdraw   | 5. Delete  Account     |\n");
-        printf("| 3. Remittance | 0. Exit  System        |\n");
+        printf("| 3. Remittance | 6. Session Info        |\n");
+        printf("| 7. Find       | 0. Exit  System        |\n");
         printf("+========================================+\n");
         printf("Please select (number or keyword): ");
         
@@ -813,11 +8864,18 @@ void mainMenu() {
         else if(strcmp(input, "5") == 0 || strcmp(input, "delete") == 0 || 
                 strcmp(input, "remove") == 0)
             deleteAccount();
+        else if(strcmp(input, "6") == 0 || strcmp(input, "session") == 0 || 
+                strcmp(input, "info") == 0)
+            showSession();
+        else if(strcmp(input, "7") == 0 || strcmp(input, "find") == 0 || 
+                strcmp(input, "search") == 0)
+            searchAccounts(NULL);
         else if(strcmp(input, "0") == 0 || strcmp(input, "exit") == 0 || 
                 strcmp(input, "quit") == 0) {
             printf("==============================================\n");
             printf("Thank you for using Banking System. Goodbye!\n");
             logTransaction("exit system");
+            journalCheckpoint();
             exit(0);
         }
         else {